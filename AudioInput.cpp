@@ -4,30 +4,26 @@
 
 // Destructor to close the input context
 AudioInput::~AudioInput() {
+    this->captureThread.join(); // The loop uses the input context
     avformat_close_input(&this->inputContext);
 }
 
 // Reads a frame of audio data
 bool AudioInput::readFrame(av::Frame& frame) {
-    av::Packet packet;
-
     while (true) {
-        packet.dataUnref(); // Unreference any existing data in the packet
-        auto successExp = this->readPacket(packet); // Read a packet from input
+        this->packet.dataUnref(); // Unreference any existing data in the packet
+        auto successExp = this->readPacket(this->packet); // Read a packet from input
         if (!successExp) {
-            std::cerr << "Can't read packet" << std::endl; // Error reading packet
+            LOG_AV_ERROR_EVERY(1000, "Can't read packet"); // Error reading packet
         }
 
-        shared_ptr<av::Decoder> dec;
-
         // Check if the packet belongs to the audio stream
-        if (std::get<0>(this->stream) && packet.native()->stream_index == std::get<0>(this->stream)->index) {
-            dec = std::get<1>(this->stream);
-            av_packet_rescale_ts(*packet, std::get<0>(this->stream)->time_base, dec->native()->time_base); // Rescale packet timestamps
-            auto resExp = dec->decode(packet, frame); // Decode the packet into a frame
+        if (std::get<0>(this->stream) && this->packet.native()->stream_index == std::get<0>(this->stream)->index) {
+            auto& dec = std::get<1>(this->stream); // Packet timestamps stay in the stream time base
+            auto resExp = dec->decode(this->packet, frame); // Decode the packet into a frame
 
             if (!resExp) {
-                std::cerr << "Can't decode audio packet" << std::endl; // Error decoding packet
+                LOG_AV_ERROR("Can't decode audio packet"); // Error decoding packet
                 return false;
             }
 
@@ -39,7 +35,7 @@ bool AudioInput::readFrame(av::Frame& frame) {
 
             return true; // Successfully read an audio frame
         } else {
-            std::cerr << "Unknown stream index " << packet.native()->stream_index << std::endl; // Unrecognized stream index
+            LOG_AV_ERROR_EVERY(1000, "Unknown stream index {}", this->packet.native()->stream_index); // Unrecognized stream index
             continue;
         }
     }
@@ -66,15 +62,47 @@ int AudioInput::getSampleRate() {
     return std::get<1>(this->stream)->native()->sample_rate;
 }
 
+// Add this input to the mixer of the session
+bool AudioInput::attachMixer(std::shared_ptr<av::AudioMixer> mixer, const float gain, const int streamIndex) {
+    auto sourceExp = mixer->addSource(this->getChannelsNumber(), this->getSampleFormat(), this->getSampleRate(), gain); // Converted to the mixer format
+    if (!sourceExp) {
+        std::cerr << "Can't mix audio input '" << this->device << "': " << sourceExp.errorString() << std::endl; // Error adding the source
+        return false;
+    }
+    this->mixer = mixer;
+    this->mixerSource = sourceExp.value();
+    this->trackIndex = streamIndex; // The mix, written by whichever source completes a frame
+    return true;
+}
+
+// Write this input to a track of its own
+void AudioInput::attachTrack(const int streamIndex) {
+    this->mixer.reset(); // Not mixed
+    this->trackIndex = streamIndex;
+}
+
+// Drop the captured frames until recording starts
+void AudioInput::setStandby(const bool enable) {
+    this->standby = enable;
+}
+
+// Get the number of overruns seen so far
+uint64_t AudioInput::getXruns() {
+    return this->xruns.load(std::memory_order_relaxed);
+}
+
 // Launch the recording thread asynchronously
 std::future<void> AudioInput::launchRecordThread(bool* isStopped, bool* onPause) {
+    if (this->realtime) { // Dedicated thread, above the encoders
+        return this->captureThread.launch("audio capture", CaptureThread::Priority::Audio, this->captureCpu, [this, isStopped, onPause] { this->record(isStopped, onPause); });
+    }
     return std::async(std::launch::async, [this, isStopped, onPause] { this->record(isStopped, onPause); });
 }
 
 // Create an AudioInput instance for reading audio
-std::shared_ptr<AudioInput> AudioInput::getAudioReader(std::shared_ptr<av::StreamWriter> writer) {
+std::shared_ptr<AudioInput> AudioInput::getAudioReader(const std::string& device, const CaptureOptions& options, std::shared_ptr<SessionClock> clock, std::shared_ptr<av::StreamWriter> writer) {
     std::shared_ptr<AudioInput> res{ new AudioInput{} };
-    if (!res->init(writer)) {
+    if (!res->init(device, options, clock, writer)) {
         return nullptr; // Return nullptr if initialization fails
     }
     return res; // Return the created AudioInput instance
@@ -88,6 +116,14 @@ AudioInput::AudioInput() {
     this->inputFormat = nullptr;
     this->opts = nullptr;
     this->writer = nullptr;
+    this->mixerSource = -1;
+    this->trackIndex = -1;
+    this->expectedPts = AV_NOPTS_VALUE;
+    this->xruns = 0;
+    this->realtime = false;
+    this->captureCpu = -1;
+    this->fastOpen = false;
+    this->standby = false;
 }
 
 // Reads a packet from the audio input
@@ -109,7 +145,7 @@ bool AudioInput::readPacket(av::Packet& packet) {
         }
 
         if (err < 0) {
-            std::cerr << "Failed to read frame: " << av::avErrorStr(err) << std::endl; // Error reading frame
+            LOG_AV_ERROR_EVERY(1000, "Failed to read frame: {}", av::avErrorStr(err)); // Error reading frame
             return false;
         }
 
@@ -117,9 +153,14 @@ bool AudioInput::readPacket(av::Packet& packet) {
     }
 }
 
-// Initialize the AudioInput with a StreamWriter
-bool AudioInput::init(std::shared_ptr<av::StreamWriter> writer) {
+// Initialize the AudioInput on a device with the session clock and a StreamWriter
+bool AudioInput::init(const std::string& device, const CaptureOptions& options, std::shared_ptr<SessionClock> clock, std::shared_ptr<av::StreamWriter> writer) {
+    this->device = device; // Capture device, empty for the platform default
+    this->realtime = options.realtimeCapture; // Capture thread scheduling
+    this->captureCpu = options.captureCpu;
+    this->fastOpen = options.fastOpen; // Trust the device header instead of probing
     this->writer = writer;
+    this->clock = clock; // Clock the captured frames are stamped with
     this->inputContext = avformat_alloc_context(); // Allocate input context
     if (!this->openInput()) {
         return false; // Return false if input opening fails
@@ -152,6 +193,21 @@ bool AudioInput::findBestStream(AVMediaType type) {
     return true; // Successfully found the best stream
 }
 
+// Count a lost stretch of samples: the device timestamps jump past the end of the previous frame
+void AudioInput::countXrun(av::Frame& frame) {
+    const auto pts = frame.native()->pts;
+    if (pts == AV_NOPTS_VALUE) {
+        return; // Nothing to compare
+    }
+    const auto timeBase = std::get<0>(this->stream)->time_base;
+    const auto duration = av_rescale_q(frame.native()->nb_samples, {1, frame.native()->sample_rate}, timeBase); // Frame length in the stream time base
+    if (this->expectedPts != AV_NOPTS_VALUE && pts - this->expectedPts > duration) {
+        this->xruns.fetch_add(1, std::memory_order_relaxed);
+        LOG_AV_ERROR_EVERY(1000, "Audio input '{}' lost {} us of samples", this->device, av_rescale_q(pts - this->expectedPts, timeBase, AV_TIME_BASE_Q));
+    }
+    this->expectedPts = pts + duration;
+}
+
 // Record audio in a separate thread
 void AudioInput::record(bool* isStopped, bool* onPause) {
     av::Frame frame;
@@ -180,16 +236,33 @@ void AudioInput::record(bool* isStopped, bool* onPause) {
             return;
         }
 
-        {
+        this->countXrun(frame); // Before the device timestamp is replaced
+        if (this->standby) {
+            continue; // Read only to keep the device buffer drained
+        }
+        frame.native()->pts = this->clock->fromCapture(frame.native()->pts, std::get<0>(this->stream)->time_base); // Stamp with the session clock
+        if (this->mixer) {
             lock_guard<std::mutex> lk{ThreadStructures::getSingleton().getMutex()}; // Lock for thread safety
-            if (!*onPause) {
-                assertExpected(this->writer->write(frame, 1)); // Write frame to the writer
-                nSample += frame.native()->nb_samples; // Update sample count
-                if (nSample % 100 == 0) {
-                    std::cout << "Wrote " << nSample << " audio samples" << std::endl; // Log every 100 samples
-                }
+            if (*onPause) {
+                continue;
+            }
+            assertExpected(this->mixer->push(this->mixerSource, frame, AV_TIME_BASE_Q)); // Queue the frame on the mixer timeline
+            while (assertExpected(this->mixer->pull(this->mixed))) { // Write every frame the mix completes
+                assertExpected(this->writer->write(this->mixed, this->trackIndex, {1, this->mixer->sampleRate()}));
             }
+        } else {
+            bool paused;
+            {
+                lock_guard<std::mutex> lk{ThreadStructures::getSingleton().getMutex()}; // Lock only to read the pause state
+                paused = *onPause;
+            }
+            if (paused) {
+                continue;
+            }
+            assertExpected(this->writer->write(frame, this->trackIndex, AV_TIME_BASE_Q)); // Queued to the encoder thread of the track
         }
+        nSample += frame.native()->nb_samples; // Update sample count
+        LOG_AV_INFO_EVERY(1000, "Captured {} audio samples", nSample); // Progress, at most once per second
     }
 }
 
@@ -211,17 +284,32 @@ bool AudioInput::openInput() {
 #endif
 
 #if WIN32
-    auto err = avformat_open_input(&this->inputContext, "audio=virtual-audio-capturer", this->inputFormat, &this->opts); // Open audio input on Windows
+    const char* defaultDevice = "audio=virtual-audio-capturer"; // Default audio input on Windows
 #elif __linux__
-    auto err = avformat_open_input(&this->inputContext, "default", this->inputFormat, &this->opts); // Open audio input on Linux
+    const char* defaultDevice = "default"; // Default audio input on Linux
 #else
-    auto err = avformat_open_input(&this->inputContext, "0:0", this->inputFormat, &this->opts); // Open audio input on macOS
+    const char* defaultDevice = "0:0"; // Default audio input on macOS
 #endif
+    const std::string url = this->device.empty() ? defaultDevice : this->device; // Device to open
+    auto err = avformat_open_input(&this->inputContext, url.c_str(), this->inputFormat, &this->opts); // Open audio input
 
     if (err < 0) {
-        std::cerr << "Cannot open audio input 'desktop': " << av::avErrorStr(err) << std::endl; // Error opening input
+        std::cerr << "Cannot open audio input '" << url << "': " << av::avErrorStr(err) << std::endl; // Error opening input
         return false;
     }
 
-    err = avformat_find_stream_info(this->inputContext, nullptr); // Find stream info
-    if
+    err = this->fastOpen ? 0 : avformat_find_stream_info(this->inputContext, nullptr); // Find stream info, the header already has the format
+    if (err < 0) {
+        avformat_close_input(&this->inputContext);
+        std::cerr << "Cannot find audio stream info: " << av::avErrorStr(err) << std::endl; // Error finding stream info
+        return false;
+    }
+
+    if (!this->findBestStream(AVMEDIA_TYPE_AUDIO)) {
+        std::cerr << "Can't create the audio stream" << std::endl; // Error creating the audio stream
+        return false;
+    }
+
+    av_dump_format(this->inputContext, 0, nullptr, 0); // Dump input format information
+    return true; // Input opened successfully
+}
@@ -0,0 +1,122 @@
+#include "include/CaptureThread.h"
+#include <cstring>
+#include <iostream>
+#include "libav-cpp-master/av/common.hpp"
+#if WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#if __linux__
+#include <sys/syscall.h>
+#endif
+
+namespace {
+// Stack prefaulted and locked by a realtime capture thread when the process memory can't be locked, well above what
+// the demuxers and decoders use
+constexpr size_t kLockedStack = 256 * 1024;
+// Realtime priorities over the minimum: capture only needs to preempt normal threads, not the system ones
+constexpr int kAudioRtPriority = 20;
+constexpr int kVideoRtPriority = 10;
+// Nice values asked for when realtime scheduling is refused
+constexpr int kAudioNice = -11;
+constexpr int kVideoNice = -5;
+
+#if !WIN32
+/**
+ * Locks every page of the process in RAM, those mapped later too: the frames, the encoders and the muxers of the
+ * session are allocated after the capture threads start. Without privileges the locked pages count against
+ * RLIMIT_MEMLOCK, and with MCL_FUTURE any mapping past it would fail, so the process is only locked when the limit
+ * can't be reached.
+ * @return true if the memory is locked.
+ */
+bool lockProcessMemory() {
+    rlimit limit{};
+    const bool unlimited = geteuid() == 0 || (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur == RLIM_INFINITY);
+    return unlimited && mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+}
+#endif
+}
+
+CaptureThread::~CaptureThread() {
+    this->join();
+}
+
+std::future<void> CaptureThread::launch(const std::string& name, const Priority priority, const int cpu, std::function<void()> loop) {
+    this->join();
+    std::packaged_task<void()> task{std::move(loop)};
+    auto future = task.get_future();
+    this->thread = std::thread([this, name, priority, cpu, task = std::move(task)]() mutable {
+        const auto applied = applyRealtime(name, priority, cpu);
+        {
+            std::lock_guard<std::mutex> lk{this->statusMutex};
+            this->status = applied;
+        }
+        task();
+    });
+    return future;
+}
+
+void CaptureThread::join() {
+    if (this->thread.joinable())
+        this->thread.join();
+}
+
+CaptureThreadStatus CaptureThread::getStatus() const {
+    std::lock_guard<std::mutex> lk{this->statusMutex};
+    return this->status;
+}
+
+CaptureThreadStatus CaptureThread::applyRealtime(const std::string& name, const Priority priority, const int cpu) {
+    CaptureThreadStatus res;
+    const bool audio = priority == Priority::Audio;
+#if WIN32
+    res.realtime = SetThreadPriority(GetCurrentThread(), audio ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST);
+    if (cpu >= 0 && cpu < 64 && SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu))
+        res.cpu = cpu;
+#else
+#if __linux__
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+#endif
+
+    const int policy = audio ? SCHED_FIFO : SCHED_RR;
+    sched_param param{};
+    param.sched_priority = sched_get_priority_min(policy) + (audio ? kAudioRtPriority : kVideoRtPriority);
+    res.realtime = pthread_setschedparam(pthread_self(), policy, &param) == 0;
+#if __linux__
+    if (!res.realtime) {
+        // per thread on Linux, limited by RLIMIT_NICE
+        const auto tid = (id_t)syscall(SYS_gettid);
+        if (setpriority(PRIO_PROCESS, tid, audio ? kAudioNice : kVideoNice) == 0)
+            res.nice = getpriority(PRIO_PROCESS, tid);
+    }
+
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+            res.cpu = cpu;
+    }
+#endif
+
+    // the first capture thread locks the process for all of them, its stack included
+    static const bool processLocked = lockProcessMemory();
+    res.memoryLocked = processLocked;
+    res.stackLocked = processLocked;
+    if (!res.memoryLocked) {
+        // touch the stack so it is mapped, then keep it out of swap
+        char reserve[kLockedStack];
+        std::memset(reserve, 0, sizeof(reserve));
+        res.stackLocked = mlock(reserve, sizeof(reserve)) == 0;
+    }
+#endif
+
+    LOG_AV_INFO("Capture thread '{}': {} scheduling, nice {}, memory {}, cpu {}", name, res.realtime ? "realtime" : "normal", res.nice,
+                res.memoryLocked ? "locked" : res.stackLocked ? "not locked (stack locked)" : "not locked", res.cpu);
+    return res;
+}
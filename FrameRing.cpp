@@ -0,0 +1,212 @@
+#include "include/FrameRing.h"
+#include <cstring>
+#include <iostream>
+#include <new>
+#if __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace {
+// Planes and slots start on cache lines, so slots never share one
+constexpr size_t kAlign = 64;
+
+size_t alignUp(const size_t n) {
+    return (n + kAlign - 1) / kAlign * kAlign;
+}
+
+int64_t wallClock() {
+#if __linux__
+    timespec ts{};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    return 0;
+#endif
+}
+}
+
+/**================= WRITER ===================*/
+
+FrameRingWriter::FrameRingWriter() : fd(-1), base(nullptr), size(0), header(nullptr) {}
+
+FrameRingWriter::~FrameRingWriter() {
+#if __linux__
+    if (this->base)
+        munmap(this->base, this->size);
+    if (this->fd >= 0)
+        close(this->fd);
+#endif
+}
+
+std::shared_ptr<FrameRingWriter> FrameRingWriter::create(const std::string& name, const int slots, const FrameRingFormat& format) {
+#if __linux__
+    if (slots < 2 || format.planes <= 0 || format.planes > FrameRingHeader::kMaxPlanes) {
+        std::cerr << "Bad frame ring geometry: " << slots << " slots of " << format.planes << " planes" << std::endl;
+        return nullptr;
+    }
+
+    std::shared_ptr<FrameRingWriter> ring{new FrameRingWriter()};
+    FrameRingHeader layout{};
+    size_t slotSize = alignUp(sizeof(FrameRingSlot));
+    for (int p = 0; p < format.planes; p++) {
+        layout.linesize[p] = (int32_t)alignUp(format.rowBytes[p]);
+        layout.lines[p] = format.lines[p];
+        layout.planeOffset[p] = slotSize;
+        slotSize += alignUp((size_t)layout.linesize[p] * format.lines[p]);
+    }
+    layout.slotsOffset = alignUp(sizeof(FrameRingHeader));
+    ring->size = layout.slotsOffset + slotSize * slots;
+
+    ring->fd = memfd_create(name.c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (ring->fd < 0 || ftruncate(ring->fd, (off_t)ring->size) < 0) {
+        std::cerr << "Can't create the frame ring '" << name << "': " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+    // readers can rely on the size of their mapping
+    fcntl(ring->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+    auto mapping = mmap(nullptr, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Can't map the frame ring '" << name << "': " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+    ring->base = (uint8_t*)mapping;
+    ring->format = format;
+
+    // a fresh memfd is zeroed: the slots start as never written
+    ring->header = new (ring->base) FrameRingHeader{};
+    auto header = ring->header;
+    header->slots = (uint32_t)slots;
+    header->width = format.width;
+    header->height = format.height;
+    header->pixFmt = format.pixFmt;
+    header->planes = format.planes;
+    std::memcpy(header->linesize, layout.linesize, sizeof(layout.linesize));
+    std::memcpy(header->lines, layout.lines, sizeof(layout.lines));
+    std::memcpy(header->planeOffset, layout.planeOffset, sizeof(layout.planeOffset));
+    header->slotSize = slotSize;
+    header->slotsOffset = layout.slotsOffset;
+    header->version = FrameRingHeader::kVersion;
+    header->magic.store(FrameRingHeader::kMagic, std::memory_order_release);
+    return ring;
+#else
+    std::cerr << "Frame rings need memfd, which only Linux has" << std::endl;
+    return nullptr;
+#endif
+}
+
+uint64_t FrameRingWriter::publish(const uint8_t* const data[], const int linesize[], const int64_t pts) {
+    const auto frame = this->header->published.load(std::memory_order_relaxed) + 1;
+    auto slotBase = this->base + this->header->slotsOffset + (frame % this->header->slots) * this->header->slotSize;
+    auto slot = (FrameRingSlot*)slotBase;
+
+    // odd while written, the fence orders it before the frame data
+    slot->sequence.store(2 * frame - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->pts = pts;
+    slot->wallTime = wallClock();
+    for (int p = 0; p < this->format.planes; p++) {
+        auto dst = slotBase + this->header->planeOffset[p];
+        auto src = data[p];
+        for (int y = 0; y < this->format.lines[p]; y++, dst += this->header->linesize[p], src += linesize[p])
+            std::memcpy(dst, src, this->format.rowBytes[p]);
+    }
+    slot->sequence.store(2 * frame, std::memory_order_release);
+    this->header->published.store(frame, std::memory_order_release);
+    return frame;
+}
+
+std::string FrameRingWriter::getPath() const {
+#if __linux__
+    return "/proc/" + std::to_string(getpid()) + "/fd/" + std::to_string(this->fd);
+#else
+    return {};
+#endif
+}
+
+/**================= READER ===================*/
+
+FrameRingReader::FrameRingReader() : fd(-1), base(nullptr), size(0), header(nullptr) {}
+
+FrameRingReader::~FrameRingReader() {
+#if __linux__
+    if (this->base)
+        munmap((void*)this->base, this->size);
+    if (this->fd >= 0)
+        close(this->fd);
+#endif
+}
+
+std::shared_ptr<FrameRingReader> FrameRingReader::open(const std::string& path) {
+#if __linux__
+    std::shared_ptr<FrameRingReader> ring{new FrameRingReader()};
+    ring->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (ring->fd < 0 || fstat(ring->fd, &st) < 0 || (size_t)st.st_size < sizeof(FrameRingHeader)) {
+        std::cerr << "Can't open the frame ring " << path << ": " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+    ring->size = (size_t)st.st_size;
+    auto mapping = mmap(nullptr, ring->size, PROT_READ, MAP_SHARED, ring->fd, 0);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Can't map the frame ring " << path << ": " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+    ring->base = (const uint8_t*)mapping;
+    ring->header = (const FrameRingHeader*)ring->base;
+
+    const auto header = ring->header;
+    if (header->magic.load(std::memory_order_acquire) != FrameRingHeader::kMagic
+        || header->version != FrameRingHeader::kVersion
+        || header->slotsOffset + header->slotSize * header->slots > ring->size) {
+        std::cerr << path << " is not a frame ring of version " << FrameRingHeader::kVersion << std::endl;
+        return nullptr;
+    }
+    return ring;
+#else
+    std::cerr << "Frame rings need memfd, which only Linux has" << std::endl;
+    return nullptr;
+#endif
+}
+
+uint64_t FrameRingReader::getPublished() const {
+    return this->header->published.load(std::memory_order_acquire);
+}
+
+bool FrameRingReader::acquire(const uint64_t frame, FrameRingView& view) const {
+    if (!frame || frame > this->getPublished())
+        return false;
+
+    auto slotBase = this->base + this->header->slotsOffset + (frame % this->header->slots) * this->header->slotSize;
+    auto slot = (const FrameRingSlot*)slotBase;
+    if (slot->sequence.load(std::memory_order_acquire) != 2 * frame)
+        return false;
+
+    view.frame = frame;
+    view.pts = slot->pts;
+    view.wallTime = slot->wallTime;
+    view.width = this->header->width;
+    view.height = this->header->height;
+    view.pixFmt = this->header->pixFmt;
+    for (int p = 0; p < this->header->planes; p++) {
+        view.data[p] = slotBase + this->header->planeOffset[p];
+        view.linesize[p] = this->header->linesize[p];
+    }
+    view.slot = slot;
+    // the timestamps may have been read from the next frame of the slot
+    return this->isValid(view);
+}
+
+bool FrameRingReader::latest(FrameRingView& view) const {
+    return this->acquire(this->getPublished(), view);
+}
+
+bool FrameRingReader::isValid(const FrameRingView& view) const {
+    // orders the reads of the frame before the second look at the sequence
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return view.slot && view.slot->sequence.load(std::memory_order_relaxed) == 2 * view.frame;
+}
@@ -0,0 +1,104 @@
+#include "include/FrameSubscribers.h"
+#include <algorithm>
+
+/**================= SUBSCRIBER ===================*/
+
+FrameSubscriber::FrameSubscriber(Callback callback, const size_t queueFrames) : callback(std::move(callback)), queueFrames(std::max<size_t>(queueFrames, 1)) {
+    this->thread = std::thread([this] { this->run(); });
+}
+
+FrameSubscriber::~FrameSubscriber() {
+    {
+        std::lock_guard<std::mutex> lk{this->mutex};
+        this->stopping = true;
+    }
+    this->cv.notify_all();
+    this->thread.join();
+}
+
+void FrameSubscriber::offer(const av::Frame& frame) {
+    {
+        std::lock_guard<std::mutex> lk{this->mutex};
+        if (this->queue.size() >= this->queueFrames) {
+            // the freshest frames matter, the oldest goes
+            this->queue.pop_front();
+            this->dropped++;
+        }
+        this->queue.push_back({frame, av_gettime_relative()});
+    }
+    this->cv.notify_one();
+}
+
+SubscriberStats FrameSubscriber::getStats() const {
+    SubscriberStats res;
+    res.delivered = this->delivered;
+    res.dropped = this->dropped;
+    res.lastLagUs = this->lastLag;
+    res.maxLagUs = this->maxLag;
+    std::lock_guard<std::mutex> lk{this->mutex};
+    res.queued = this->queue.size();
+    return res;
+}
+
+void FrameSubscriber::run() {
+    while (true) {
+        std::unique_lock<std::mutex> lk{this->mutex};
+        this->cv.wait(lk, [this] { return !this->queue.empty() || this->stopping; });
+        if (this->stopping)
+            return;
+        auto next = std::move(this->queue.front());
+        this->queue.pop_front();
+        lk.unlock();
+
+        const auto lag = av_gettime_relative() - next.published;
+        this->lastLag = lag;
+        if (lag > this->maxLag)
+            this->maxLag = lag;
+        this->callback(next.frame);
+        this->delivered++;
+    }
+}
+
+/**================= SUBSCRIBERS ===================*/
+
+int FrameSubscribers::add(const FrameStage stage, FrameSubscriber::Callback callback, const size_t queueFrames) {
+    auto subscriber = std::make_shared<FrameSubscriber>(std::move(callback), queueFrames);
+    std::lock_guard<std::mutex> lk{this->mutex};
+    const int id = this->nextId++;
+    this->entries.push_back({id, stage, std::move(subscriber)});
+    this->counts[(int)stage]++;
+    return id;
+}
+
+void FrameSubscribers::remove(const int id) {
+    std::shared_ptr<FrameSubscriber> removed;
+    {
+        std::lock_guard<std::mutex> lk{this->mutex};
+        auto it = std::find_if(this->entries.begin(), this->entries.end(), [id](auto& entry) { return entry.id == id; });
+        if (it == this->entries.end())
+            return;
+        removed = std::move(it->subscriber);
+        this->counts[(int)it->stage]--;
+        this->entries.erase(it);
+    }
+    // joined here, outside the lock the recording publishes under
+}
+
+void FrameSubscribers::publish(const FrameStage stage, const av::Frame& frame) {
+    if (!this->counts[(int)stage])
+        return;
+    std::lock_guard<std::mutex> lk{this->mutex};
+    for (auto& entry : this->entries) {
+        if (entry.stage == stage)
+            entry.subscriber->offer(frame);
+    }
+}
+
+SubscriberStats FrameSubscribers::getStats(const int id) const {
+    std::lock_guard<std::mutex> lk{this->mutex};
+    for (auto& entry : this->entries) {
+        if (entry.id == id)
+            return entry.subscriber->getStats();
+    }
+    return SubscriberStats{};
+}
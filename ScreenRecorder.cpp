@@ -1,5 +1,12 @@
 #include "include/ScreenRecorder.h"
 
+namespace {
+av::OptValueMap videoCodecOptions() {
+    // forced keyframes are IDRs, so a rollover file starts decodable
+    return {{"preset", "medium"}, {"forced-idr", "1"}};
+}
+}
+
 /**================= PUBLIC METHODS ===================*/
 
 ScreenRecorder::ScreenRecorder() {
@@ -11,6 +18,10 @@ ScreenRecorder::ScreenRecorder() {
     this->enableAudio = true;
     this->isStopped = false;
     this->isStarted = false;
+    this->sessionVideo = true;
+    this->audioTrack = 1;
+    this->startTime = 0;
+    this->subscribers = std::make_shared<FrameSubscribers>();
 #if WIN32
     this->output = "..\\media\\output.mp4";
 #else
@@ -34,6 +45,7 @@ bool ScreenRecorder::set(const bool enableAudio) {
 }
 
 bool ScreenRecorder::set(const bool enableAudio, const int width, const int height, const int offset_x, const int offset_y) {
+    this->stop(); // A session in standby is already capturing
     this->isStopped = false;
     this->isStarted = false;
     this->onPause = false;
@@ -42,31 +54,235 @@ bool ScreenRecorder::set(const bool enableAudio, const int width, const int heig
     this->height = height;
     this->offset_x = offset_x;
     this->offset_y = offset_y;
+    this->sessionVideo = this->options.regions.empty() || this->options.regionBox;
+    if (!this->options.regions.empty() && !this->boundRegions())
+        return false;
+    const auto setTime = av_gettime_relative();
     this->reset();
     if (!this->init()) {
         return false;
     }
+    this->startup = StartupTiming{};
+    this->startup.openMs = (double)(av_gettime_relative() - setTime) / 1000;
+    LOG_AV_INFO("Session opened in {} ms", this->startup.openMs);
+    if (this->options.standby)
+        this->launchCapture();
     return true;
 }
 
+void ScreenRecorder::setPoolSize(const int frames) {
+    this->options.poolSize = frames;
+}
+
+av::PoolStats ScreenRecorder::getFramePoolStats() const {
+    return this->videoReader ? this->videoReader->getFramePoolStats() : av::PoolStats{};
+}
+
+void ScreenRecorder::setFrameArena(const bool enable) {
+    this->options.frameArena = enable;
+}
+
+av::FrameArena::Stats ScreenRecorder::getFrameArenaStats() const {
+    return this->frameArena ? this->frameArena->stats() : av::FrameArena::Stats{};
+}
+
+void ScreenRecorder::setFrameRate(const int fps) {
+    this->options.frameRate = fps;
+}
+
+CaptureCalibration ScreenRecorder::calibrate() {
+    // the capture thread, running from set() on in standby, would take the frames
+    if (!this->videoReader || this->videoFuture.valid()) {
+        std::cerr << "Can't calibrate: no session is set or its capture is running" << std::endl;
+        return CaptureCalibration{};
+    }
+    auto encoderExp = av::Encoder::create(AV_CODEC_ID_H264);
+    if (!encoderExp) {
+        std::cerr << "Can't create the calibration encoder: " << encoderExp.errorString() << std::endl;
+        return CaptureCalibration{};
+    }
+    auto encoder = encoderExp.value();
+    encoder->setVideoParams(this->width, this->height, AVRational{1, this->options.frameRate}, videoCodecOptions());
+    encoder->setThreading(this->threadPlan.video);
+    auto openExp = encoder->open();
+    if (!openExp) {
+        std::cerr << "Can't open the calibration encoder: " << openExp.errorString() << std::endl;
+        return CaptureCalibration{};
+    }
+    if (!this->videoReader->calibrate(this->options.frameRate, *encoder))
+        std::cerr << "Can't run the capture calibration" << std::endl;
+    return this->videoReader->getCalibration();
+}
+
+CaptureCalibration ScreenRecorder::getCalibration() const {
+    return this->videoReader ? this->videoReader->getCalibration() : CaptureCalibration{};
+}
+
+av::Resample::Drift ScreenRecorder::getAudioDrift(const int source) const {
+    if (source < 0 || source >= (int)this->audioReaders.size())
+        return av::Resample::Drift{};
+    return this->mixer ? this->mixer->drift(source) : this->writer->audioDrift(this->audioTrack + source);
+}
+
+void ScreenRecorder::addAudioSource(const std::string& device, const float gain) {
+    this->options.audioSources.push_back({device, gain});
+}
+
+void ScreenRecorder::clearAudioSources() {
+    this->options.audioSources.clear();
+}
+
+void ScreenRecorder::setSeparateAudioTracks(const bool enable) {
+    this->options.separateAudioTracks = enable;
+}
+
+av::AudioMixer::Stats ScreenRecorder::getMixerStats() const {
+    return this->mixer ? this->mixer->stats() : av::AudioMixer::Stats{};
+}
+
+void ScreenRecorder::setSilenceSkipping(const bool enable, const double thresholdDb) {
+    this->options.skipSilence = enable;
+    this->options.silenceThresholdDb = thresholdDb;
+}
+
+void ScreenRecorder::setRealtimeCapture(const bool enable, const int cpu) {
+    this->options.realtimeCapture = enable;
+    this->options.captureCpu = cpu;
+}
+
+uint64_t ScreenRecorder::getAudioXruns() const {
+    uint64_t xruns = 0;
+    for (auto& audioReader : this->audioReaders)
+        xruns += audioReader->getXruns();
+    return xruns;
+}
+
+void ScreenRecorder::setStandby(const bool enable) {
+    this->options.standby = enable;
+}
+
+void ScreenRecorder::setFastOpen(const bool enable) {
+    this->options.fastOpen = enable;
+}
+
+StartupTiming ScreenRecorder::getStartupTiming() const {
+    auto res = this->startup;
+    const auto firstFrame = this->videoReader ? this->videoReader->getFirstFrameTime() : 0;
+    if (firstFrame && this->startTime)
+        res.firstFrameMs = (double)(firstFrame - this->startTime) / 1000;
+    return res;
+}
+
+void ScreenRecorder::setThreadPlanning(const bool enable) {
+    this->options.planThreads = enable;
+}
+
+ThreadPlan ScreenRecorder::getThreadPlan() const {
+    return this->threadPlan;
+}
+
+void ScreenRecorder::setChangeRegions(const bool enable) {
+    this->options.changeRegions = enable;
+}
+
+av::ChangeMap::Stats ScreenRecorder::getChangeStats() const {
+    return this->writer ? this->writer->changeStats(0) : av::ChangeMap::Stats{};
+}
+
+void ScreenRecorder::setTileConversion(const int tileSize) {
+    this->options.conversionTile = tileSize;
+}
+
+av::StreamWriter::TileStats ScreenRecorder::getTileStats() const {
+    return this->writer ? this->writer->tileStats(0) : av::StreamWriter::TileStats{};
+}
+
+void ScreenRecorder::addRendition(const int height, const std::string& output) {
+    this->options.renditions.push_back({height, output});
+}
+
+void ScreenRecorder::clearRenditions() {
+    this->options.renditions.clear();
+}
+
+void ScreenRecorder::setPreview(const int width, const int fps) {
+    this->options.previewWidth = width;
+    this->options.previewFps = fps;
+}
+
+std::shared_ptr<const av::Frame> ScreenRecorder::getPreview() const {
+    return this->writer ? this->writer->preview(0) : nullptr;
+}
+
+void ScreenRecorder::setFrameRing(const bool enable, const int slots) {
+    this->options.frameRing = enable;
+    this->options.frameRingSlots = slots;
+}
+
+std::string ScreenRecorder::getFrameRingPath() const {
+    return this->videoReader ? this->videoReader->getFrameRingPath() : std::string{};
+}
+
+int ScreenRecorder::subscribe(const FrameStage stage, std::function<void(const av::Frame&)> callback, const size_t queueFrames) {
+    return this->subscribers->add(stage, std::move(callback), queueFrames);
+}
+
+void ScreenRecorder::unsubscribe(const int id) {
+    this->subscribers->remove(id);
+}
+
+SubscriberStats ScreenRecorder::getSubscriberStats(const int id) const {
+    return this->subscribers->getStats(id);
+}
+
+void ScreenRecorder::addRegion(const int x, const int y, const int width, const int height, const std::string& output) {
+    this->options.regions.push_back({x, y, width, height, output});
+}
+
+void ScreenRecorder::clearRegions() {
+    this->options.regions.clear();
+}
+
+void ScreenRecorder::setRegionBox(const bool enable) {
+    this->options.regionBox = enable;
+}
+
+av::StreamWriter::SilenceStats ScreenRecorder::getSilenceStats(const int track) const {
+    const int tracks = this->mixer ? 1 : (int)this->audioReaders.size();
+    if (!this->writer || track < 0 || track >= tracks)
+        return av::StreamWriter::SilenceStats{};
+    return this->writer->silenceStats(this->audioTrack + track);
+}
+
 void ScreenRecorder::start() {
     if (this->isStarted)
         return;
 
-    this->videoFuture = this->videoReader->launchRecordThread(&this->isStopped, &this->onPause);
-    if (this->enableAudio)
-        this->audioFuture = this->audioReader->launchRecordThread(&this->isStopped, &this->onPause);
+    this->startTime = av_gettime_relative();
+    if (!this->videoFuture.valid()) {
+        this->clock->start();
+        this->launchCapture();
+    } else {
+        // standby: devices and encoders are running, only the output is missing
+        this->openOutputs();
+        this->clock->start();
+        this->videoReader->setStandby(false);
+        for (auto& audioReader : this->audioReaders)
+            audioReader->setStandby(false);
+    }
     this->isStarted = true;
 }
 
 void ScreenRecorder::pause() {
     std::lock_guard<std::mutex> lk{ ThreadStructures::getSingleton().getMutex() };
     this->onPause = true;
+    this->clock->pause();
 }
 
 void ScreenRecorder::resume() {
     std::lock_guard<std::mutex> lk{ ThreadStructures::getSingleton().getMutex() };
     this->onPause = false;
+    this->clock->resume();
     ThreadStructures::getSingleton().getConditionVariable().notify_all();
 }
 
@@ -83,50 +299,266 @@ void ScreenRecorder::stop() {
         if (this->onPause)
             ThreadStructures::getSingleton().getConditionVariable().notify_all();
     }
-    this->videoFuture.wait();
-    if (this->enableAudio)
-        this->audioFuture.wait();
+    if (this->videoFuture.valid())
+        this->videoFuture.wait();
+    for (auto& audioFuture : this->audioFutures)
+        audioFuture.wait();
+}
+
+bool ScreenRecorder::rollover(const std::string& output) {
+    if (!this->isStarted || this->isStopped)
+        return false;
+    // renditions and regions with outputs of their own would keep writing to their first files
+    if (!this->renditionWriters.empty() || !this->regionWriters.empty()) {
+        std::cerr << "Can't roll over a session with rendition or region outputs" << std::endl;
+        return false;
+    }
+    auto expected = this->writer->rollover(output, this->clock->now());
+    if (!expected) {
+        std::cerr << "Can't roll over to " << output << ": " << expected.errorString() << std::endl;
+        return false;
+    }
+    return true;
 }
 
 /**================= PRIVATE METHODS ===================*/
 
+// One grab of the bounding box of the regions serves them all, inside the area given to set()
+bool ScreenRecorder::boundRegions() {
+    const int areaRight = this->offset_x + this->width;
+    const int areaBottom = this->offset_y + this->height;
+    int left = areaRight, top = areaBottom, right = this->offset_x, bottom = this->offset_y;
+    for (auto& region : this->options.regions) {
+        if (region.width < 2 || region.height < 2 || region.x < this->offset_x || region.y < this->offset_y
+            || region.x + region.width > areaRight || region.y + region.height > areaBottom) {
+            std::cerr << "Region " << region.width << "x" << region.height << "+" << region.x << "+" << region.y << " of "
+                      << region.output << " is not inside the recorded area " << this->width << "x" << this->height << "+"
+                      << this->offset_x << "+" << this->offset_y << std::endl;
+            return false;
+        }
+        left = std::min(left, region.x);
+        top = std::min(top, region.y);
+        right = std::max(right, region.x + (region.width & ~1));
+        bottom = std::max(bottom, region.y + (region.height & ~1));
+    }
+    // the encoders want an even size: the box grows by a line inside the area, or loses its last one at the edge of
+    // an odd sized area, the regions reaching it are then cropped short of it
+    left -= (left - this->offset_x) & 1;
+    top -= (top - this->offset_y) & 1;
+    if ((right - left) & 1)
+        right += right < areaRight ? 1 : -1;
+    if ((bottom - top) & 1)
+        bottom += bottom < areaBottom ? 1 : -1;
+    LOG_AV_INFO("Grabbing {}x{}+{}+{} of the {}x{}+{}+{} given for {} regions", right - left, bottom - top, left, top,
+                this->width, this->height, this->offset_x, this->offset_y, this->options.regions.size());
+    this->offset_x = left;
+    this->offset_y = top;
+    this->width = right - left;
+    this->height = bottom - top;
+    return true;
+}
+
 bool ScreenRecorder::init() {
-    avdevice_register_all();
-    this->writer = assertExpected(av::StreamWriter::create(output));
+    static std::once_flag devicesRegistered;
+    std::call_once(devicesRegistered, avdevice_register_all);
+    if (!this->sessionVideo && !this->options.renditions.empty()) {
+        std::cerr << "Renditions scale the session video, set the region box to record it" << std::endl;
+        return false;
+    }
+    this->clock = std::make_shared<SessionClock>();
+    // with regions only, the session output is left out unless it records the audio
+    if (this->sessionVideo || this->enableAudio)
+        this->writer = assertExpected(av::StreamWriter::create(output, true));
+    this->audioTrack = this->sessionVideo ? 1 : 0;
+
+    auto capture = this->options;
+    this->threadPlan = ThreadPlan{};
+    if (this->options.planThreads) {
+        this->threadPlan = ThreadPlanner::plan(av::cpuCount(), this->height);
+        if (capture.captureCpu < 0)
+            capture.captureCpu = this->threadPlan.captureCpu;
+        LOG_AV_INFO("Thread plan for {} cores: capture on core {}, {} video encoder threads", this->threadPlan.cores,
+                    this->threadPlan.captureCpu, this->threadPlan.video.threads);
+    }
+
     this->videoReader = VideoInput::getInputReader(this->width, this->height, this->offset_x,
-                                                   this->offset_y, this->writer);
+                                                   this->offset_y, capture, this->clock, this->sessionVideo ? this->writer : nullptr);
     if (!this->videoReader)
         return false;
+    this->videoReader->setSubscribers(this->subscribers);
+    if (this->enableAudio && !this->initAudio(capture))
+        return false;
+    if (this->sessionVideo)
+        this->createVideoStream();
+    if (this->enableAudio)
+        this->createAudioStream();
+    this->createRenditions(); // after the audio, which keeps the tracks right after the video
+    if (!this->createRegions())
+        return false;
+
+    if (!this->options.standby)
+        this->openOutputs();
+    return true;
+}
+
+void ScreenRecorder::openOutputs() {
+    if (this->writer)
+        assertExpected(this->writer->open());
+    for (auto& renditionWriter : this->renditionWriters)
+        assertExpected(renditionWriter->open());
+    for (auto& regionWriter : this->regionWriters)
+        assertExpected(regionWriter->open());
+}
+
+void ScreenRecorder::launchCapture() {
+    this->videoReader->setStandby(!this->isStarted && this->options.standby);
+    this->videoFuture = this->videoReader->launchRecordThread(&this->isStopped, &this->onPause);
     if (this->enableAudio) {
-        this->audioReader = AudioInput::getAudioReader(this->writer);
-        if (!this->audioReader)
+        for (auto& audioReader : this->audioReaders) {
+            audioReader->setStandby(!this->isStarted && this->options.standby);
+            this->audioFutures.push_back(audioReader->launchRecordThread(&this->isStopped, &this->onPause));
+        }
+    }
+}
+
+bool ScreenRecorder::initAudio(const CaptureOptions& capture) {
+    auto sources = capture.audioSources;
+    if (sources.empty())
+        sources.push_back({});
+    for (auto& source : sources) {
+        auto audioReader = AudioInput::getAudioReader(source.device, capture, this->clock, this->writer);
+        if (!audioReader)
             return false;
+        this->audioReaders.push_back(audioReader);
     }
-    this->createVideoStream();
-    if (this->enableAudio)
-        this->createAudioStream();
 
-    assertExpected(this->writer->open());
+    if (capture.separateAudioTracks)
+        return true;
+
+    // the first device sets the mixer format, AAC sized frames
+    auto& first = this->audioReaders.front();
+    auto mixerExp = av::AudioMixer::create(first->getChannelsNumber(), first->getSampleRate(), kMixerFrameSize);
+    if (!mixerExp) {
+        std::cerr << "Can't create the audio mixer: " << mixerExp.errorString() << std::endl;
+        return false;
+    }
+    this->mixer = mixerExp.value();
+    for (size_t i = 0; i < sources.size(); i++) {
+        if (!this->audioReaders[i]->attachMixer(this->mixer, sources[i].gain, this->audioTrack))
+            return false;
+    }
     return true;
 }
 
 void ScreenRecorder::createVideoStream() {
-    AVRational framerate = {1, 15};
-    av::OptValueMap codecOpts = {{"preset", "medium"}};
-    assertExpected(this->writer->addVideoStream(AV_CODEC_ID_H264, this->width, this->height,
-        this->videoReader->getPixelFormat(), framerate, std::move(codecOpts)));
+    AVRational framerate = {1, this->options.frameRate};
+    const auto index = assertExpected(this->writer->addVideoStream(AV_CODEC_ID_H264, this->width, this->height,
+        this->videoReader->getPixelFormat(), framerate, videoCodecOptions(), this->threadPlan.video));
+    assertExpected(this->writer->setFrameCallback(index, [subscribers = this->subscribers](const av::Frame& frame) {
+        subscribers->publish(FrameStage::Converted, frame);
+    }));
+    if (this->options.changeRegions)
+        assertExpected(this->writer->enableChangeRegions(index));
+    if (this->options.conversionTile > 0)
+        assertExpected(this->writer->enableTileConversion(index, this->options.conversionTile));
+    if (this->options.previewWidth > 0) {
+        const int previewHeight = std::max((int)((int64_t)this->height * this->options.previewWidth / this->width) & ~1, 2);
+        assertExpected(this->writer->enablePreview(index, this->options.previewWidth & ~1, previewHeight,
+                                                   {1, std::max(this->options.previewFps, 1)}));
+    }
+    if (this->options.frameArena) {
+        // the frame being converted plus the ones the subscribers and the encoder still hold
+        this->frameArena = assertExpected(this->writer->enableFrameArena(index, this->options.poolSize + 2));
+        if (this->options.realtimeCapture && !this->frameArena->lock())
+            std::cerr << "Can't lock the frame arena in memory, it may be swapped out" << std::endl;
+        const auto stats = this->frameArena->stats();
+        LOG_AV_INFO("Frame arena: {} MB, backing {}, NUMA node {}", stats.capacity >> 20, (int)stats.backing, stats.numaNode);
+    }
+    if (this->options.planThreads) {
+        // conversion and encoding leave the capture thread, the pool keeps frames for the grabber and the decoder
+        const auto queueFrames = (size_t)std::max(1, this->options.poolSize - 2);
+        assertExpected(this->writer->startEncoderThread(index, queueFrames, this->threadPlan.conversionMask));
+    }
+}
+
+void ScreenRecorder::createRenditions() {
+    auto renditions = this->options.renditions;
+    std::sort(renditions.begin(), renditions.end(), [](auto& a, auto& b) { return a.height > b.height; });
+
+    // each rendition scales the one above it, the writer that holds it feeds it. Tracks of the recording only scale
+    // tracks of the recording: the writer is flushed before the outputs of the renditions
+    std::shared_ptr<av::StreamWriter> source = this->writer;
+    int sourceIndex = 0;
+    int trackIndex = 0;
+    for (auto& rendition : renditions) {
+        const int height = rendition.height & ~1;
+        const int width = (int)((int64_t)this->width * height / this->height) & ~1;
+        if (rendition.output.empty()) {
+            trackIndex = assertExpected(this->writer->addRendition(trackIndex, AV_CODEC_ID_H264, width, height, videoCodecOptions()));
+            source = this->writer;
+            sourceIndex = trackIndex;
+            continue;
+        }
+        auto target = assertExpected(av::StreamWriter::create(rendition.output, true));
+        this->renditionWriters.push_back(target);
+        sourceIndex = assertExpected(source->addRendition(sourceIndex, target, AV_CODEC_ID_H264, width, height, videoCodecOptions()));
+        source = target;
+    }
+}
+
+bool ScreenRecorder::createRegions() {
+    AVRational framerate = {1, this->options.frameRate};
+    for (auto& region : this->options.regions) {
+        // short of the last line of an odd sized area, if the region reaches it
+        const int width = std::min(region.width, this->offset_x + this->width - region.x) & ~1;
+        const int height = std::min(region.height, this->offset_y + this->height - region.y) & ~1;
+        auto regionWriter = assertExpected(av::StreamWriter::create(region.output, true));
+        const auto index = assertExpected(regionWriter->addVideoStream(AV_CODEC_ID_H264, width, height,
+            this->videoReader->getPixelFormat(), framerate, videoCodecOptions()));
+        // each region converts and encodes on its own thread, the capture only queues the crop
+        assertExpected(regionWriter->startEncoderThread(index));
+        if (!this->videoReader->addRegion(regionWriter, region.x - this->offset_x, region.y - this->offset_y, width, height))
+            return false;
+        this->regionWriters.push_back(regionWriter);
+    }
+    return true;
 }
 
 void ScreenRecorder::createAudioStream() {
-    int bitRate = 128 * 1024; // TODO: this->audioReader->getBitRate() 128000
-    int sampleRate = 96000; // TODO: this->audioReader->getSampleRate() 96000
-    assertExpected(this->writer->addAudioStream(AV_CODEC_ID_AAC, this->audioReader->getChannelsNumber(),
-        this->audioReader->getSampleFormat(), this->audioReader->getSampleRate(),
-        this->audioReader->getChannelsNumber(), sampleRate, bitRate));
+    const int bitRate = 128 * 1024;
+    // the encoders keep the rate of what they are fed, the device or the mixer: resampling only added cost
+    if (!this->mixer) {
+        // one track per device, each encoded on its own thread
+        for (auto& audioReader : this->audioReaders) {
+            const auto index = assertExpected(this->writer->addAudioStream(AV_CODEC_ID_AAC, audioReader->getChannelsNumber(),
+                audioReader->getSampleFormat(), audioReader->getSampleRate(),
+                audioReader->getChannelsNumber(), audioReader->getSampleRate(), bitRate, {}, this->threadPlan.audio));
+            if (this->options.skipSilence)
+                assertExpected(this->writer->enableSilenceSkipping(index, this->options.silenceThresholdDb));
+            assertExpected(this->writer->startEncoderThread(index, av::StreamWriter::kQueueFrames, this->threadPlan.audio.coreMask));
+            audioReader->attachTrack(index);
+        }
+        return;
+    }
+    const auto index = assertExpected(this->writer->addAudioStream(AV_CODEC_ID_AAC, this->mixer->channels(),
+        AV_SAMPLE_FMT_FLTP, this->mixer->sampleRate(),
+        this->mixer->channels(), this->mixer->sampleRate(), bitRate, {}, this->threadPlan.audio));
+    if (this->options.skipSilence)
+        assertExpected(this->writer->enableSilenceSkipping(index, this->options.silenceThresholdDb));
+    assertExpected(this->writer->startEncoderThread(index, av::StreamWriter::kQueueFrames, this->threadPlan.audio.coreMask));
 }
 
 void ScreenRecorder::reset() {
     this->writer.reset();
+    for (auto& renditionWriter : this->renditionWriters)
+        renditionWriter.reset();
+    this->renditionWriters.clear();
+    this->regionWriters.clear();
     this->videoReader.reset();
-    this->audioReader.reset();
+    this->audioReaders.clear();
+    this->videoFuture = {};
+    this->audioFutures.clear();
+    this->mixer.reset();
+    this->frameArena.reset();
+    this->clock.reset();
 }
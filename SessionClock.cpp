@@ -0,0 +1,43 @@
+#include "include/SessionClock.h"
+#include <algorithm>
+extern "C" {
+#include <libavutil/avutil.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/time.h>
+}
+
+void SessionClock::start() {
+    this->origin = av_gettime_relative();
+    this->pausedSince = 0;
+    this->pausedTotal = 0;
+}
+
+void SessionClock::pause() {
+    int64_t expected = 0;
+    this->pausedSince.compare_exchange_strong(expected, av_gettime_relative());
+}
+
+void SessionClock::resume() {
+    const auto since = this->pausedSince.exchange(0);
+    if (since)
+        this->pausedTotal += av_gettime_relative() - since;
+}
+
+int64_t SessionClock::now() const {
+    const auto since = this->pausedSince.load();
+    const auto t = since ? since : av_gettime_relative();
+    return t - this->origin - this->pausedTotal;
+}
+
+int64_t SessionClock::fromCapture(const int64_t pts, const AVRational timeBase) const {
+    if (pts == AV_NOPTS_VALUE)
+        return this->now();
+
+    // map the wall clock stamp onto the monotonic clock, sampling the offset now follows wall clock adjustments
+    const auto mono = av_gettime_relative();
+    const auto captured = av_rescale_q(pts, timeBase, AV_TIME_BASE_Q) - (av_gettime() - mono);
+    if (captured > mono || mono - captured > AV_TIME_BASE)
+        return this->now();
+
+    return std::max<int64_t>(captured - this->origin - this->pausedTotal, 0);
+}
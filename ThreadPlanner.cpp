@@ -0,0 +1,36 @@
+#include "include/ThreadPlanner.h"
+#include <algorithm>
+
+namespace {
+// x264 frame threads stop paying off at about one per 60 picture lines, and each adds a frame of latency
+constexpr int kLinesPerEncoderThread = 60;
+constexpr int kMinEncoderThreads = 2;
+constexpr int kMaxEncoderThreads = 16;
+}
+
+ThreadPlan ThreadPlanner::plan(const int cores, const int height) {
+    ThreadPlan res;
+    res.cores = std::max(cores, 1);
+    res.video.type = av::EncoderThreading::Type::kFrame;
+    res.audio.threads = 1;
+
+    const int useful = std::clamp(height / kLinesPerEncoderThread, kMinEncoderThreads, kMaxEncoderThreads);
+    if (res.cores < 3) {
+        // nothing to spare, only keep the encoder from starting more threads than cores
+        res.video.threads = res.cores;
+        return res;
+    }
+
+    res.captureCpu = 0;
+    res.captureMask = av::coreRange(0, 1);
+    res.audio.coreMask = res.captureMask;
+
+    // with 3 cores the conversion shares the capture core
+    const int conversionCpu = res.cores >= 4 ? 1 : 0;
+    res.conversionMask = av::coreRange(conversionCpu, 1);
+
+    const int encoderCores = res.cores - conversionCpu - 1;
+    res.video.threads = std::min(encoderCores, useful);
+    res.video.coreMask = av::coreRange(conversionCpu + 1, encoderCores);
+    return res;
+}
@@ -3,6 +3,7 @@
 /**================= PUBLIC METHODS ===================*/
 
 VideoInput::~VideoInput() {
+    this->captureThread.join();
     avformat_close_input(&this->inputContext);
 }
 
@@ -11,12 +12,49 @@ AVPixelFormat VideoInput::getPixelFormat() {
 }
 
 std::future<void> VideoInput::launchRecordThread(bool* isStopped, bool* onPause) {
+	if (this->realtime)
+		return this->captureThread.launch("video capture", CaptureThread::Priority::Video, this->captureCpu, [this, isStopped, onPause] { this->record(isStopped, onPause); });
 	return std::async(std::launch::async, [this, isStopped, onPause] { this->record(isStopped, onPause); });
 }
 
-std::shared_ptr<VideoInput> VideoInput::getInputReader(const int width, const int height, const int offset_x, const int offset_y, std::shared_ptr<av::StreamWriter> writer) {
+av::PoolStats VideoInput::getFramePoolStats() {
+	return this->framePool ? this->framePool->stats() : av::PoolStats{};
+}
+
+CaptureCalibration VideoInput::getCalibration() {
+	return this->calibration;
+}
+
+int64_t VideoInput::getFirstFrameTime() {
+	return this->firstFrameTime;
+}
+
+void VideoInput::setStandby(const bool enable) {
+	this->standby = enable;
+}
+
+std::string VideoInput::getFrameRingPath() {
+	return this->frameRing ? this->frameRing->getPath() : std::string{};
+}
+
+void VideoInput::setSubscribers(std::shared_ptr<FrameSubscribers> subscribers) {
+	this->subscribers = std::move(subscribers);
+}
+
+bool VideoInput::addRegion(std::shared_ptr<av::StreamWriter> writer, const int x, const int y, const int width, const int height) {
+	const auto codecpar = std::get<0>(this->stream)->codecpar;
+	if (x < 0 || y < 0 || width <= 0 || height <= 0 || x + width > codecpar->width || y + height > codecpar->height) {
+		std::cerr << "Region " << width << "x" << height << "+" << x << "+" << y << " is out of the "
+		          << codecpar->width << "x" << codecpar->height << " capture" << std::endl;
+		return false;
+	}
+	this->regions.push_back({std::move(writer), x, y, width, height, av::Frame{}});
+	return true;
+}
+
+std::shared_ptr<VideoInput> VideoInput::getInputReader(const int width, const int height, const int offset_x, const int offset_y, const CaptureOptions& options, std::shared_ptr<SessionClock> clock, std::shared_ptr<av::StreamWriter> writer) {
 	std::shared_ptr<VideoInput> res{ new VideoInput{} };
-	if (!res->init(width, height, offset_x, offset_y, writer))
+	if (!res->init(width, height, offset_x, offset_y, options, clock, writer))
 		return nullptr;
 	return res;
 }
@@ -28,10 +66,17 @@ VideoInput::VideoInput() {
 	this->inputFormat = nullptr;
 	this->opts = nullptr;
 	this->writer = nullptr;
+	this->realtime = false;
+	this->captureCpu = -1;
+	this->firstFrameTime = 0;
+	this->standby = false;
 }
 
-bool VideoInput::init(const int width, const int height, const int offset_x, const int offset_y, std::shared_ptr<av::StreamWriter> writer) {
+bool VideoInput::init(const int width, const int height, const int offset_x, const int offset_y, const CaptureOptions& options, std::shared_ptr<SessionClock> clock, std::shared_ptr<av::StreamWriter> writer) {
 	this->writer = writer;
+	this->clock = clock;
+	this->realtime = options.realtimeCapture;
+	this->captureCpu = options.captureCpu;
 	this->inputContext = avformat_alloc_context();
 #if WIN32
 	this->inputFormat = av_find_input_format("gdigrab");
@@ -41,7 +86,7 @@ bool VideoInput::init(const int width, const int height, const int offset_x, con
 	std::string size = std::to_string(width) + "x" + std::to_string(height);
 	//av_dict_set(&this->opts, "rtbufsize", "1024M", 0);
 	//av_dict_set(&this->opts, "bit_rate", "40000", 0);
-	av_dict_set(&this->opts, "framerate", "15", 0);
+	av_dict_set(&this->opts, "framerate", std::to_string(options.frameRate).c_str(), 0);
 	av_dict_set(&this->opts, "video_size", size.c_str(), 0);
 #if WIN32
 	av_dict_set(&this->opts, "offset_x", std::to_string(offset_x).c_str(), 0);
@@ -56,22 +101,50 @@ bool VideoInput::init(const int width, const int height, const int offset_x, con
 		std::cerr << "Cannot open video input 'desktop': " << av::avErrorStr(err) << std::endl;
 		return false;
 	}
-	err = avformat_find_stream_info(this->inputContext, nullptr);
+	// the grabber header already sets size, pixel format and rate, probing only decodes frames to find them again
+	err = options.fastOpen ? 0 : avformat_find_stream_info(this->inputContext, nullptr);
 	if (err < 0) {
 		avformat_close_input(&this->inputContext);
 		std::cerr << "Cannot find video stream info: " << av::avErrorStr(err) << std::endl;
 		return false;
 	}
-	if (!this->findBestStream(AVMEDIA_TYPE_VIDEO)) {
+	if (!this->findBestStream(AVMEDIA_TYPE_VIDEO, options)) {
 		std::cerr << "Can't create the video stream" << std::endl;
 		return false;
 	}
 
 	av_dump_format(this->inputContext, 0, nullptr, 0);
+
+	if (options.frameRing && !this->createFrameRing(options.frameRingSlots)) {
+		std::cerr << "Can't create the frame ring" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool VideoInput::createFrameRing(const int slots) {
+	const auto codecpar = std::get<0>(this->stream)->codecpar;
+	const auto fmt = this->getPixelFormat();
+	const auto desc = av_pix_fmt_desc_get(fmt);
+	FrameRingFormat format;
+	format.width = codecpar->width;
+	format.height = codecpar->height;
+	format.pixFmt = fmt;
+	format.planes = av_pix_fmt_count_planes(fmt);
+	if (!desc || format.planes > FrameRingHeader::kMaxPlanes)
+		return false;
+	for (int p = 0; p < format.planes; p++) {
+		format.rowBytes[p] = av_image_get_linesize(fmt, format.width, p);
+		format.lines[p] = p == 1 || p == 2 ? AV_CEIL_RSHIFT(format.height, desc->log2_chroma_h) : format.height;
+	}
+	this->frameRing = FrameRingWriter::create("screen-capture", slots, format);
+	if (!this->frameRing)
+		return false;
+	LOG_AV_INFO("Captured frames published in {}", this->frameRing->getPath());
 	return true;
 }
 
-bool VideoInput::findBestStream(AVMediaType type) {
+bool VideoInput::findBestStream(AVMediaType type, const CaptureOptions& options) {
 	AVCodec* dec = nullptr;
 	int stream_i = av_find_best_stream(this->inputContext, type, -1, -1, &dec, 0);
 	if (stream_i == AVERROR_STREAM_NOT_FOUND) {
@@ -83,8 +156,16 @@ bool VideoInput::findBestStream(AVMediaType type) {
 		return false;
 	}
 
+    const auto codecpar = this->inputContext->streams[stream_i]->codecpar;
+    auto poolExp = av::FramePool::create(codecpar->width, codecpar->height, (AVPixelFormat)codecpar->format, options.poolSize);
+    if (!poolExp) {
+        std::cerr << "Can't create the frame pool: " << poolExp.errorString() << std::endl;
+        return false;
+    }
+    this->framePool = poolExp.value();
+
     const auto framerate = av_guess_frame_rate(this->inputContext, this->inputContext->streams[stream_i], nullptr);
-    auto decContext = av::Decoder::create(dec, this->inputContext->streams[stream_i], framerate);
+    auto decContext = av::Decoder::create(dec, this->inputContext->streams[stream_i], framerate, this->framePool);
     if (!decContext) {
         std::cerr << "Can't create decoder context" << std::endl;
         return false;
@@ -113,7 +194,7 @@ bool VideoInput::readPacket(av::Packet& packet) {
 		}
 
 		if (err < 0) {
-			std::cerr << "Failed to read frame: " << av::avErrorStr(err) << std::endl;
+			LOG_AV_ERROR_EVERY(1000, "Failed to read frame: {}", av::avErrorStr(err));
 			return false;
 		}
 
@@ -122,23 +203,25 @@ bool VideoInput::readPacket(av::Packet& packet) {
 }
 
 bool VideoInput::readFrame(av::Frame& frame) {
-	av::Packet packet;
-
 	while (true) {
-		packet.dataUnref();
-		auto successExp = this->readPacket(packet);
+		this->packet.dataUnref();
+		auto successExp = this->readPacket(this->packet);
 		if (!successExp)
-			std::cerr << "Can't read packet" << std::endl;
+			LOG_AV_ERROR_EVERY(1000, "Can't read packet");
 
-		shared_ptr<av::Decoder> dec;
 		//Video Stream
-		if (packet.native()->stream_index == get<0>(this->stream)->index) {
-			dec = std::get<1>(this->stream);
-            av_packet_rescale_ts(*packet, std::get<0>(this->stream)->time_base, dec->native()->time_base);
-			auto resExp = dec->decode(packet, frame);
+		if (this->packet.native()->stream_index == get<0>(this->stream)->index) {
+			auto& dec = std::get<1>(this->stream);
+			// x11grab packets already hold the raw pixels
+			if (av::Decoder::wrapRawPacket(std::get<0>(this->stream)->codecpar, this->packet, frame)) {
+				frame.type(AVMEDIA_TYPE_VIDEO);
+				return true;
+			}
+
+			auto resExp = dec->decode(this->packet, frame);
 
 			if (!resExp) {
-				std::cerr << "Can't decode video packet" << std::endl;
+				LOG_AV_ERROR("Can't decode video packet");
 				return false;
 			}
 
@@ -149,15 +232,69 @@ bool VideoInput::readFrame(av::Frame& frame) {
 
 			return true;
 		} else {
-			std::cerr << "Unknown stream index " << packet.native()->stream_index << std::endl;
+			LOG_AV_ERROR_EVERY(1000, "Unknown stream index {}", this->packet.native()->stream_index);
 			continue;
 		}
 	}
 	return false;
 }
 
+bool VideoInput::calibrate(const int frameRate, av::Encoder& encoder) {
+	// half a second of real capture, each frame converted and encoded with the session settings like the writer does
+	const auto codecpar = std::get<0>(this->stream)->codecpar;
+	const auto encCtx = encoder.native();
+	auto scaleExp = av::Scale::create(codecpar->width, codecpar->height, (AVPixelFormat)codecpar->format,
+	                                  encCtx->width, encCtx->height, encCtx->pix_fmt);
+	auto dstExp = encoder.newWriteableVideoFrame();
+	if (!scaleExp || !dstExp)
+		return false;
+
+	this->calibration = CaptureCalibration{};
+	this->calibration.requestedFps = frameRate;
+	const int frames = std::max(frameRate / 2, 8);
+	std::vector<av::Packet> packets;
+	std::chrono::duration<double, std::milli> convert{0}, encode{0};
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < frames; i++) {
+		auto frame = this->framePool->acquire(false);
+		if (!frame || !this->readFrame(*frame.value()))
+			break;
+		const auto t0 = std::chrono::steady_clock::now();
+		auto& dst = *dstExp.value();
+		av_frame_make_writable(dst.native());
+		scaleExp.value()->scale(*frame.value(), dst);
+		const auto t1 = std::chrono::steady_clock::now();
+		convert += t1 - t0;
+		dst.native()->pts = i;
+		if (std::get<0>(encoder.encodeFrame(dst, packets)) == av::Result::kFail)
+			return false;
+		encode += std::chrono::steady_clock::now() - t1;
+		this->calibration.frames++;
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	if (!this->calibration.frames)
+		return false;
+	// the frames the encoder delayed are encoded by the flush, their cost belongs to the run too
+	const auto t0 = std::chrono::steady_clock::now();
+	encoder.flush(packets);
+	encode += std::chrono::steady_clock::now() - t0;
+
+	auto& res = this->calibration;
+	res.captureFps = res.frames / elapsed.count();
+	res.convertMs = convert.count() / res.frames;
+	res.encodeMs = encode.count() / res.frames;
+	// the grabber paces itself at frameRate, allow for the jitter of the first frames
+	res.sustainable = res.captureFps >= 0.9 * frameRate && res.convertMs + res.encodeMs < 1000.0 / frameRate;
+	if (res.sustainable)
+		LOG_AV_INFO("Calibration: {} fps requested, capture {} fps, conversion {} ms/frame, encoding {} ms/frame", frameRate,
+		            (int)res.captureFps, res.convertMs, res.encodeMs);
+	else
+		LOG_AV_ERROR("Calibration: the host can't sustain {} fps, capture {} fps, conversion {} ms/frame, encoding {} ms/frame", frameRate,
+		             (int)res.captureFps, res.convertMs, res.encodeMs);
+	return true;
+}
+
 void VideoInput::record(bool* isStopped, const bool* onPause) {
-	av::Frame frame;
 	int nFrames = 0;
 	while (true) {
         if (*isStopped) //Check if the recording is stopped
@@ -170,13 +307,49 @@ void VideoInput::record(bool* isStopped, const bool* onPause) {
 				return;
 		}
 
-		if (!this->readFrame(frame)) {
+		auto frame = assertExpected(this->framePool->acquire(false));
+		if (!this->readFrame(*frame)) {
 			*isStopped = true;
 			return;
 		}
-		assertExpected(this->writer->write(frame, 0));
+		if (this->standby) //Grabbed and dropped, so the grabber keeps its pace and the next frame is fresh
+			continue;
+		frame->native()->pts = this->clock->fromCapture(frame->native()->pts, std::get<0>(this->stream)->time_base);
+		if (this->frameRing)
+			this->frameRing->publish(frame->native()->data, frame->native()->linesize, frame->native()->pts);
+		if (this->subscribers)
+			this->subscribers->publish(FrameStage::Captured, *frame);
+		this->writeRegions(*frame);
+		// last use of the capture: an encoder thread takes it over without allocating references
+		if (this->writer)
+			assertExpected(this->writer->write(std::move(*frame), 0, AV_TIME_BASE_Q));
+		if (!nFrames)
+			this->firstFrameTime = av_gettime_relative();
 		nFrames++;
-		if (nFrames % 10 == 0)
-			std::cout << "Wrote " << nFrames << " video frames" << std::endl;
+		LOG_AV_INFO_EVERY(1000, "Wrote {} video frames", nFrames);
+	}
+}
+
+void VideoInput::writeRegions(const av::Frame& frame) {
+	const auto src = frame.native();
+	for (auto& region : this->regions) {
+		auto crop = region.crop.native();
+		av_frame_unref(crop);
+		auto err = av_frame_ref(crop, src);
+		if (err < 0) {
+			LOG_AV_ERROR_EVERY(1000, "Can't reference the captured frame for a region: {}", av::avErrorStr(err));
+			continue;
+		}
+		// only the plane pointers move, the region planes stay inside the captured ones
+		crop->crop_left = region.x;
+		crop->crop_top = region.y;
+		crop->crop_right = src->width - region.x - region.width;
+		crop->crop_bottom = src->height - region.y - region.height;
+		err = av_frame_apply_cropping(crop, AV_FRAME_CROP_UNALIGNED);
+		if (err < 0) {
+			LOG_AV_ERROR_EVERY(1000, "Can't crop the captured frame to a region: {}", av::avErrorStr(err));
+			continue;
+		}
+		assertExpected(region.writer->write(region.crop, 0, AV_TIME_BASE_Q));
 	}
 }
@@ -3,11 +3,16 @@
 #include <iostream>
 #include <memory>
 #include <future>
+#include <atomic>
 #include "../libav-cpp-master/av/common.hpp"
 #include "../libav-cpp-master/av/Packet.hpp"
 #include "../libav-cpp-master/av/Decoder.hpp"
 #include "../libav-cpp-master/av/StreamWriter.hpp"
+#include "../libav-cpp-master/av/AudioMixer.hpp"
 #include "ThreadStructures.h"
+#include "SessionClock.h"
+#include "CaptureOptions.h"
+#include "CaptureThread.h"
 
 class AudioInput
 {
@@ -16,12 +21,27 @@ class AudioInput
 	AVDictionary* opts;
 	tuple<AVStream*, shared_ptr<av::Decoder>> stream;
 	std::shared_ptr<av::StreamWriter> writer;
+	std::shared_ptr<SessionClock> clock;
+	std::shared_ptr<av::AudioMixer> mixer;
+	int mixerSource;
+	int trackIndex;
+	av::Frame mixed;
+	std::string device;
+	av::Packet packet;
+	int64_t expectedPts;
+	std::atomic<uint64_t> xruns;
+	bool realtime;
+	int captureCpu;
+	bool fastOpen;
+	std::atomic<bool> standby;
+	CaptureThread captureThread;
 
 	AudioInput();
-	bool init(std::shared_ptr<av::StreamWriter> writer);
+	bool init(const std::string& device, const CaptureOptions& options, std::shared_ptr<SessionClock> clock, std::shared_ptr<av::StreamWriter> writer);
 	bool findBestStream(AVMediaType type);
 	bool readPacket(av::Packet& packet);
 	bool readFrame(av::Frame& frame);
+	void countXrun(av::Frame& frame);
 	void record(bool* isStopped, bool* isPaused);
     bool openInput();
 public:
@@ -50,7 +70,30 @@ public:
      */
     int getSampleRate();
     /**
-     * Starts a thread for recording the desktop audio.
+     * Makes the captured audio a source of the mixer, whose output this thread also writes when it completes a frame.
+     * @param mixer: the mixer of the session.
+     * @param gain: linear gain of this source in the mix.
+     * @param streamIndex: the writer audio stream of the mix.
+     * @return true if the source is added, false if its format can't be converted to the mixer one.
+     */
+    bool attachMixer(std::shared_ptr<av::AudioMixer> mixer, float gain, int streamIndex);
+    /**
+     * Makes the captured audio a track of its own, written by this thread without holding the session mutex.
+     * @param streamIndex: the writer audio stream of this source.
+     */
+    void attachTrack(int streamIndex);
+    /**
+     * Gets how many times the device lost samples, seen as gaps in its timestamps.
+     * @return the number of overruns since the capture started.
+     */
+    uint64_t getXruns();
+    /**
+     * Keeps the capture running without writing, the frames are read and dropped until standby is left.
+     * @param enable: if the captured frames have to be dropped.
+     */
+    void setStandby(bool enable);
+    /**
+     * Starts a thread for recording the desktop audio, a dedicated realtime one if the session asks for it.
      * @param isStopped: boolean to stop the thread.
      * @param isPaused: boolean to set on pause the thread.
      * @return the promise.
@@ -58,10 +101,13 @@ public:
     std::future<void> launchRecordThread(bool* isStopped, bool* isPaused);
     /**
      * Builds an AudioInput object.
+     * @param device: the capture device, empty for the default one of the platform.
+     * @param options: capture tuning of the session.
+     * @param clock: session clock the captured frames are stamped with.
      * @param writer: writer to record the video.
      * @return a smart pointer to the AudioInput object built.
      */
-    static std::shared_ptr<AudioInput> getAudioReader(std::shared_ptr<av::StreamWriter> writer);
+    static std::shared_ptr<AudioInput> getAudioReader(const std::string& device, const CaptureOptions& options, std::shared_ptr<SessionClock> clock, std::shared_ptr<av::StreamWriter> writer);
 };
 
 #endif
\ No newline at end of file
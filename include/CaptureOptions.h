@@ -0,0 +1,83 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * Audio capture device mixed into the recording.
+ */
+struct AudioSourceOptions
+{
+	std::string device; // capture device, empty for the default one of the platform
+	float gain = 1.0f; // linear gain in the mix
+};
+
+/**
+ * Lower resolution encoding of the captured video, made along with the recording.
+ */
+struct RenditionOptions
+{
+	int height = 0; // picture height, the width keeps the aspect ratio
+	std::string output; // file of its own, empty for an additional video track of the recording
+};
+
+/**
+ * Part of the screen recorded to a file of its own, cropped from the capture every region shares.
+ */
+struct RegionOptions
+{
+	int x = 0; // left edge on the screen
+	int y = 0; // top edge on the screen
+	int width = 0;
+	int height = 0;
+	std::string output; // file of the region
+};
+
+/**
+ * Capture tuning of a recording session, set on the ScreenRecorder and applied at the next set().
+ */
+struct CaptureOptions
+{
+	int poolSize = 8; // captured frames recycled by the frame pool
+	bool frameArena = false; // carve the frames converted for the encoder from a huge-page, NUMA-local arena
+	int frameRate = 15; // capture rate, also the encoder time base and the muxer frame rate
+	std::vector<AudioSourceOptions> audioSources; // mixed into one track, empty for the default device only
+	bool separateAudioTracks = false; // one track per audio source instead of the mix
+	bool skipSilence = false; // mux long quiet audio spans as a cached silent packet instead of encoding them
+	double silenceThresholdDb = -60; // RMS level under which the audio counts as quiet
+	bool realtimeCapture = false; // capture on dedicated realtime priority threads with locked memory
+	int captureCpu = -1; // core the realtime capture threads are pinned to, -1 for any
+	bool planThreads = false; // divide the cores among capture, conversion and encoding instead of letting the encoder pick
+	bool fastOpen = false; // take the stream parameters from the device headers instead of probing
+	bool standby = false; // capture idles from set() on with the encoders open, start() only opens the output
+	bool changeRegions = false; // give the video encoder the macroblocks that changed since the previous frame as regions of interest
+	int conversionTile = 0; // convert only the changed tiles of this size of each captured frame, 0 converts every frame whole
+	std::vector<RenditionOptions> renditions; // scaled down from each other, the highest from the recording
+	int previewWidth = 0; // width of the RGB preview of the recording, 0 for no preview
+	int previewFps = 5; // previews made per second
+	bool frameRing = false; // publish the captured frames in a shared memory ring other processes map (Linux)
+	int frameRingSlots = 4; // frames the ring keeps
+	std::vector<RegionOptions> regions; // the capture is then their bounding box, each is recorded to its own file
+	bool regionBox = false; // with regions, also record their bounding box to the session output
+};
+
+/**
+ * How long a session took to get going.
+ */
+struct StartupTiming
+{
+	double openMs = 0; // spent in set(): devices, encoders and file header
+	double firstFrameMs = 0; // from start(), the trigger in standby, to the first video frame handed to the writer, 0 until then
+};
+
+/**
+ * Result of the calibration run of a session, see ScreenRecorder::calibrate().
+ */
+struct CaptureCalibration
+{
+	int requestedFps = 0; // the frame rate of the session
+	int frames = 0; // frames captured during the run, 0 if no run was made
+	double captureFps = 0; // rate the grabber delivered frames at
+	double convertMs = 0; // average cost of converting one frame to the encoder pixel format
+	double encodeMs = 0; // average cost of encoding one frame, the final flush included
+	bool sustainable = false; // capture keeps up and conversion plus encoding fit in the frame interval
+};
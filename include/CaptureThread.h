@@ -0,0 +1,60 @@
+#pragma once
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * Scheduling a capture thread actually obtained, realtime mode degrades to what the process is allowed.
+ */
+struct CaptureThreadStatus
+{
+	bool realtime = false; // SCHED_FIFO/SCHED_RR, time critical priority on Windows
+	int nice = 0; // nice value when realtime scheduling is refused
+	bool memoryLocked = false; // every page of the process, present and future, is locked in RAM (mlockall)
+	bool stackLocked = false; // the thread stack is prefaulted and locked in RAM, alone when the process memory isn't
+	int cpu = -1; // core the thread is pinned to, -1 if it is not
+};
+
+/**
+ * Dedicated thread of a capture loop, with realtime scheduling and memory locking instead of an std::async worker.
+ */
+class CaptureThread
+{
+	std::thread thread;
+	mutable std::mutex statusMutex;
+	CaptureThreadStatus status;
+public:
+	/**
+	 * Priority class of the loop: audio runs SCHED_FIFO above video, which runs SCHED_RR so it can't starve it.
+	 */
+	enum class Priority { Audio, Video };
+
+	/**
+	 * Destroyer, waits for the loop to return.
+	 */
+	~CaptureThread();
+	/**
+	 * Starts the loop on its own thread, which first raises its priority, locks the process memory and pins itself.
+	 * Every step that fails for lack of privileges is logged and skipped, the loop runs anyway: without the memory
+	 * lock, only the thread stack is locked.
+	 * @param name: the thread name, shown by the system tools and in the log.
+	 * @param priority: the priority class of the loop.
+	 * @param cpu: the core to pin the thread to, -1 for any.
+	 * @param loop: the capture loop.
+	 * @return the promise, fulfilled when the loop returns.
+	 */
+	std::future<void> launch(const std::string& name, Priority priority, int cpu, std::function<void()> loop);
+	/**
+	 * Waits for the loop to return, if it was started.
+	 */
+	void join();
+	/**
+	 * Gets the scheduling obtained by the thread.
+	 * @return the status, empty until the thread has started.
+	 */
+	[[nodiscard]] CaptureThreadStatus getStatus() const;
+private:
+	static CaptureThreadStatus applyRealtime(const std::string& name, Priority priority, int cpu);
+};
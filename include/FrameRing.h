@@ -0,0 +1,163 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * Shared memory ring of captured frames, written by the recorder and mapped read-only by other local processes.
+ * The ring is a sealed memfd: a header followed by a fixed number of slots, each holding one frame with its
+ * sequence number and capture time. The writer never waits for the readers, it overwrites the oldest slot.
+ * Every slot is a seqlock: its sequence is odd while the frame is written and set to 2 * frame number once it is
+ * complete, so a reader checks it before and after reading the frame in place to know it was not overwritten.
+ * Only Linux supports it. Readers need no FFmpeg: the pixel format is the AVPixelFormat value.
+ */
+struct FrameRingHeader
+{
+	static constexpr uint32_t kMagic = 0x474e5246; // "FRNG"
+	static constexpr uint32_t kVersion = 1;
+	static constexpr int kMaxPlanes = 4;
+
+	std::atomic<uint32_t> magic; // set last, once the header is complete
+	uint32_t version;
+	uint32_t slots; // frames in the ring
+	int32_t width;
+	int32_t height;
+	int32_t pixFmt; // AVPixelFormat
+	int32_t planes;
+	int32_t linesize[kMaxPlanes]; // bytes from one line of a plane to the next
+	int32_t lines[kMaxPlanes]; // lines of each plane
+	uint64_t planeOffset[kMaxPlanes]; // from the start of a slot
+	uint64_t slotSize; // bytes of a slot, its header included
+	uint64_t slotsOffset; // of the first slot from the start of the ring
+	std::atomic<uint64_t> published; // number of the last complete frame, frames count from 1, 0 before the first
+};
+
+/**
+ * Header of a slot, its planes follow.
+ */
+struct FrameRingSlot
+{
+	std::atomic<uint64_t> sequence; // 2 * frame number when complete, odd while written
+	int64_t pts; // capture time, microseconds of the session clock
+	int64_t wallTime; // CLOCK_REALTIME of the publication in microseconds, to compare with other processes
+};
+
+/**
+ * A frame read in place from a ring, valid as long as FrameRingReader::isValid() says so.
+ */
+struct FrameRingView
+{
+	uint64_t frame = 0; // frame number
+	int64_t pts = 0;
+	int64_t wallTime = 0;
+	int width = 0;
+	int height = 0;
+	int pixFmt = -1;
+	const uint8_t* data[FrameRingHeader::kMaxPlanes] = {};
+	int linesize[FrameRingHeader::kMaxPlanes] = {};
+	const FrameRingSlot* slot = nullptr;
+};
+
+/**
+ * Geometry of the frames published in a ring.
+ */
+struct FrameRingFormat
+{
+	int width = 0;
+	int height = 0;
+	int pixFmt = -1; // AVPixelFormat
+	int planes = 0;
+	int rowBytes[FrameRingHeader::kMaxPlanes] = {}; // bytes of pixels of a line of each plane
+	int lines[FrameRingHeader::kMaxPlanes] = {}; // lines of each plane
+};
+
+/**
+ * Publishing side of a ring.
+ */
+class FrameRingWriter
+{
+	int fd;
+	uint8_t* base;
+	size_t size;
+	FrameRingHeader* header;
+	FrameRingFormat format;
+
+	FrameRingWriter();
+public:
+	/**
+	 * Destroyer, unmaps the ring, the readers keep their mapping.
+	 */
+	~FrameRingWriter();
+	/**
+	 * Copies a frame into the oldest slot and publishes it.
+	 * @param data: the planes of the frame, in the format of the ring.
+	 * @param linesize: the line sizes of the planes.
+	 * @param pts: the capture time in microseconds.
+	 * @return the frame number.
+	 */
+	uint64_t publish(const uint8_t* const data[], const int linesize[], int64_t pts);
+	/**
+	 * Gets a path other processes of the same user open the ring with.
+	 * @return /proc/<pid>/fd/<fd> of the memfd.
+	 */
+	[[nodiscard]] std::string getPath() const;
+	/**
+	 * Creates a ring, a sealed memfd sized for slots frames of the format.
+	 * @param name: the memfd name, shown in /proc/<pid>/fd.
+	 * @param slots: the frames kept in the ring.
+	 * @param format: the geometry of the frames.
+	 * @return the writer, null if the ring can't be created.
+	 */
+	static std::shared_ptr<FrameRingWriter> create(const std::string& name, int slots, const FrameRingFormat& format);
+};
+
+/**
+ * Reading side of a ring, maps it read-only.
+ */
+class FrameRingReader
+{
+	int fd;
+	const uint8_t* base;
+	size_t size;
+	const FrameRingHeader* header;
+
+	FrameRingReader();
+public:
+	/**
+	 * Destroyer, unmaps the ring.
+	 */
+	~FrameRingReader();
+	/**
+	 * Gets the number of the last frame published.
+	 * @return the frame number, 0 before the first frame.
+	 */
+	[[nodiscard]] uint64_t getPublished() const;
+	/**
+	 * Gets a frame in place, if it is still in the ring.
+	 * @param frame: the frame number.
+	 * @param view: set to the frame.
+	 * @return false if the frame is not published yet, already overwritten or being written.
+	 */
+	bool acquire(uint64_t frame, FrameRingView& view) const;
+	/**
+	 * Gets the last frame published in place.
+	 * @param view: set to the frame.
+	 * @return false if there is no frame yet or it was overwritten meanwhile.
+	 */
+	bool latest(FrameRingView& view) const;
+	/**
+	 * Tells if a frame read in place is still intact, to be checked after reading it: the reads happen before the
+	 * check, a frame overwritten meanwhile has to be dropped.
+	 * @param view: the frame.
+	 * @return true if the slot was not overwritten since the view was acquired.
+	 */
+	[[nodiscard]] bool isValid(const FrameRingView& view) const;
+	/**
+	 * Opens a ring published by another process.
+	 * @param path: the path of the ring memfd, see FrameRingWriter::getPath().
+	 * @return the reader, null if the path is not a ring.
+	 */
+	static std::shared_ptr<FrameRingReader> open(const std::string& path);
+};
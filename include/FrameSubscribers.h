@@ -0,0 +1,129 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../libav-cpp-master/av/Frame.hpp"
+
+/**
+ * Point of the video path a subscriber gets the frames from.
+ */
+enum class FrameStage
+{
+	Captured, // as grabbed, in the capture pixel format, pts in session microseconds
+	Converted // in the encoder pixel format, pts in the encoder time base
+};
+
+/**
+ * Delivery of the frames to a subscriber.
+ */
+struct SubscriberStats
+{
+	uint64_t delivered = 0; // frames the callback was called with
+	uint64_t dropped = 0; // frames discarded because the callback was behind
+	int64_t lastLagUs = 0; // from the publication of the last delivered frame to its callback
+	int64_t maxLagUs = 0; // the largest such lag
+	size_t queued = 0; // frames waiting for the callback
+};
+
+/**
+ * A callback run on a thread of its own with the frames of a stage.
+ * Frames are references to the recorded ones, nothing is copied. The recording only queues them: when queueFrames
+ * are already waiting the oldest is dropped, so a slow callback misses frames instead of stalling the capture.
+ */
+class FrameSubscriber
+{
+public:
+	using Callback = std::function<void(const av::Frame&)>;
+
+	/**
+	 * Starts the executor of the callback.
+	 * @param callback: the callback, run on the subscriber thread only.
+	 * @param queueFrames: the frames kept while the callback runs, at least 1.
+	 */
+	FrameSubscriber(Callback callback, size_t queueFrames);
+	/**
+	 * Destroyer, waits for the running callback and drops the queued frames.
+	 */
+	~FrameSubscriber();
+	/**
+	 * Queues a reference to a frame for the callback, never waits for it.
+	 * @param frame: the frame.
+	 */
+	void offer(const av::Frame& frame);
+	/**
+	 * Gets the delivery statistics.
+	 * @return the delivered and dropped frames and the lag of the callback.
+	 */
+	[[nodiscard]] SubscriberStats getStats() const;
+private:
+	struct Queued
+	{
+		av::Frame frame;
+		int64_t published;
+	};
+
+	Callback callback;
+	size_t queueFrames;
+	mutable std::mutex mutex;
+	std::condition_variable cv;
+	std::deque<Queued> queue;
+	bool stopping = false;
+	std::atomic<uint64_t> delivered{0};
+	std::atomic<uint64_t> dropped{0};
+	std::atomic<int64_t> lastLag{0};
+	std::atomic<int64_t> maxLag{0};
+	std::thread thread;
+
+	void run();
+};
+
+/**
+ * Subscribers of the video frames of a recorder, by stage, kept across its sessions.
+ */
+class FrameSubscribers
+{
+	struct Entry
+	{
+		int id;
+		FrameStage stage;
+		std::shared_ptr<FrameSubscriber> subscriber;
+	};
+
+	mutable std::mutex mutex;
+	std::vector<Entry> entries;
+	int nextId = 1;
+	std::atomic<int> counts[2] = {};
+public:
+	/**
+	 * Adds a subscriber.
+	 * @param stage: where its frames are taken.
+	 * @param callback: the callback, see FrameSubscriber.
+	 * @param queueFrames: the frames kept while the callback runs.
+	 * @return the subscriber id.
+	 */
+	int add(FrameStage stage, FrameSubscriber::Callback callback, size_t queueFrames);
+	/**
+	 * Removes a subscriber, waiting for its running callback.
+	 * @param id: the subscriber id.
+	 */
+	void remove(int id);
+	/**
+	 * Hands a frame to the subscribers of a stage.
+	 * @param stage: the stage of the frame.
+	 * @param frame: the frame.
+	 */
+	void publish(FrameStage stage, const av::Frame& frame);
+	/**
+	 * Gets the delivery statistics of a subscriber.
+	 * @param id: the subscriber id.
+	 * @return the statistics, empty if there is no such subscriber.
+	 */
+	[[nodiscard]] SubscriberStats getStats(int id) const;
+};
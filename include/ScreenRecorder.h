@@ -11,12 +11,17 @@
 #include <string_view>
 #include <memory>
 #include <future>
+#include <vector>
 #include "../libav-cpp-master/av/common.hpp"
 #include "../libav-cpp-master/av/StreamReader.hpp"
 #include "../libav-cpp-master/av/StreamWriter.hpp"
 #include "AudioInput.h"
 #include "VideoInput.h"
 #include "ThreadStructures.h"
+#include "CaptureOptions.h"
+#include "SessionClock.h"
+#include "ThreadPlanner.h"
+#include "FrameSubscribers.h"
 
 class ScreenRecorder
 {
@@ -25,20 +30,40 @@ private:
 	int height;
 	int offset_x;
 	int offset_y;
+	CaptureOptions options;
+	ThreadPlan threadPlan;
+	StartupTiming startup;
+	int64_t startTime;
 	bool onPause;
 	bool enableAudio;
 	bool isStopped;
 	bool isStarted;
+	bool sessionVideo; // the session output has a video track, not when it would only be the bounding box of regions
+	int audioTrack; // first audio track of the session output
 	std::string_view output;
-	std::shared_ptr<AudioInput> audioReader;
+	std::shared_ptr<SessionClock> clock;
+	std::vector<std::shared_ptr<AudioInput>> audioReaders;
+	std::shared_ptr<av::AudioMixer> mixer;
 	std::shared_ptr<VideoInput> videoReader;
+	std::shared_ptr<FrameSubscribers> subscribers;
+	std::vector<std::shared_ptr<av::StreamWriter>> renditionWriters; // outputs of their own, flushed after the writer
+	std::vector<std::shared_ptr<av::StreamWriter>> regionWriters;
 	std::shared_ptr<av::StreamWriter> writer;
+	std::shared_ptr<av::FrameArena> frameArena; // of the frames converted for the encoder
 	std::future<void> videoFuture;
-	std::future<void> audioFuture;
+	std::vector<std::future<void>> audioFutures;
 
+	static constexpr int kMixerFrameSize = 1024;
+
+	bool boundRegions();
 	bool init();
+	bool initAudio(const CaptureOptions& capture);
 	void createVideoStream();
+	void createRenditions();
+	bool createRegions();
+	void openOutputs();
 	void createAudioStream();
+	void launchCapture();
 	void reset();
 public:
     /**
@@ -57,14 +82,237 @@ public:
 	bool set(bool enableAudio);
     /**
      * Sets and initializes a new recording session.
+     * With regions the area only bounds them: the grab is their bounding box inside it, see addRegion().
      * @param enableAudio: if the audio has to be recorded.
      * @param width: the window width to record in pixels unit.
      * @param height: the window height to record in pixels unit.
      * @param offset_x: the x offset from left display bound in pixel units.
      * @param offset_y: the y offset from top display bound in pixel units.
-     * @return true if the initialization is completed, instead false if there are been some errors.
+     * @return true if the initialization is completed, instead false if there are been some errors or a region is
+     * not inside the area.
      */
 	bool set(bool enableAudio, int width, int height, int offset_x, int offset_y);
+    /**
+     * Sets how many captured frames the session recycles instead of allocating, used from the next set() on.
+     * @param frames: the number of pooled frames.
+     */
+	void setPoolSize(int frames);
+    /**
+     * Gets the recycling statistics of the captured frames pool of the current session.
+     * @return the pool hits and misses.
+     */
+	[[nodiscard]] av::PoolStats getFramePoolStats() const;
+    /**
+     * Enables a preallocated huge-page, NUMA-local arena for the frames converted for the encoder, used from the
+     * next set() on. It is sized at set() time from the output resolution and the pool size.
+     * @param enable: if the converted frames have to be carved from the arena.
+     */
+	void setFrameArena(bool enable);
+    /**
+     * Gets the usage of the converted frames arena of the current session.
+     * @return the arena statistics, empty if the arena is disabled.
+     */
+	[[nodiscard]] av::FrameArena::Stats getFrameArenaStats() const;
+    /**
+     * Sets the capture frame rate, used from the next set() on for the grabber, the encoder time base and the muxer.
+     * @param fps: the frames per second to record, e.g. 30, 60 or 120.
+     */
+	void setFrameRate(int fps);
+    /**
+     * Checks if the host sustains the frame rate of the current session: captures, converts and encodes half a
+     * second of frames with its settings, blocking meanwhile. Call it after set() and before start(), not in standby
+     * whose capture already runs. The frames are not recorded.
+     * @return the measured throughput, with no frames if the run could not be made.
+     */
+	CaptureCalibration calibrate();
+    /**
+     * Gets the result of the last calibration run of the current session.
+     * @return the measured throughput, with no frames if calibrate() was not called.
+     */
+	[[nodiscard]] CaptureCalibration getCalibration() const;
+    /**
+     * Gets the measured drift of an audio device sample clock against the session clock, compensated while recording.
+     * @param source: the audio source, in the order they are added.
+     * @return the residual drift, the samples corrected so far and the estimated skew in ppm.
+     */
+	[[nodiscard]] av::Resample::Drift getAudioDrift(int source = 0) const;
+    /**
+     * Adds an audio device to mix into the recording, used from the next set() on.
+     * Without any, the default capture device of the platform is recorded.
+     * @param device: the capture device name of the platform input format.
+     * @param gain: linear gain of the device in the mix.
+     */
+	void addAudioSource(const std::string& device, float gain);
+    /**
+     * Removes the audio devices added, used from the next set() on.
+     */
+	void clearAudioSources();
+    /**
+     * Records every audio device on a track of its own, encoded on its own thread, instead of mixing them, used from the next set() on.
+     * @param enable: if the audio devices have to be recorded on separate tracks.
+     */
+	void setSeparateAudioTracks(bool enable);
+    /**
+     * Gets the statistics of the audio mixer of the current session.
+     * @return the mixed frames, the ones reduced by the limiter and the capture gaps filled or dropped.
+     */
+	[[nodiscard]] av::AudioMixer::Stats getMixerStats() const;
+    /**
+     * Lets the audio encoders skip long quiet spans, muxed as a cached silent packet, used from the next set() on.
+     * @param enable: if the quiet spans have to be skipped.
+     * @param thresholdDb: the RMS level in dBFS under which the audio counts as quiet.
+     */
+	void setSilenceSkipping(bool enable, double thresholdDb = -60);
+    /**
+     * Gets how much of an audio track was quiet and how much of it skipped the encoder.
+     * @param track: the audio track, 0 for the mix or the first source.
+     * @return the samples written, the quiet ones and the skipped ones, empty if the skipping is disabled.
+     */
+	[[nodiscard]] av::StreamWriter::SilenceStats getSilenceStats(int track = 0) const;
+    /**
+     * Runs the capture loops on dedicated threads with realtime scheduling and the process memory locked, used from the next set() on.
+     * Without the privileges for it the threads fall back to a raised nice value, or to normal scheduling, and only their stacks and
+     * the frame arena are locked.
+     * @param enable: if the capture threads have to be realtime.
+     * @param cpu: the core to pin the capture threads to, -1 for any.
+     */
+	void setRealtimeCapture(bool enable, int cpu = -1);
+    /**
+     * Gets how many times the audio devices lost samples, seen as gaps in their timestamps.
+     * @return the overruns of all the audio sources of the current session.
+     */
+	[[nodiscard]] uint64_t getAudioXruns() const;
+    /**
+     * Keeps the next sessions warm: from set() on the devices capture and the encoders are open, the frames are
+     * dropped until start(), which then only opens the output, so recording begins within a frame interval.
+     * The trigger to first frame latency is the firstFrameMs of getStartupTiming().
+     * @param enable: if the sessions have to wait in standby.
+     */
+	void setStandby(bool enable);
+    /**
+     * Opens the devices without probing their streams, whose parameters come from the device headers, used from the
+     * next set() on.
+     * @param enable: if the session has to be opened the fast way.
+     */
+	void setFastOpen(bool enable);
+    /**
+     * Gets how long the current session took to open and to write its first frame.
+     * @return the open time of set() and the time from start() to the first video frame.
+     */
+	[[nodiscard]] StartupTiming getStartupTiming() const;
+    /**
+     * Divides the cores among capture, conversion and encoding, used from the next set() on.
+     * The video is then converted and encoded on a thread of its own, the encoder gets a thread budget and the
+     * stages are pinned to their cores, realtime capture threads to the capture core unless one is set.
+     * @param enable: if the session threads have to be planned.
+     */
+	void setThreadPlanning(bool enable);
+    /**
+     * Gets the thread plan of the current session.
+     * @return the cores given to each stage, empty if the planning is disabled.
+     */
+	[[nodiscard]] ThreadPlan getThreadPlan() const;
+    /**
+     * Lets the video encoder favour the parts of the screen that changed, used from the next set() on.
+     * Each frame is compared with the previous one per macroblock and the changed ones are encoded at a finer quality.
+     * @param enable: if the changed regions have to be passed to the encoder.
+     */
+	void setChangeRegions(bool enable);
+    /**
+     * Gets how much of the screen changed in the current session.
+     * @return the compared and the changed macroblocks, empty if the change regions are disabled.
+     */
+	[[nodiscard]] av::ChangeMap::Stats getChangeStats() const;
+    /**
+     * Converts only the parts of the captured frames that changed, used from the next set() on.
+     * The conversion to the encoder pixel format then costs in proportion to the screen activity.
+     * @param tileSize: the side in pixels of the compared and converted tiles, 0 to convert every frame whole.
+     */
+	void setTileConversion(int tileSize);
+    /**
+     * Gets how many tiles of the current session kept their previous conversion.
+     * @return the compared and the converted tiles, empty if the tile conversion is disabled.
+     */
+	[[nodiscard]] av::StreamWriter::TileStats getTileStats() const;
+    /**
+     * Adds a lower resolution encoding of the screen, made from the next set() on along with the recording.
+     * Renditions are scaled down from each other in decreasing height, the highest from the recording, and each is
+     * encoded on a thread of its own.
+     * @param height: the picture height, the width keeps the aspect ratio of the recording.
+     * @param output: the file of the rendition, empty to add it as a video track of the recording.
+     */
+	void addRendition(int height, const std::string& output = "");
+    /**
+     * Removes the renditions, the next sessions only record the screen at its resolution.
+     */
+	void clearRenditions();
+    /**
+     * Makes a small RGB copy of the recorded screen available to monitor it, from the next set() on.
+     * @param width: the preview width, the height keeps the aspect ratio, 0 to disable the preview.
+     * @param fps: how many previews are made per second.
+     */
+	void setPreview(int width, int fps = 5);
+    /**
+     * Gets the last preview of the current session, never waits for the recording.
+     * @return the RGB24 frame, shared with the next readers, null if there is no preview yet.
+     */
+	[[nodiscard]] std::shared_ptr<const av::Frame> getPreview() const;
+    /**
+     * Publishes the captured frames in a shared memory ring other local processes map read-only, from the next set()
+     * on, so they analyze the screen without grabbing it again. Linux only.
+     * @param enable: if the captured frames have to be published.
+     * @param slots: the frames the ring keeps for slow readers.
+     */
+	void setFrameRing(bool enable, int slots = 4);
+    /**
+     * Records a part of the screen to a file of its own, from the next set() on. The sessions then grab the bounding
+     * box of the regions once and crop every region from it without copying its pixels. The regions have to be
+     * inside the area set() is given, the screen by default. The session output only records the audio, unless
+     * setRegionBox() asks for the bounding box too.
+     * @param x: the left edge of the region on the screen.
+     * @param y: the top edge of the region on the screen.
+     * @param width: the region width.
+     * @param height: the region height.
+     * @param output: the file of the region.
+     */
+	void addRegion(int x, int y, int width, int height, const std::string& output);
+    /**
+     * Removes the regions, the next sessions only record the area given to set().
+     */
+	void clearRegions();
+    /**
+     * Records the bounding box of the regions to the session output as well, from the next set() on. Renditions,
+     * previews and the converted frame subscribers need it, they work on the session video.
+     * @param enable: if the bounding box has to be recorded.
+     */
+	void setRegionBox(bool enable);
+    /**
+     * Gets where the captured frames of the current session are published, to open with FrameRingReader::open().
+     * @return the path of the ring, empty if there is none.
+     */
+	[[nodiscard]] std::string getFrameRingPath() const;
+    /**
+     * Calls back with every video frame of this and the next sessions, on a thread of the subscriber.
+     * The frame is a reference to the recorded one, valid after the callback as long as it is copied (av::Frame copies
+     * are references). A callback that falls behind by more than queueFrames loses the oldest frames, the recording
+     * never waits for it. A callback must not unsubscribe itself.
+     * @param stage: Captured for the frames as grabbed, Converted for the frames in the encoder pixel format.
+     * @param callback: the callback.
+     * @param queueFrames: the frames kept while the callback runs.
+     * @return the subscriber id.
+     */
+	int subscribe(FrameStage stage, std::function<void(const av::Frame&)> callback, size_t queueFrames = 2);
+    /**
+     * Stops calling back a subscriber, waiting for its running callback.
+     * @param id: the subscriber id.
+     */
+	void unsubscribe(int id);
+    /**
+     * Gets how a subscriber keeps up with the recording.
+     * @param id: the subscriber id.
+     * @return the delivered and dropped frames and the callback lag.
+     */
+	[[nodiscard]] SubscriberStats getSubscriberStats(int id) const;
     /**
      * Starts the recording session.
      */
@@ -81,6 +329,15 @@ public:
      * Stops the recording session.
      */
     void stop();
+    /**
+     * Continues the started session in a new file, capture and encoders keep running.
+     * The new file starts now with a keyframe and its timestamps from zero, the previous one ends where it begins.
+     * Renditions and regions written to outputs of their own are not rolled over, such sessions are refused.
+     * @param output: the path of the new file.
+     * @return true if the new file was opened, false if the session is not started, has rendition or region outputs
+     * or the file can't be opened.
+     */
+	bool rollover(const std::string& output);
     /**
 	 * Gets if the recording is in pause.
 	 * @return true if the recording is in pause state, false contrariwise.
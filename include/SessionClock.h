@@ -0,0 +1,43 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+extern "C" {
+#include <libavutil/rational.h>
+}
+
+/**
+ * Monotonic clock of a recording session, in microseconds (AV_TIME_BASE) since start(), paused spans excluded.
+ * Every captured frame is stamped against it, so audio and video share one timeline.
+ */
+class SessionClock
+{
+	std::atomic<int64_t> origin{0};
+	std::atomic<int64_t> pausedSince{0};
+	std::atomic<int64_t> pausedTotal{0};
+public:
+    /**
+     * Starts the session timeline at zero.
+     */
+	void start();
+    /**
+     * Stops the timeline until resume().
+     */
+	void pause();
+    /**
+     * Resumes the timeline, the paused span is not counted.
+     */
+	void resume();
+    /**
+     * Gets the current session time.
+     * @return the microseconds elapsed since start().
+     */
+	[[nodiscard]] int64_t now() const;
+    /**
+     * Converts a timestamp set by a capture device (wall clock, as x11grab and ALSA stamp their packets) to session time.
+     * Timestamps in the future or older than a second are not device wall clock stamps, the current time is used instead.
+     * @param pts: the device timestamp, AV_NOPTS_VALUE if it has none.
+     * @param timeBase: the time base of pts.
+     * @return the session time of the capture in microseconds.
+     */
+	[[nodiscard]] int64_t fromCapture(int64_t pts, AVRational timeBase) const;
+};
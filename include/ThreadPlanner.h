@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <iostream>
+#include "../libav-cpp-master/av/Encoder.hpp"
+
+/**
+ * Cores given to each stage of a recording session, as masks where bit n is core n and 0 means any core.
+ */
+struct ThreadPlan
+{
+	int cores = 0; // cores of the machine, 0 if no plan was made
+	int captureCpu = -1; // core of the capture threads, the audio encoders and the muxer
+	uint64_t captureMask = 0; // the capture core as a mask
+	uint64_t conversionMask = 0; // core of the video writer thread, which converts the captured frames
+	av::EncoderThreading video; // threads and cores of the video encoder
+	av::EncoderThreading audio; // threads and cores of every audio encoder
+};
+
+/**
+ * Divides the cores of the machine among the stages of a session, so the encoder does not oversubscribe the cores
+ * capture and conversion run on.
+ */
+class ThreadPlanner
+{
+public:
+	/**
+	 * Plans a session: one core for capture, muxing and the audio encoders, one for the conversion of the captured
+	 * frames and the rest for the video encoder, frame threaded with no more threads than the picture height uses.
+	 * With fewer than 4 cores stages share cores, with fewer than 3 nothing is pinned.
+	 * @param cores: the cores of the machine.
+	 * @param height: the captured picture height.
+	 * @return the plan.
+	 */
+	static ThreadPlan plan(int cores, int height);
+};
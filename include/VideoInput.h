@@ -5,26 +5,61 @@
 #include <memory>
 #include <future>
 #include <chrono>
+#include <atomic>
 #include "../libav-cpp-master/av/common.hpp"
 #include "../libav-cpp-master/av/Packet.hpp"
 #include "../libav-cpp-master/av/Decoder.hpp"
+#include "../libav-cpp-master/av/FramePool.hpp"
+#include "../libav-cpp-master/av/Scale.hpp"
 #include "../libav-cpp-master/av/StreamWriter.hpp"
 #include "ThreadStructures.h"
+#include "CaptureOptions.h"
+#include "SessionClock.h"
+#include "CaptureThread.h"
+#include "FrameRing.h"
+#include "FrameSubscribers.h"
 
 class VideoInput
 {
+	/**
+	 * Rectangle of the captured frames recorded by a writer of its own.
+	 */
+	struct CaptureRegion
+	{
+		std::shared_ptr<av::StreamWriter> writer;
+		int x;
+		int y;
+		int width;
+		int height;
+		av::Frame crop; // reference to the captured frame, reused for every frame
+	};
+
 	AVFormatContext* inputContext;
 	AVInputFormat* inputFormat;
 	AVDictionary* opts;
 	tuple<AVStream*, shared_ptr<av::Decoder>> stream;
 	std::shared_ptr<av::StreamWriter> writer;
+	std::shared_ptr<SessionClock> clock;
+	av::Packet packet;
+	std::shared_ptr<av::FramePool> framePool;
+	CaptureCalibration calibration;
+	bool realtime;
+	int captureCpu;
+	CaptureThread captureThread;
+	std::atomic<int64_t> firstFrameTime;
+	std::atomic<bool> standby;
+	std::shared_ptr<FrameRingWriter> frameRing;
+	std::shared_ptr<FrameSubscribers> subscribers;
+	std::vector<CaptureRegion> regions;
 
 	VideoInput();
-	bool init(int width, int height, int offset_x, int offset_y, std::shared_ptr<av::StreamWriter> writer);
-	bool findBestStream(AVMediaType type);
+	bool init(int width, int height, int offset_x, int offset_y, const CaptureOptions& options, std::shared_ptr<SessionClock> clock, std::shared_ptr<av::StreamWriter> writer);
+	bool findBestStream(AVMediaType type, const CaptureOptions& options);
 	bool readPacket(av::Packet& packet);
 	bool readFrame(av::Frame& frame);
+	bool createFrameRing(int slots);
 	void record(bool* isStopped, const bool* onPause);
+	void writeRegions(const av::Frame& frame);
 public:
     /**
      * Destroyer.
@@ -36,7 +71,56 @@ public:
 	 */
 	AVPixelFormat getPixelFormat();
 	/**
-	 * Starts the thread for recording the desktop video.
+	 * Gets the recycling statistics of the captured frames pool.
+	 * @return the pool hits and misses.
+	 */
+	av::PoolStats getFramePoolStats();
+	/**
+	 * Captures half a second of frames, converting and encoding each like the writer does, to check if the host
+	 * sustains the frame rate. The frames are dropped, the capture thread must not run meanwhile.
+	 * @param frameRate: the requested frame rate.
+	 * @param encoder: an open video encoder with the settings of the session.
+	 * @return false if no frame could be captured or encoded.
+	 */
+	bool calibrate(int frameRate, av::Encoder& encoder);
+	/**
+	 * Gets the result of the last calibration run.
+	 * @return the measured capture, conversion and encoding throughput.
+	 */
+	CaptureCalibration getCalibration();
+	/**
+	 * Gets when the first captured frame was handed to the writer.
+	 * @return the av_gettime_relative() time in microseconds, 0 if no frame was written yet.
+	 */
+	int64_t getFirstFrameTime();
+	/**
+	 * Keeps the capture running without writing, the frames are grabbed and dropped until standby is left.
+	 * @param enable: if the captured frames have to be dropped.
+	 */
+	void setStandby(bool enable);
+	/**
+	 * Gets where other processes of the user map the captured frames from, see FrameRingReader.
+	 * @return the path of the frame ring, empty if the session has none.
+	 */
+	std::string getFrameRingPath();
+	/**
+	 * Hands the captured frames to subscribers, set before the record thread is launched.
+	 * @param subscribers: the subscribers of the recorder.
+	 */
+	void setSubscribers(std::shared_ptr<FrameSubscribers> subscribers);
+	/**
+	 * Records a rectangle of the captured frames with another writer, the frames are cropped by moving their plane
+	 * pointers, the pixels are not copied. Added before the record thread is launched.
+	 * @param writer: the writer, its stream 0 is a video stream of the rectangle size in the capture pixel format.
+	 * @param x: the left edge of the rectangle in the captured frame.
+	 * @param y: the top edge of the rectangle in the captured frame.
+	 * @param width: the rectangle width.
+	 * @param height: the rectangle height.
+	 * @return false if the rectangle is not inside the captured frames.
+	 */
+	bool addRegion(std::shared_ptr<av::StreamWriter> writer, int x, int y, int width, int height);
+	/**
+	 * Starts the thread for recording the desktop video, a dedicated realtime one if the session asks for it.
 	 * @param isStopped: boolean to stop the thread.
 	 * @param onPause: boolean to set on pause the thread.
 	 * @return the promise.
@@ -48,10 +132,12 @@ public:
 	 * @param height: video height.
 	 * @param offset_x: video left up corner x coordinate.
 	 * @param offset_y: video left up corner y coordinate.
-	 * @param writer: writer to record the video.
+	 * @param options: capture tuning of the session.
+	 * @param clock: session clock the captured frames are stamped with.
+	 * @param writer: writer to record the video, null when only regions are recorded.
 	 * @return a smart pointer to the VideoInput object built.
 	 */
-	static std::shared_ptr<VideoInput> getInputReader(int width, int height, int offset_x, int offset_y, std::shared_ptr<av::StreamWriter> writer);
+	static std::shared_ptr<VideoInput> getInputReader(int width, int height, int offset_x, int offset_y, const CaptureOptions& options, std::shared_ptr<SessionClock> clock, std::shared_ptr<av::StreamWriter> writer);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,330 @@
+#pragma once
+
+#include "Frame.hpp"
+#include "Resample.hpp"
+#include "SampleConvert.hpp"
+#include "common.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+namespace av
+{
+
+/*
+ * Mixes several capture sources into one planar float track.
+ * Each source is converted to the mixer format and placed on a shared sample timeline by its frame timestamps,
+ * with its own drift compensation. A source more than maxLatency behind the most advanced one counts as silence,
+ * so a stalled device does not hold the others back. The sum goes through a peak limiter and is handed out in
+ * frames of frameSize samples, stamped in 1/sampleRate.
+ */
+class AudioMixer : NoCopyable
+{
+	AudioMixer() = default;
+
+public:
+	// Peak level the limiter keeps the mix under
+	static constexpr float kCeiling = 0.98f;
+
+	struct Stats
+	{
+		uint64_t frames{0};        // mixed frames handed out
+		uint64_t limited{0};       // frames the limiter reduced
+		uint64_t paddedSamples{0}; // silence inserted for capture gaps
+		uint64_t droppedFrames{0}; // source frames behind the timeline
+	};
+
+	static Expected<Ptr<AudioMixer>> create(int channels, int sampleRate, int frameSize, AVRational maxLatency = {1, 5}) noexcept
+	{
+		if (channels <= 0 || channels > AV_NUM_DATA_POINTERS || sampleRate <= 0 || frameSize <= 0)
+			RETURN_AV_ERROR("Invalid mixer format: {} channels {} Hz {} samples per frame", channels, sampleRate, frameSize);
+
+		Ptr<AudioMixer> mixer{new AudioMixer};
+		mixer->channels_    = channels;
+		mixer->sampleRate_  = sampleRate;
+		mixer->frameSize_   = frameSize;
+		mixer->maxLatency_  = av_rescale_q(1, maxLatency, {1, sampleRate});
+		mixer->maxGap_      = av_rescale_q(1, kMaxGap, {1, sampleRate});
+		mixer->releaseStep_ = static_cast<float>(frameSize) / (static_cast<float>(sampleRate) * kReleaseSeconds);
+
+		mixer->pool_ = av_buffer_pool_init(FFALIGN(frameSize * static_cast<int>(sizeof(float)), 64), nullptr);
+		mixer->scratch_.resize(static_cast<size_t>(channels) * frameSize);
+		mixer->silence_.resize(frameSize);
+		if (!mixer->pool_)
+			RETURN_AV_ERROR("Failed to create mixer buffer pool");
+
+		return mixer;
+	}
+
+	~AudioMixer()
+	{
+		for (auto& source : sources_)
+			av_audio_fifo_free(source.fifo);
+		if (pool_)
+			av_buffer_pool_uninit(&pool_);
+	}
+
+	// Registers a source before the first push, returns its index
+	[[nodiscard]] Expected<int> addSource(int channels, AVSampleFormat sampleFmt, int sampleRate, float gain = 1.0f) noexcept
+	{
+		auto resampleExp = Resample::create(channels, sampleFmt, sampleRate, channels_, AV_SAMPLE_FMT_FLTP, sampleRate_);
+		if (!resampleExp)
+			FORWARD_AV_ERROR(resampleExp);
+
+		auto fifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_FLTP, channels_, static_cast<int>(maxLatency_) + 2 * frameSize_);
+		if (!fifo)
+			RETURN_AV_ERROR("Failed to allocate mixer fifo");
+
+		std::lock_guard lk{mutex_};
+		auto& source    = sources_.emplace_back();
+		source.resample = resampleExp.value();
+		source.fifo     = fifo;
+		source.gain     = gain;
+
+		return static_cast<int>(sources_.size()) - 1;
+	}
+
+	void setGain(int source, float gain) noexcept
+	{
+		std::lock_guard lk{mutex_};
+		sources_[source].gain = gain;
+	}
+
+	// frame.pts in timeBase places it on the timeline, frames without timestamp follow the previous one
+	[[nodiscard]] Expected<void> push(int source, Frame& frame, AVRational timeBase) noexcept
+	{
+		std::lock_guard lk{mutex_};
+		auto& src = sources_[source];
+
+		// everything before the read position is mixed already, e.g. after the source stalled
+		if (readPos_ != AV_NOPTS_VALUE && src.endPos != AV_NOPTS_VALUE && src.endPos < readPos_)
+		{
+			av_audio_fifo_reset(src.fifo);
+			src.endPos = readPos_;
+		}
+
+		const auto pts = frame.native()->pts;
+		if (pts != AV_NOPTS_VALUE)
+		{
+			const auto pos = av_rescale_q(pts, timeBase, {1, sampleRate_});
+			if (src.endPos == AV_NOPTS_VALUE)
+				src.endPos = src.firstPos = pos;
+
+			const auto drift = pos - src.endPos;
+			if (drift > maxGap_)
+			{
+				if (!writeSilence(src, drift))
+					RETURN_AV_ERROR("Failed to pad {} samples of silence", drift);
+				stats_.paddedSamples += drift;
+			}
+			else if (drift < -maxGap_)
+			{
+				// overlaps what is already queued or mixed
+				stats_.droppedFrames++;
+				return {};
+			}
+			else if (auto compExp = src.resample->compensate(drift, src.endPos - src.firstPos); !compExp)
+				LOG_AV_ERROR_EVERY(1000, "{}", compExp.errorString());
+		}
+
+		frame.native()->channel_layout = av_get_default_channel_layout(frame.native()->channels);
+		av_frame_unref(src.converted.native());
+		auto convExp = src.resample->convert(frame, src.converted);
+		if (!convExp)
+			FORWARD_AV_ERROR(convExp);
+
+		auto converted = src.converted.native();
+		if (converted->nb_samples > 0)
+		{
+			auto err = av_audio_fifo_write(src.fifo, reinterpret_cast<void**>(converted->extended_data), converted->nb_samples);
+			if (err < 0)
+				RETURN_AV_ERROR("Failed to queue {} mixer samples: {}", converted->nb_samples, avErrorStr(err));
+			if (src.endPos == AV_NOPTS_VALUE)
+				src.endPos = src.firstPos = 0;
+			src.endPos += converted->nb_samples;
+		}
+
+		return {};
+	}
+
+	// Produces the next mixed frame once every live source covers it, false while more input is needed
+	[[nodiscard]] Expected<bool> pull(Frame& output) noexcept
+	{
+		std::lock_guard lk{mutex_};
+
+		int64_t latest = AV_NOPTS_VALUE;
+		int64_t start  = AV_NOPTS_VALUE;
+		for (auto& src : sources_)
+		{
+			if (src.endPos == AV_NOPTS_VALUE)
+				continue;
+			const auto srcStart = src.endPos - av_audio_fifo_size(src.fifo);
+			start               = start == AV_NOPTS_VALUE ? srcStart : std::min(start, srcStart);
+			latest              = std::max(latest, src.endPos);
+		}
+		if (latest == AV_NOPTS_VALUE)
+			return false;
+		if (readPos_ == AV_NOPTS_VALUE)
+			readPos_ = start;
+
+		const auto end = readPos_ + frameSize_;
+		if (latest < end)
+			return false;
+		for (auto& src : sources_)
+		{
+			const bool live = src.endPos != AV_NOPTS_VALUE && src.endPos >= latest - maxLatency_;
+			if (live && src.endPos < end)
+				return false;
+		}
+
+		auto out = output.native();
+		av_frame_unref(out);
+		out->format         = AV_SAMPLE_FMT_FLTP;
+		out->channels       = channels_;
+		out->channel_layout = av_get_default_channel_layout(channels_);
+		out->sample_rate    = sampleRate_;
+		out->nb_samples     = frameSize_;
+		out->linesize[0]    = FFALIGN(frameSize_ * static_cast<int>(sizeof(float)), 64);
+		for (int c = 0; c < channels_; ++c)
+		{
+			out->buf[c] = av_buffer_pool_get(pool_);
+			if (!out->buf[c])
+				RETURN_AV_ERROR("Failed to get mixer buffer from pool");
+			out->data[c] = out->buf[c]->data;
+			std::memset(out->data[c], 0, frameSize_ * sizeof(float));
+		}
+		out->extended_data = out->data;
+
+		for (auto& src : sources_)
+			mixSource(src, out);
+
+		limit(out);
+
+		out->pts = readPos_;
+		readPos_ = end;
+		stats_.frames++;
+
+		return true;
+	}
+
+	// Sample clock drift of a source against the timestamps it is pushed with
+	[[nodiscard]] Resample::Drift drift(int source) const noexcept
+	{
+		std::lock_guard lk{mutex_};
+		return sources_[source].resample->drift();
+	}
+
+	[[nodiscard]] Stats stats() const noexcept
+	{
+		std::lock_guard lk{mutex_};
+		return stats_;
+	}
+
+	int channels() const noexcept
+	{
+		return channels_;
+	}
+	int sampleRate() const noexcept
+	{
+		return sampleRate_;
+	}
+	int frameSize() const noexcept
+	{
+		return frameSize_;
+	}
+
+private:
+	struct Source
+	{
+		Ptr<Resample> resample;
+		Frame converted;
+		AVAudioFifo* fifo{nullptr};
+		int64_t firstPos{AV_NOPTS_VALUE};
+		int64_t endPos{AV_NOPTS_VALUE};// timeline position right after the last queued sample
+		float gain{1.0f};
+	};
+
+	bool writeSilence(Source& src, int64_t samples) noexcept
+	{
+		void* planes[AV_NUM_DATA_POINTERS];
+		for (int c = 0; c < channels_; ++c)
+			planes[c] = silence_.data();
+
+		for (int64_t left = samples; left > 0;)
+		{
+			const auto n = static_cast<int>(std::min<int64_t>(left, frameSize_));
+			if (av_audio_fifo_write(src.fifo, planes, n) < n)
+				return false;
+			left -= n;
+		}
+		src.endPos += samples;
+		return true;
+	}
+
+	void mixSource(Source& src, AVFrame* out) noexcept
+	{
+		if (src.endPos == AV_NOPTS_VALUE)
+			return;
+
+		auto start = src.endPos - av_audio_fifo_size(src.fifo);
+		if (start < readPos_)
+		{
+			av_audio_fifo_drain(src.fifo, static_cast<int>(std::min<int64_t>(readPos_ - start, av_audio_fifo_size(src.fifo))));
+			start = readPos_;
+		}
+
+		const auto offset = static_cast<int>(start - readPos_);
+		if (offset >= frameSize_)
+			return;
+
+		void* planes[AV_NUM_DATA_POINTERS];
+		for (int c = 0; c < channels_; ++c)
+			planes[c] = scratch_.data() + static_cast<size_t>(c) * frameSize_;
+
+		const auto n = av_audio_fifo_read(src.fifo, planes, frameSize_ - offset);
+		for (int c = 0; n > 0 && c < channels_; ++c)
+			simd::mixAdd(reinterpret_cast<float*>(out->data[c]) + offset, static_cast<const float*>(planes[c]), n, src.gain);
+	}
+
+	// Linked peak limiter: instant attack to keep the frame under kCeiling, linear release over kReleaseSeconds
+	void limit(AVFrame* out) noexcept
+	{
+		float peak = 0;
+		for (int c = 0; c < channels_; ++c)
+			peak = std::max(peak, simd::peak(reinterpret_cast<const float*>(out->data[c]), frameSize_));
+
+		const float release = std::min(1.0f, limiterGain_ + releaseStep_);
+		const float target  = peak * release > kCeiling ? kCeiling / peak : release;
+		const float from    = target < limiterGain_ ? target : limiterGain_;
+		if (target < 1.0f)
+			stats_.limited++;
+
+		for (int c = 0; c < channels_; ++c)
+			simd::applyGain(reinterpret_cast<float*>(out->data[c]), frameSize_, from, target);
+
+		limiterGain_ = target;
+	}
+
+private:
+	static constexpr AVRational kMaxGap    = {1, 25};
+	static constexpr float kReleaseSeconds = 0.2f;
+
+	int channels_{0};
+	int sampleRate_{0};
+	int frameSize_{0};
+	int64_t maxLatency_{0};
+	int64_t maxGap_{0};
+	float releaseStep_{0};
+	float limiterGain_{1.0f};
+
+	mutable std::mutex mutex_;
+	std::vector<Source> sources_;
+	int64_t readPos_{AV_NOPTS_VALUE};
+	AVBufferPool* pool_{nullptr};
+	std::vector<float> scratch_;
+	std::vector<float> silence_;
+	Stats stats_;
+};
+
+}// namespace av
@@ -0,0 +1,278 @@
+#pragma once
+
+#include "Frame.hpp"
+#include "common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define AV_CHANGE_MAP_SSE2 1
+#endif
+
+namespace av::simd
+{
+
+// Compares a block of rows, bytes per row, stopping at the first row that differs
+inline bool blockEqual(const uint8_t* a, int strideA, const uint8_t* b, int strideB, size_t bytes, int rows) noexcept
+{
+	for (int y = 0; y < rows; ++y, a += strideA, b += strideB)
+	{
+		size_t i = 0;
+#if AV_CHANGE_MAP_SSE2
+		auto diff = _mm_setzero_si128();
+		for (; i + 16 <= bytes; i += 16)
+		{
+			const auto va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+			const auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+			diff          = _mm_or_si128(diff, _mm_xor_si128(va, vb));
+		}
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF)
+			return false;
+#endif
+		if (i < bytes && std::memcmp(a + i, b + i, bytes - i))
+			return false;
+	}
+	return true;
+}
+
+inline void copyBlock(uint8_t* dst, int dstStride, const uint8_t* src, int srcStride, size_t bytes, int rows) noexcept
+{
+	for (int y = 0; y < rows; ++y, dst += dstStride, src += srcStride)
+		std::memcpy(dst, src, bytes);
+}
+
+}// namespace av::simd
+
+namespace av
+{
+
+/*
+ * Which square tiles of a picture changed since the previous one.
+ * The previous picture is kept as a copy in which only the changed tiles are copied again, so a static screen costs
+ * one compare per tile and no copy. Tiles of 16 are the H.264 macroblocks.
+ */
+class ChangeMap : NoCopyable
+{
+	// Tile edges of a plane: bytes into a line for the columns, lines for the rows
+	struct Plane
+	{
+		std::vector<int> columns;
+		std::vector<int> rows;
+	};
+
+	ChangeMap(Ptr<Frame> previous, int tileSize) noexcept
+	    : previous_(std::move(previous)),
+	      tileSize_(tileSize)
+	{}
+
+public:
+	struct Stats
+	{
+		uint64_t frames{0};
+		uint64_t tiles{0};
+		uint64_t changedTiles{0};
+
+		double changedFraction() const noexcept
+		{
+			return tiles ? static_cast<double>(changedTiles) / static_cast<double>(tiles) : 0.0;
+		}
+	};
+
+	static Expected<Ptr<ChangeMap>> create(int width, int height, AVPixelFormat pixFmt, int tileSize = 16) noexcept
+	{
+		const auto desc = av_pix_fmt_desc_get(pixFmt);
+		if (!desc || desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_PAL))
+			RETURN_AV_ERROR("Change map of {} pictures is not supported", av_get_pix_fmt_name(pixFmt));
+		if (width <= 0 || height <= 0 || tileSize <= 0 || tileSize % (1 << std::max(desc->log2_chroma_w, desc->log2_chroma_h)))
+			RETURN_AV_ERROR("Bad change map geometry: {}x{} in tiles of {}", width, height, tileSize);
+
+		auto frameExp = Frame::create(width, height, pixFmt);
+		if (!frameExp)
+			FORWARD_AV_ERROR(frameExp);
+
+		Ptr<ChangeMap> map{new ChangeMap{frameExp.value(), tileSize}};
+		map->columns_ = (width + tileSize - 1) / tileSize;
+		map->rows_    = (height + tileSize - 1) / tileSize;
+		map->changed_.resize(static_cast<size_t>(map->columns_) * map->rows_);
+
+		for (int p = 0; p < av_pix_fmt_count_planes(pixFmt); ++p)
+		{
+			const int shiftY = p == 1 || p == 2 ? desc->log2_chroma_h : 0;
+			Plane plane;
+			for (int c = 0; c <= map->columns_; ++c)
+				plane.columns.push_back(av_image_get_linesize(pixFmt, std::min(c * tileSize, width), p));
+			for (int r = 0; r <= map->rows_; ++r)
+				plane.rows.push_back(AV_CEIL_RSHIFT(std::min(r * tileSize, height), shiftY));
+			map->planes_.push_back(std::move(plane));
+		}
+
+		return map;
+	}
+
+	// Compares the picture with the previous one, returns the number of changed tiles. The first picture is all changed.
+	[[nodiscard]] Expected<int> update(const Frame& frame) noexcept
+	{
+		const auto src = frame.native();
+		const auto ref = previous_->native();
+		if (src->width != ref->width || src->height != ref->height || src->format != ref->format)
+			RETURN_AV_ERROR("Change map of {}x{} {} pictures got a {}x{} {} one", ref->width, ref->height, av_get_pix_fmt_name(static_cast<AVPixelFormat>(ref->format)),
+			                src->width, src->height, av_get_pix_fmt_name(static_cast<AVPixelFormat>(src->format)));
+
+		changedCount_ = 0;
+		for (int ty = 0; ty < rows_; ++ty)
+		{
+			for (int tx = 0; tx < columns_; ++tx)
+			{
+				bool same = !first_;
+				for (size_t p = 0; same && p < planes_.size(); ++p)
+					same = simd::blockEqual(tile(src, p, tx, ty), src->linesize[p], tile(ref, p, tx, ty), ref->linesize[p], tileBytes(p, tx), tileLines(p, ty));
+
+				changed_[ty * columns_ + tx] = !same;
+				if (same)
+					continue;
+
+				++changedCount_;
+				for (size_t p = 0; p < planes_.size(); ++p)
+					simd::copyBlock(tile(ref, p, tx, ty), ref->linesize[p], tile(src, p, tx, ty), src->linesize[p], tileBytes(p, tx), tileLines(p, ty));
+			}
+		}
+		first_ = false;
+
+		frames_.fetch_add(1, std::memory_order_relaxed);
+		tiles_.fetch_add(changed_.size(), std::memory_order_relaxed);
+		changedTiles_.fetch_add(changedCount_, std::memory_order_relaxed);
+
+		return static_cast<int>(changedCount_);
+	}
+
+	/*
+	 * Marks the changed tiles of the last update() as regions of interest of frame with qoffset, negative for a
+	 * better quality (see AVRegionOfInterest). Runs of changed tiles in a row are one region, continued down while
+	 * the rows below have the same run. A picture all changed or all static gets no regions.
+	 */
+	[[nodiscard]] Expected<void> attachRegionsOfInterest(Frame& frame, AVRational qoffset) noexcept
+	{
+		auto f = frame.native();
+		av_frame_remove_side_data(f, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+		if (!changedCount_ || changedCount_ == changed_.size())
+			return {};
+
+		const auto width  = previous_->native()->width;
+		const auto height = previous_->native()->height;
+
+		regions_.clear();
+		active_.clear();
+		for (int ty = 0; ty < rows_; ++ty)
+		{
+			const int top    = ty * tileSize_;
+			const int bottom = std::min(top + tileSize_, height);
+			size_t above     = 0;
+			continued_.clear();
+			for (int tx = 0; tx < columns_;)
+			{
+				if (!changed_[ty * columns_ + tx])
+				{
+					++tx;
+					continue;
+				}
+
+				const int first = tx;
+				while (tx < columns_ && changed_[ty * columns_ + tx])
+					++tx;
+
+				const int left  = first * tileSize_;
+				const int right = std::min(tx * tileSize_, width);
+				while (above < active_.size() && regions_[active_[above]].left < left)
+					++above;
+
+				if (above < active_.size() && regions_[active_[above]].left == left && regions_[active_[above]].right == right)
+				{
+					regions_[active_[above]].bottom = bottom;
+					continued_.push_back(active_[above]);
+					continue;
+				}
+
+				AVRegionOfInterest roi{};
+				roi.self_size = sizeof(AVRegionOfInterest);
+				roi.top       = top;
+				roi.bottom    = bottom;
+				roi.left      = left;
+				roi.right     = right;
+				roi.qoffset   = qoffset;
+				continued_.push_back(regions_.size());
+				regions_.push_back(roi);
+			}
+			std::swap(active_, continued_);
+		}
+
+		const auto size = regions_.size() * sizeof(AVRegionOfInterest);
+		auto sd         = av_frame_new_side_data(f, AV_FRAME_DATA_REGIONS_OF_INTEREST, static_cast<int>(size));
+		if (!sd)
+			RETURN_AV_ERROR("Failed to allocate {} regions of interest", regions_.size());
+		std::memcpy(sd->data, regions_.data(), size);
+
+		return {};
+	}
+
+	int columns() const noexcept
+	{
+		return columns_;
+	}
+	int rows() const noexcept
+	{
+		return rows_;
+	}
+	int tileSize() const noexcept
+	{
+		return tileSize_;
+	}
+
+	// Tile (x, y) changed in the last update()
+	bool changed(int x, int y) const noexcept
+	{
+		return changed_[y * columns_ + x];
+	}
+
+	Stats stats() const noexcept
+	{
+		return {frames_.load(std::memory_order_relaxed), tiles_.load(std::memory_order_relaxed), changedTiles_.load(std::memory_order_relaxed)};
+	}
+
+private:
+	uint8_t* tile(const AVFrame* f, size_t p, int tx, int ty) const noexcept
+	{
+		return f->data[p] + static_cast<ptrdiff_t>(planes_[p].rows[ty]) * f->linesize[p] + planes_[p].columns[tx];
+	}
+	size_t tileBytes(size_t p, int tx) const noexcept
+	{
+		return static_cast<size_t>(planes_[p].columns[tx + 1] - planes_[p].columns[tx]);
+	}
+	int tileLines(size_t p, int ty) const noexcept
+	{
+		return planes_[p].rows[ty + 1] - planes_[p].rows[ty];
+	}
+
+private:
+	Ptr<Frame> previous_;
+	int tileSize_{16};
+	int columns_{0};
+	int rows_{0};
+	std::vector<Plane> planes_;
+	std::vector<uint8_t> changed_;
+	size_t changedCount_{0};
+	bool first_{true};
+
+	std::vector<AVRegionOfInterest> regions_;
+	std::vector<size_t> active_;   // regions reaching the previous tile row, left to right
+	std::vector<size_t> continued_;// the same for the current row
+
+	std::atomic<uint64_t> frames_{0};
+	std::atomic<uint64_t> tiles_{0};
+	std::atomic<uint64_t> changedTiles_{0};
+};
+
+}// namespace av
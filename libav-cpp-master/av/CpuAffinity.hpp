@@ -0,0 +1,82 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#if __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace av
+{
+
+/*
+ * Core masks: bit n is core n, 0 means no restriction.
+ * Threads inherit the mask of the thread that starts them, which is how the worker threads a codec starts in
+ * avcodec_open2 get confined. Only Linux supports it, elsewhere masks are ignored.
+ */
+
+inline int cpuCount() noexcept
+{
+	const auto n = std::thread::hardware_concurrency();
+	return n ? static_cast<int>(n) : 1;
+}
+
+// Cores [first, first + count) as a mask, clipped to the 64 a mask holds
+inline uint64_t coreRange(int first, int count) noexcept
+{
+	uint64_t mask = 0;
+	for (int c = std::max(first, 0); c < first + count && c < 64; ++c)
+		mask |= uint64_t{1} << c;
+	return mask;
+}
+
+inline bool setThreadAffinity(uint64_t mask) noexcept
+{
+#if __linux__
+	if (!mask)
+		return true;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int c = 0; c < 64 && c < CPU_SETSIZE; ++c)
+		if (mask & (uint64_t{1} << c))
+			CPU_SET(c, &set);
+
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	return !mask;
+#endif
+}
+
+// Confines the calling thread, and the threads it starts, to a mask until the end of the scope
+class ScopedAffinity : NoCopyable
+{
+public:
+	explicit ScopedAffinity(uint64_t mask) noexcept
+	{
+#if __linux__
+		if (mask && pthread_getaffinity_np(pthread_self(), sizeof(saved_), &saved_) == 0)
+			restore_ = setThreadAffinity(mask);
+#endif
+	}
+
+	~ScopedAffinity()
+	{
+#if __linux__
+		if (restore_)
+			pthread_setaffinity_np(pthread_self(), sizeof(saved_), &saved_);
+#endif
+	}
+
+private:
+#if __linux__
+	cpu_set_t saved_{};
+#endif
+	bool restore_{false};
+};
+
+}// namespace av
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Frame.hpp"
+#include "FramePool.hpp"
 #include "Packet.hpp"
 #include "common.hpp"
 
@@ -14,7 +15,9 @@ class Decoder : NoCopyable
 	{}
 
 public:
-	static Expected<Ptr<Decoder>> create(AVCodec* codec, AVStream* stream, AVRational framerate = {})
+	// framePool: optional pool the decoder draws its output frames from. Only codecs with direct rendering use it:
+	// rawvideo and the pcm decoders of the capture devices don't, their frames reference the packet or the decoder's own buffers
+	static Expected<Ptr<Decoder>> create(AVCodec* codec, AVStream* stream, AVRational framerate = {}, Ptr<FramePool> framePool = nullptr)
 	{
 		if (!av_codec_is_decoder(codec))
 			RETURN_AV_ERROR("{} is not a decoder", codec->name);
@@ -41,6 +44,12 @@ public:
 			codecContext->framerate = framerate;
 		}
 
+		if (framePool)
+		{
+			codecContext->opaque      = framePool.get();
+			codecContext->get_buffer2 = &Decoder::getPooledBuffer;
+		}
+
 		AVDictionary* opts = nullptr;
 		ret                = avcodec_open2(codecContext, codecContext->codec, &opts);
 		if (ret < 0)
@@ -49,7 +58,10 @@ public:
 			RETURN_AV_ERROR("Could not open video codec: {}", avErrorStr(ret));
 		}
 
-		return Ptr<Decoder>{new Decoder{codecContext}};
+		Ptr<Decoder> decoder{new Decoder{codecContext}};
+		decoder->framePool_ = std::move(framePool);
+
+		return decoder;
 	}
 
 	~Decoder()
@@ -106,8 +118,52 @@ public:
 		return Result::kSuccess;
 	}
 
+	// Makes frame take the pixels of a raw video packet (rawvideo without codec tag, e.g. x11grab) instead of a
+	// decoder round trip. The packet's buffer reference moves to the frame, a new one would be an allocation per
+	// frame. False when the packet can't be used as is: another codec, not refcounted or short.
+	static bool wrapRawPacket(const AVCodecParameters* codecpar, Packet& packet, Frame& frame) noexcept
+	{
+		const auto pkt = packet.native();
+		if (codecpar->codec_id != AV_CODEC_ID_RAWVIDEO || codecpar->codec_tag || !pkt->buf)
+			return false;
+
+		const auto f    = frame.native();
+		const auto size = av_image_fill_arrays(f->data, f->linesize, pkt->data, (AVPixelFormat) codecpar->format, codecpar->width, codecpar->height, 1);
+		if (size < 0 || size > pkt->size)
+		{
+			av_frame_unref(f);
+			return false;
+		}
+
+		f->buf[0] = pkt->buf;
+		pkt->buf  = nullptr;
+
+		f->extended_data         = f->data;
+		f->format                = codecpar->format;
+		f->width                 = codecpar->width;
+		f->height                = codecpar->height;
+		f->pts                   = pkt->pts;
+		f->pkt_dts               = pkt->dts;
+		f->best_effort_timestamp = pkt->pts;
+		f->key_frame             = 1;
+		f->pict_type             = AV_PICTURE_TYPE_I;
+
+		return true;
+	}
+
+private:
+	static int getPooledBuffer(AVCodecContext* ctx, AVFrame* frame, int flags)
+	{
+		auto pool = static_cast<FramePool*>(ctx->opaque);
+		if (!(ctx->codec->capabilities & AV_CODEC_CAP_DR1) || !pool->fill(frame))
+			return avcodec_default_get_buffer2(ctx, frame, flags);
+
+		return 0;
+	}
+
 private:
 	AVCodecContext* codecContext_{nullptr};
+	Ptr<FramePool> framePool_;
 };
 
 }// namespace av
@@ -1,12 +1,33 @@
 #pragma once
 
+#include "CpuAffinity.hpp"
 #include "OptSetter.hpp"
 #include "common.hpp"
 #include "Frame.hpp"
 #include "Packet.hpp"
+#include "PacketPool.hpp"
+
+#include <algorithm>
+#include <mutex>
 
 namespace av
 {
+
+// Threads an encoder may use, applied at open()
+struct EncoderThreading
+{
+	enum class Type
+	{
+		kAuto, // whatever the codec prefers
+		kFrame,// several frames in flight: throughput, one frame of latency per thread
+		kSlice // slices of one frame: less latency, scales worse
+	};
+
+	int threads{0};      // 0 keeps the codec default
+	Type type{Type::kAuto};
+	uint64_t coreMask{0};// cores of the codec threads, 0 for any
+};
+
 class Encoder : NoCopyable
 {
 	explicit Encoder(AVCodecContext* codecContext) noexcept
@@ -19,26 +40,9 @@ public:
 		/* find the encoder */
 		//codec_ = avcodec_find_encoder(codecId);
 
-		void* it             = nullptr;
-		const AVCodec* codec = nullptr;
-		for (;;)
-		{
-			codec = av_codec_iterate(&it);
-
-			if (!codec)
-				RETURN_AV_ERROR("Could not find encoder for '{}'", avcodec_get_name(codecId));
-
-			if (!av_codec_is_encoder(codec))
-				continue;
-
-			if (codec->id != codecId)
-				continue;
-
-			if (!allowHWAccel && codec->capabilities & AV_CODEC_CAP_HARDWARE)
-				continue;
-
-			break;
-		}
+		auto codec = findEncoder(codecId, allowHWAccel);
+		if (!codec)
+			RETURN_AV_ERROR("Could not find encoder for '{}'", avcodec_get_name(codecId));
 
 		auto codecContext = avcodec_alloc_context3(codec);
 		if (!codecContext)
@@ -96,6 +100,9 @@ public:
 
 	Expected<void> open() noexcept
 	{
+		// the codec starts its threads here, they inherit the mask
+		ScopedAffinity affinity{threading_.coreMask};
+
 		AVDictionary* opts = nullptr;
 		auto ret           = avcodec_open2(codecContext_, codecContext_->codec, &opts);
 		if (ret < 0)
@@ -107,6 +114,49 @@ public:
 		return {};
 	}
 
+	// Before open(). The thread type falls back to the other one when the codec only supports that.
+	void setThreading(const EncoderThreading& threading) noexcept
+	{
+		threading_ = threading;
+
+		const auto caps  = codecContext_->codec->capabilities;
+		const bool frame = caps & (AV_CODEC_CAP_FRAME_THREADS | AV_CODEC_CAP_OTHER_THREADS);
+		const bool slice = caps & (AV_CODEC_CAP_SLICE_THREADS | AV_CODEC_CAP_OTHER_THREADS);
+
+		if (threading.threads > 0)
+			codecContext_->thread_count = threading.threads;
+		switch (threading.type)
+		{
+			case EncoderThreading::Type::kFrame:
+				codecContext_->thread_type = frame ? FF_THREAD_FRAME : FF_THREAD_SLICE;
+				break;
+			case EncoderThreading::Type::kSlice:
+				codecContext_->thread_type = slice ? FF_THREAD_SLICE : FF_THREAD_FRAME;
+				break;
+			case EncoderThreading::Type::kAuto:
+				break;
+		}
+	}
+
+	[[nodiscard]] const EncoderThreading& threading() const noexcept
+	{
+		return threading_;
+	}
+
+	// Before open(). Encoders with direct rendering take the payloads of their packets from the pool, packets larger
+	// than its payloads and those of the other encoders are allocated by libavcodec as usual.
+	void setPacketPool(Ptr<PacketPool> pool) noexcept
+	{
+		packetPool_                      = std::move(pool);
+		codecContext_->opaque            = packetPool_.get();
+		codecContext_->get_encode_buffer = packetPool_ ? &Encoder::getPooledPacketBuffer : &avcodec_default_get_encode_buffer;
+	}
+
+	[[nodiscard]] PoolStats packetPoolStats() const noexcept
+	{
+		return packetPool_ ? packetPool_->stats() : PoolStats{};
+	}
+
 	void setVideoParams(int width, int height, double fps, OptValueMap&& valueMap) noexcept
 	{
 		auto framerate = av_d2q(1.0 / fps, 100000);
@@ -123,6 +173,7 @@ public:
                      * timebase should be 1/framerate and timestamp increments should be
                      * identical to 1. */
 		codecContext_->time_base = framerate;
+		codecContext_->framerate = av_inv_q(framerate);
 
 		codecContext_->bit_rate = 0;
 		if (codecContext_->priv_data)
@@ -138,6 +189,7 @@ public:
 		codecContext_->channel_layout = av_get_default_channel_layout(channels);
 		codecContext_->sample_rate    = sampleRate;
 		codecContext_->bit_rate       = bitRate;
+		codecContext_->time_base      = {1, sampleRate};
 
 		/* Allow the use of the experimental encoder. */
         //codecContext_->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
@@ -205,6 +257,54 @@ public:
 	}
 
 private:
+	// The registry walk is linear over every codec, its results are kept for the next sessions
+	static const AVCodec* findEncoder(AVCodecID codecId, bool allowHWAccel) noexcept
+	{
+		struct Entry
+		{
+			AVCodecID id;
+			bool allowHWAccel;
+			const AVCodec* codec;
+		};
+		static std::mutex mutex;
+		static std::vector<Entry> cache;
+
+		std::lock_guard lk{mutex};
+		auto it = std::find_if(cache.begin(), cache.end(), [&](auto& e) { return e.id == codecId && e.allowHWAccel == allowHWAccel; });
+		if (it != cache.end())
+			return it->codec;
+
+		void* iter           = nullptr;
+		const AVCodec* codec = nullptr;
+		while ((codec = av_codec_iterate(&iter)))
+		{
+			if (!av_codec_is_encoder(codec))
+				continue;
+
+			if (codec->id != codecId)
+				continue;
+
+			if (!allowHWAccel && codec->capabilities & AV_CODEC_CAP_HARDWARE)
+				continue;
+
+			break;
+		}
+
+		if (codec)
+			cache.push_back({codecId, allowHWAccel, codec});
+
+		return codec;
+	}
+
+	static int getPooledPacketBuffer(AVCodecContext* ctx, AVPacket* pkt, int flags)
+	{
+		auto pool = static_cast<PacketPool*>(ctx->opaque);
+		if (!(ctx->codec->capabilities & AV_CODEC_CAP_DR1) || !pool->fill(pkt))
+			return avcodec_default_get_encode_buffer(ctx, pkt, flags);
+
+		return 0;
+	}
+
 	bool sendFrame(AVFrame* frame) noexcept
 	{
 		// send the frame to the encoder
@@ -317,6 +417,8 @@ private:
 
 private:
 	AVCodecContext* codecContext_{nullptr};
+	EncoderThreading threading_;
+	Ptr<PacketPool> packetPool_;
 };
 
 }// namespace av
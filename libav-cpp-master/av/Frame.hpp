@@ -1,5 +1,6 @@
 #pragma once
 
+#include "FrameArena.hpp"
 #include "common.hpp"
 
 namespace av
@@ -34,6 +35,34 @@ public:
 		return frame;
 	}
 
+	// Same as above with the planes carved from a preallocated arena (one contiguous buffer)
+	static Expected<Ptr<Frame>> create(int width, int height, AVPixelFormat pixFmt, FrameArena& arena, int align = 64) noexcept
+	{
+		auto frame = av::makePtr<Frame>();
+		if (!frame)
+			RETURN_AV_ERROR("Failed to alloc frame");
+
+		auto f    = frame->native();
+		f->width  = width;
+		f->height = height;
+		f->format = pixFmt;
+
+		auto size = av_image_get_buffer_size(pixFmt, FFALIGN(width, align), height, align);
+		if (size < 0)
+			RETURN_AV_ERROR("Failed to get buffer size: {}", avErrorStr(size));
+
+		f->buf[0] = arena.allocBuffer(static_cast<size_t>(size) + align);
+		if (!f->buf[0])
+			RETURN_AV_ERROR("Failed to get buffer from arena");
+
+		auto err = av_image_fill_arrays(f->data, f->linesize, f->buf[0]->data, pixFmt, FFALIGN(width, align), height, align);
+		if (err < 0)
+			RETURN_AV_ERROR("Failed to fill frame planes: {}", avErrorStr(err));
+		f->extended_data = f->data;
+
+		return frame;
+	}
+
 	~Frame()
 	{
 		if (frame_)
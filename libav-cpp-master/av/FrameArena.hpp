@@ -0,0 +1,242 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <mutex>
+
+#if __linux__
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace av
+{
+
+/*
+ * Preallocated arena for full-resolution frame buffers.
+ * On Linux the region is backed by explicit huge pages when the system has them reserved, transparent huge
+ * pages otherwise, bound to the NUMA node of the creating thread and prefaulted, so neither sws_scale nor
+ * the encoder take TLB misses or page faults on capture buffers. Elsewhere it is a single aligned allocation.
+ * Exhaustion is not an error: buffers fall back to av_malloc and are counted.
+ */
+class FrameArena : NoCopyable
+{
+#if FF_API_BUFFER_SIZE_T
+	using BufferSize = int;
+#else
+	using BufferSize = size_t;
+#endif
+
+	static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+	static constexpr size_t kAlignment    = 64;
+
+	// Outlives the arena while buffers are still referenced, the last returned buffer releases it
+	struct Region
+	{
+		std::mutex mutex;
+		uint8_t* base{nullptr};
+		size_t size{0};
+		size_t used{0};
+		size_t outstanding{0};
+		bool mapped{false};
+		bool orphaned{false};
+		std::vector<std::pair<size_t, std::vector<uint8_t*>>> freeLists;
+
+		~Region()
+		{
+#if __linux__
+			if (mapped)
+			{
+				munmap(base, size);
+				return;
+			}
+#endif
+			av_free(base);
+		}
+	};
+
+	FrameArena() = default;
+
+public:
+	enum class Backing
+	{
+		kHeap,
+		kTransparentHugePages,
+		kHugePages
+	};
+
+	struct Stats
+	{
+		size_t capacity{0};
+		size_t used{0};
+		uint64_t fallbacks{0};
+		Backing backing{Backing::kHeap};
+		int numaNode{-1};
+	};
+
+	static Expected<Ptr<FrameArena>> create(size_t bytes) noexcept
+	{
+		Ptr<FrameArena> arena{new FrameArena};
+		arena->region_ = new Region;
+		auto& region   = *arena->region_;
+		region.size    = FFALIGN(bytes, kHugePageSize);
+
+#if __linux__
+		void* p = mmap(nullptr, region.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+			arena->backing_ = Backing::kHugePages;
+		else
+		{
+			p = mmap(nullptr, region.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p == MAP_FAILED)
+				RETURN_AV_ERROR("Failed to map {} bytes for the frame arena: {}", region.size, strerror(errno));
+
+			if (madvise(p, region.size, MADV_HUGEPAGE) == 0)
+				arena->backing_ = Backing::kTransparentHugePages;
+		}
+		region.base   = static_cast<uint8_t*>(p);
+		region.mapped = true;
+
+		// prefer the node we are running on, before the first touch decides placement
+		unsigned cpu = 0, node = 0;
+		if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0)
+		{
+			unsigned long nodeMask = 1UL << node;
+			if (syscall(SYS_mbind, region.base, region.size, MPOL_PREFERRED, &nodeMask, sizeof(nodeMask) * 8, 0) == 0)
+				arena->numaNode_ = static_cast<int>(node);
+		}
+
+		const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		for (size_t off = 0; off < region.size; off += pageSize)
+			region.base[off] = 0;
+#else
+		region.base = static_cast<uint8_t*>(av_malloc(region.size));
+		if (!region.base)
+			RETURN_AV_ERROR("Failed to allocate {} bytes for the frame arena", region.size);
+		std::memset(region.base, 0, region.size);
+#endif
+
+		return arena;
+	}
+
+	~FrameArena()
+	{
+		bool release = false;
+		{
+			std::lock_guard lk{region_->mutex};
+			region_->orphaned = true;
+			release           = region_->outstanding == 0;
+		}
+		if (release)
+			delete region_;
+	}
+
+	// Refcounted buffer carved from the arena, or from av_malloc once the arena is exhausted
+	AVBufferRef* allocBuffer(size_t size) noexcept
+	{
+		auto data = allocate(size);
+		if (!data)
+		{
+			fallbacks_.fetch_add(1, std::memory_order_relaxed);
+			return av_buffer_alloc(static_cast<BufferSize>(size));
+		}
+
+		auto buf = av_buffer_create(data, static_cast<BufferSize>(size), &FrameArena::release, region_, 0);
+		if (!buf)
+			release(region_, data);
+
+		return buf;
+	}
+
+	// AVBufferPool allocator, use as av_buffer_pool_init2(size, arena, &FrameArena::poolAlloc, nullptr)
+	static AVBufferRef* poolAlloc(void* opaque, BufferSize size)
+	{
+		return static_cast<FrameArena*>(opaque)->allocBuffer(static_cast<size_t>(size));
+	}
+
+	[[nodiscard]] Stats stats() const noexcept
+	{
+		std::lock_guard lk{region_->mutex};
+		return {region_->size, region_->used, fallbacks_.load(std::memory_order_relaxed), backing_, numaNode_};
+	}
+
+	// Pins the whole region in RAM, fails without CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK
+	bool lock() noexcept
+	{
+#if __linux__
+		return mlock(region_->base, region_->size) == 0;
+#else
+		return false;
+#endif
+	}
+
+private:
+	// Every chunk starts with a kAlignment sized header holding its size class, so release() can find its free list
+	uint8_t* allocate(size_t size) noexcept
+	{
+		size = FFALIGN(size, kAlignment) + kAlignment;
+
+		std::lock_guard lk{region_->mutex};
+		auto it = std::find_if(region_->freeLists.begin(), region_->freeLists.end(), [size](auto& l) { return l.first == size; });
+		if (it != region_->freeLists.end() && !it->second.empty())
+		{
+			auto chunk = it->second.back();
+			it->second.pop_back();
+			++region_->outstanding;
+			return chunk + kAlignment;
+		}
+
+		if (region_->used + size > region_->size)
+			return nullptr;
+
+		// register the size class now so that releasing into it never allocates
+		if (it == region_->freeLists.end())
+			it = region_->freeLists.insert(it, {size, {}});
+		it->second.reserve(region_->size / size);
+
+		auto chunk = region_->base + region_->used;
+		region_->used += size;
+		++region_->outstanding;
+		std::memcpy(chunk, &size, sizeof(size));
+
+		return chunk + kAlignment;
+	}
+
+	static void release(void* opaque, uint8_t* data)
+	{
+		auto region = static_cast<Region*>(opaque);
+		auto chunk  = data - kAlignment;
+		size_t size = 0;
+		std::memcpy(&size, chunk, sizeof(size));
+
+		bool remove = false;
+		{
+			std::lock_guard lk{region->mutex};
+			for (auto& [chunkSize, chunks] : region->freeLists)
+			{
+				if (chunkSize == size)
+				{
+					chunks.push_back(chunk);
+					break;
+				}
+			}
+			--region->outstanding;
+			remove = region->orphaned && region->outstanding == 0;
+		}
+		if (remove)
+			delete region;
+	}
+
+private:
+	Region* region_{nullptr};
+	Backing backing_{Backing::kHeap};
+	int numaNode_{-1};
+	std::atomic<uint64_t> fallbacks_{0};
+};
+
+}// namespace av
@@ -0,0 +1,210 @@
+#pragma once
+
+#include "Frame.hpp"
+#include "FrameArena.hpp"
+#include "common.hpp"
+
+#include <atomic>
+#include <mutex>
+
+namespace av
+{
+
+/*
+ * Fixed-geometry video frame pool.
+ * The av::Frame objects are recycled once nobody but the pool references them, and their planes come from
+ * one AVBufferPool per plane, so in steady state neither the AVFrame structs nor the pixel data hit malloc.
+ * With an arena the pooled planes are carved from it instead of av_malloc.
+ */
+class FramePool : NoCopyable
+{
+	FramePool() = default;
+
+public:
+	static Expected<Ptr<FramePool>> create(int width, int height, AVPixelFormat pixFmt, size_t capacity, Ptr<FrameArena> arena = nullptr, int align = 64) noexcept
+	{
+		auto desc = av_pix_fmt_desc_get(pixFmt);
+		if (!desc || desc->flags & AV_PIX_FMT_FLAG_PAL || desc->flags & AV_PIX_FMT_FLAG_HWACCEL)
+			RETURN_AV_ERROR("Unsupported pool pixel format: {}", av_get_pix_fmt_name(pixFmt));
+
+		Ptr<FramePool> pool{new FramePool};
+		pool->width_  = width;
+		pool->height_ = height;
+		pool->pixFmt_ = pixFmt;
+
+		auto err = av_image_fill_linesizes(pool->linesizes_, pixFmt, FFALIGN(width, align));
+		if (err < 0)
+			RETURN_AV_ERROR("Failed to compute linesizes for {}x{} {}: {}", width, height, av_get_pix_fmt_name(pixFmt), avErrorStr(err));
+
+		ptrdiff_t linesizes[4];
+		for (int i = 0; i < 4; ++i)
+		{
+			pool->linesizes_[i] = FFALIGN(pool->linesizes_[i], align);
+			linesizes[i]        = pool->linesizes_[i];
+		}
+
+		size_t sizes[4] = {};
+		err             = av_image_fill_plane_sizes(sizes, pixFmt, height, linesizes);
+		if (err < 0)
+			RETURN_AV_ERROR("Failed to compute plane sizes for {}x{} {}: {}", width, height, av_get_pix_fmt_name(pixFmt), avErrorStr(err));
+
+		for (int i = 0; i < 4 && sizes[i]; ++i)
+		{
+			// same tail padding as av_frame_get_buffer, SIMD code may read past the last line
+			const auto size = static_cast<int>(sizes[i] + 16 + align - 1);
+			pool->pools_[i] = arena ? av_buffer_pool_init2(size, arena.get(), &FrameArena::poolAlloc, nullptr)
+			                        : av_buffer_pool_init(size, nullptr);
+			if (!pool->pools_[i])
+				RETURN_AV_ERROR("Failed to create buffer pool for plane {}", i);
+		}
+
+		pool->arena_ = std::move(arena);
+		pool->frames_.reserve(capacity);
+		for (size_t i = 0; i < capacity; ++i)
+			pool->frames_.emplace_back(makePtr<Frame>());
+
+		return pool;
+	}
+
+	~FramePool()
+	{
+		// outstanding buffers keep their AVBufferPool alive until they are released
+		for (auto& pool : pools_)
+			av_buffer_pool_uninit(&pool);
+	}
+
+	// Returns a writable frame of the pool geometry. Falls back to an unpooled frame (counted as a miss) when all are in use.
+	// withBuffers = false returns a blank frame for a decoder or av_frame_ref to fill.
+	[[nodiscard]] Expected<Ptr<Frame>> acquire(bool withBuffers = true) noexcept
+	{
+		auto frame = takeFree();
+		if (frame)
+			hits_.fetch_add(1, std::memory_order_relaxed);
+		else
+		{
+			misses_.fetch_add(1, std::memory_order_relaxed);
+			frame = makePtr<Frame>();
+		}
+
+		if (!withBuffers)
+			av_frame_unref(frame->native());
+		else if (!reset(frame->native()))
+			RETURN_AV_ERROR("Failed to get {}x{} {} buffers from pool", width_, height_, av_get_pix_fmt_name(pixFmt_));
+
+		return frame;
+	}
+
+	// Attaches pooled planes to a frame whose format/size are already set, e.g. from AVCodecContext::get_buffer2
+	bool fill(AVFrame* frame) noexcept
+	{
+		if (frame->format != pixFmt_ || frame->width > width_ || frame->height > height_)
+			return false;
+
+		for (int i = 0; i < 4 && pools_[i]; ++i)
+		{
+			frame->buf[i] = av_buffer_pool_get(pools_[i]);
+			if (!frame->buf[i])
+			{
+				for (int j = 0; j < i; ++j)
+					av_buffer_unref(&frame->buf[j]);
+				return false;
+			}
+			frame->data[i]     = frame->buf[i]->data;
+			frame->linesize[i] = linesizes_[i];
+		}
+		frame->extended_data = frame->data;
+
+		return true;
+	}
+
+	[[nodiscard]] PoolStats stats() const noexcept
+	{
+		return {hits_.load(std::memory_order_relaxed), misses_.load(std::memory_order_relaxed)};
+	}
+
+	int width() const noexcept
+	{
+		return width_;
+	}
+	int height() const noexcept
+	{
+		return height_;
+	}
+	AVPixelFormat pixFmt() const noexcept
+	{
+		return pixFmt_;
+	}
+
+private:
+	Ptr<Frame> takeFree() noexcept
+	{
+		std::lock_guard lk{mutex_};
+		for (size_t n = 0; n < frames_.size(); ++n)
+		{
+			auto& frame = frames_[next_];
+			next_       = (next_ + 1) % frames_.size();
+			// Only the pool still holds it, so nobody can copy a reference to it anymore. The fence pairs
+			// with the release of the last other holder: its writes to the frame happen before our reuse.
+			if (frame.use_count() == 1)
+			{
+				std::atomic_thread_fence(std::memory_order_acquire);
+				return frame;
+			}
+		}
+		return nullptr;
+	}
+
+	bool reset(AVFrame* f) noexcept
+	{
+		// Planes nobody else references are kept as they are: detach them, drop the previous
+		// properties and side data, then reattach. Shared planes go back to their AVBufferPool.
+		AVBufferRef* keep[4] = {};
+		bool exclusive       = f->buf[0] && f->format == pixFmt_ && f->width == width_ && f->height == height_;
+		for (int i = 0; exclusive && i < 4 && f->buf[i]; ++i)
+			exclusive = av_buffer_is_writable(f->buf[i]) && f->linesize[i] == linesizes_[i];
+
+		if (exclusive)
+		{
+			for (int i = 0; i < 4; ++i)
+			{
+				keep[i]   = f->buf[i];
+				f->buf[i] = nullptr;
+			}
+		}
+
+		av_frame_unref(f);
+		f->format = pixFmt_;
+		f->width  = width_;
+		f->height = height_;
+
+		if (!exclusive)
+			return fill(f);
+
+		for (int i = 0; i < 4 && keep[i]; ++i)
+		{
+			f->buf[i]      = keep[i];
+			f->data[i]     = keep[i]->data;
+			f->linesize[i] = linesizes_[i];
+		}
+		f->extended_data = f->data;
+
+		return true;
+	}
+
+private:
+	int width_{0};
+	int height_{0};
+	AVPixelFormat pixFmt_{AV_PIX_FMT_NONE};
+	int linesizes_[4]{};
+	AVBufferPool* pools_[4]{};
+	Ptr<FrameArena> arena_;
+
+	std::mutex mutex_;
+	std::vector<Ptr<Frame>> frames_;
+	size_t next_{0};
+
+	std::atomic<uint64_t> hits_{0};
+	std::atomic<uint64_t> misses_{0};
+};
+
+}// namespace av
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <thread>
+
+// Messages below this level are compiled out entirely (the format arguments are never evaluated)
+#ifndef AV_LOG_ACTIVE_LEVEL
+#define AV_LOG_ACTIVE_LEVEL 0
+#endif
+
+namespace av
+{
+
+enum LogLevel
+{
+	Trace    = 0,
+	Debug    = 1,
+	Info     = 2,
+	Warn     = 3,
+	Err      = 4,
+	Critical = 5,
+	Off      = 6,
+	n_levels
+};
+
+namespace internal
+{
+
+inline int64_t steadyMillis() noexcept
+{
+	using namespace std::chrono;
+	return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// One instance per call site, lets through at most one message every intervalMs
+class RateLimiter
+{
+public:
+	explicit RateLimiter(int64_t intervalMs) noexcept
+	    : intervalMs_(intervalMs)
+	{}
+
+	bool allow() noexcept
+	{
+		auto now  = steadyMillis();
+		auto last = last_.load(std::memory_order_relaxed);
+		if (last != kNever && now - last < intervalMs_)
+		{
+			suppressed_.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		if (!last_.compare_exchange_strong(last, now, std::memory_order_relaxed))
+		{
+			suppressed_.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		return true;
+	}
+
+	uint32_t takeSuppressed() noexcept
+	{
+		return suppressed_.exchange(0, std::memory_order_relaxed);
+	}
+
+private:
+	static constexpr int64_t kNever = INT64_MIN;
+
+	const int64_t intervalMs_;
+	std::atomic<int64_t> last_{kNever};
+	std::atomic<uint32_t> suppressed_{0};
+};
+
+}// namespace internal
+
+/*
+ * Asynchronous logging backend.
+ * Producers copy the message into a slot of a bounded lock-free queue and return immediately,
+ * a background thread owns stderr. When the queue is full the message is dropped and counted,
+ * so a slow terminal can never stall the capture or encoding threads.
+ */
+class Logger
+{
+public:
+	static constexpr size_t kQueueSize   = 1024;// must be a power of two
+	static constexpr size_t kMessageSize = 512;
+
+	static Logger& instance() noexcept
+	{
+		static Logger logger;
+		return logger;
+	}
+
+	Logger(const Logger&) = delete;
+	Logger& operator=(const Logger&) = delete;
+
+	~Logger()
+	{
+		stop_.store(true, std::memory_order_release);
+		if (sink_.joinable())
+			sink_.join();
+	}
+
+	// Checked by the logging macros before the message is formatted, a disabled message costs a load and a compare
+	[[nodiscard]] bool enabled(LogLevel level) const noexcept
+	{
+		return level >= level_.load(std::memory_order_relaxed);
+	}
+
+	bool push(LogLevel level, const char* file, int line, const char* fun, std::string_view msg, uint32_t suppressed = 0) noexcept
+	{
+		if (!enabled(level))
+			return false;
+
+		Slot* slot = nullptr;
+		auto pos   = enqueuePos_.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			slot     = &slots_[pos & (kQueueSize - 1)];
+			auto seq = slot->seq.load(std::memory_order_acquire);
+			auto dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (dif == 0)
+			{
+				if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (dif < 0)
+			{
+				dropped_.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			else
+				pos = enqueuePos_.load(std::memory_order_relaxed);
+		}
+
+		slot->level      = level;
+		slot->file       = file;
+		slot->line       = line;
+		slot->fun        = fun;
+		slot->suppressed = suppressed;
+		slot->length     = std::min(msg.size(), kMessageSize);
+		std::memcpy(slot->msg, msg.data(), slot->length);
+		slot->seq.store(pos + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	// Blocks until every message pushed before the call has been written out
+	void flush() noexcept
+	{
+		auto target = enqueuePos_.load(std::memory_order_acquire);
+		while (written_.load(std::memory_order_acquire) < target && !stop_.load(std::memory_order_acquire))
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+
+	void setLevel(LogLevel level) noexcept
+	{
+		level_.store(level, std::memory_order_relaxed);
+	}
+
+	[[nodiscard]] uint64_t dropped() const noexcept
+	{
+		return dropped_.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct Slot
+	{
+		std::atomic<size_t> seq{0};
+		LogLevel level{Info};
+		const char* file{nullptr};
+		const char* fun{nullptr};
+		int line{0};
+		uint32_t suppressed{0};
+		size_t length{0};
+		char msg[kMessageSize];
+	};
+
+	Logger()
+	{
+		for (size_t i = 0; i < kQueueSize; ++i)
+			slots_[i].seq.store(i, std::memory_order_relaxed);
+
+		sink_ = std::thread([this] { run(); });
+	}
+
+	bool pop() noexcept
+	{
+		auto& slot = slots_[dequeuePos_ & (kQueueSize - 1)];
+		if (slot.seq.load(std::memory_order_acquire) != dequeuePos_ + 1)
+			return false;
+
+		std::fprintf(stderr, "%s:%d [%s]: %.*s", slot.file, slot.line, slot.fun, static_cast<int>(slot.length), slot.msg);
+		if (slot.suppressed)
+			std::fprintf(stderr, " (%u similar messages suppressed)", slot.suppressed);
+		std::fputc('\n', stderr);
+
+		slot.seq.store(dequeuePos_ + kQueueSize, std::memory_order_release);
+		++dequeuePos_;
+		written_.store(dequeuePos_, std::memory_order_release);
+
+		return true;
+	}
+
+	void run() noexcept
+	{
+		uint64_t reportedDrops = 0;
+		for (;;)
+		{
+			bool any = false;
+			while (pop())
+				any = true;
+
+			auto drops = dropped_.load(std::memory_order_relaxed);
+			if (drops != reportedDrops)
+			{
+				std::fprintf(stderr, "av::Logger: %llu messages dropped, queue full\n", static_cast<unsigned long long>(drops - reportedDrops));
+				reportedDrops = drops;
+			}
+
+			if (any)
+				std::fflush(stderr);
+			else if (stop_.load(std::memory_order_acquire))
+				return;
+			else
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		}
+	}
+
+private:
+	Slot slots_[kQueueSize];
+	alignas(64) std::atomic<size_t> enqueuePos_{0};
+	alignas(64) size_t dequeuePos_{0};
+	std::atomic<size_t> written_{0};
+	std::atomic<uint64_t> dropped_{0};
+	std::atomic<LogLevel> level_{Trace};
+	std::atomic<bool> stop_{false};
+	std::thread sink_;
+};
+
+}// namespace av
@@ -3,6 +3,8 @@
 #include "Encoder.hpp"
 #include "common.hpp"
 
+#include <mutex>
+
 namespace av
 {
 
@@ -76,6 +78,8 @@ public:
 
 		stream->id        = (int) oc_->nb_streams - 1;
 		stream->time_base = codecContext->native()->time_base;
+		if (codecContext->native()->codec_type == AVMEDIA_TYPE_VIDEO)
+			stream->avg_frame_rate = codecContext->native()->framerate;
 
 		/* Some formats want stream headers to be separate. */
 		if (oc_->oformat->flags & AVFMT_GLOBALHEADER)
@@ -108,36 +112,31 @@ public:
 
 	[[nodiscard]] Expected<void> writePacket(Packet& packet, int streamIndex) noexcept
 	{
-		auto expectedStream = getStream(streamIndex);
-
-		if (!expectedStream)
-			FORWARD_AV_ERROR(expectedStream);
+		if (streamIndex < 0 || streamIndex >= (int) streams_.size())
+			RETURN_AV_ERROR("Stream index '{}' is out of range [{}-{}]", streamIndex, 0, streams_.size());
 
-		auto [stream, codecContext] = expectedStream.value();
+		// by reference: no shared_ptr copies on the per-packet path
+		auto& [stream, codecContext] = streams_[streamIndex];
 
 		/* rescale output packet timestamp values from codec to stream timebase */
 		av_packet_rescale_ts(*packet, codecContext->native()->time_base, stream->time_base);
         packet.native()->stream_index = stream->index;
 		packet.native()->pos          = -1;
 
-		auto ret = av_interleaved_write_frame(oc_, *packet);
+		// encoder threads of different streams mux concurrently
+		std::lock_guard lk{muxMutex_};
+		// a single stream has nothing to be interleaved with: av_write_frame() skips the interleaving queue,
+		// which allocates an entry per packet
+		auto ret = streams_.size() == 1 ? av_write_frame(oc_, *packet) : av_interleaved_write_frame(oc_, *packet);
         if (ret < 0)
 			RETURN_AV_ERROR("Error writing output packet: {}", avErrorStr(ret));
 
 		return {};
 	}
 
-private:
-	[[nodiscard]] Expected<std::tuple<AVStream*, Ptr<Encoder>>> getStream(int index)
-	{
-		if (index < 0 || index >= streams_.size())
-			RETURN_AV_ERROR("Stream index '{}' is out of range [{}-{}]", index, 0, streams_.size());
-
-		return streams_[index];
-	}
-
 private:
 	AVFormatContext* oc_{nullptr};
+	std::mutex muxMutex_;
 	std::vector<std::tuple<AVStream*, Ptr<Encoder>>> streams_;
 };
 
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "Packet.hpp"
+#include "common.hpp"
+
+#include <atomic>
+#include <mutex>
+
+namespace av
+{
+
+/*
+ * Packet pool: av::Packet objects are recycled once nobody but the pool references them,
+ * payloads requested through acquire(size) or fill() come from an AVBufferPool of maxPayload bytes.
+ * The demuxers allocate the payloads of the packets they read themselves, so the payloads serve encoders:
+ * see Encoder::setPacketPool().
+ */
+class PacketPool : NoCopyable
+{
+	PacketPool() = default;
+
+public:
+	static Expected<Ptr<PacketPool>> create(size_t capacity, size_t maxPayload = 0) noexcept
+	{
+		Ptr<PacketPool> pool{new PacketPool};
+		pool->maxPayload_ = maxPayload;
+
+		if (maxPayload)
+		{
+			pool->pool_ = av_buffer_pool_init(static_cast<int>(maxPayload + AV_INPUT_BUFFER_PADDING_SIZE), nullptr);
+			if (!pool->pool_)
+				RETURN_AV_ERROR("Failed to create packet buffer pool of {} bytes", maxPayload);
+		}
+
+		pool->packets_.reserve(capacity);
+		for (size_t i = 0; i < capacity; ++i)
+			pool->packets_.emplace_back(makePtr<Packet>());
+
+		return pool;
+	}
+
+	~PacketPool()
+	{
+		if (pool_)
+			av_buffer_pool_uninit(&pool_);
+	}
+
+	// Empty packet, e.g. to be filled by av_read_frame or avcodec_receive_packet
+	[[nodiscard]] Ptr<Packet> acquire() noexcept
+	{
+		auto packet = takeFree();
+		if (packet)
+		{
+			hits_.fetch_add(1, std::memory_order_relaxed);
+			packet->dataUnref();
+			return packet;
+		}
+
+		misses_.fetch_add(1, std::memory_order_relaxed);
+		return makePtr<Packet>();
+	}
+
+	// Packet owning a pooled payload of size bytes
+	[[nodiscard]] Expected<Ptr<Packet>> acquire(size_t size) noexcept
+	{
+		if (!pool_ || size > maxPayload_)
+			RETURN_AV_ERROR("Requested packet payload {} exceeds pool payload {}", size, maxPayload_);
+
+		auto packet = acquire();
+		auto pkt    = packet->native();
+
+		pkt->size = static_cast<int>(size);
+		if (!attachPayload(pkt))
+			RETURN_AV_ERROR("Failed to get packet buffer from pool");
+
+		return packet;
+	}
+
+	// Attaches a pooled payload to a packet whose size is already set, e.g. from AVCodecContext::get_encode_buffer.
+	// Packets larger than maxPayload are not served (counted as a miss), the caller allocates them.
+	bool fill(AVPacket* pkt) noexcept
+	{
+		if (!pool_ || pkt->size < 0 || static_cast<size_t>(pkt->size) > maxPayload_ || !attachPayload(pkt))
+		{
+			misses_.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		hits_.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	[[nodiscard]] PoolStats stats() const noexcept
+	{
+		return {hits_.load(std::memory_order_relaxed), misses_.load(std::memory_order_relaxed)};
+	}
+
+private:
+	Ptr<Packet> takeFree() noexcept
+	{
+		std::lock_guard lk{mutex_};
+		for (size_t n = 0; n < packets_.size(); ++n)
+		{
+			auto& packet = packets_[next_];
+			next_        = (next_ + 1) % packets_.size();
+			// Only the pool still holds it, so nobody can copy a reference to it anymore. The fence pairs
+			// with the release of the last other holder: its writes to the packet happen before our reuse.
+			if (packet.use_count() == 1)
+			{
+				std::atomic_thread_fence(std::memory_order_acquire);
+				return packet;
+			}
+		}
+		return nullptr;
+	}
+
+	bool attachPayload(AVPacket* pkt) noexcept
+	{
+		pkt->buf = av_buffer_pool_get(pool_);
+		if (!pkt->buf)
+			return false;
+
+		pkt->data = pkt->buf->data;
+		std::memset(pkt->data + pkt->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+		return true;
+	}
+
+private:
+	size_t maxPayload_{0};
+	AVBufferPool* pool_{nullptr};
+
+	std::mutex mutex_;
+	std::vector<Ptr<Packet>> packets_;
+	size_t next_{0};
+
+	std::atomic<uint64_t> hits_{0};
+	std::atomic<uint64_t> misses_{0};
+};
+
+}// namespace av
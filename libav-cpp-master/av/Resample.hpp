@@ -1,18 +1,31 @@
 #pragma once
 
 #include "Frame.hpp"
+#include "SampleConvert.hpp"
 #include "common.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
 namespace av
 {
 
 class Resample : NoCopyable
 {
-	explicit Resample(SwrContext* swr) noexcept
-	    : swr_(swr)
+	Resample(SwrContext* swr, int inSampleRate, int outSampleRate) noexcept
+	    : swr_(swr), inSampleRate_(inSampleRate), outSampleRate_(outSampleRate)
 	{}
 
 public:
+	// Capture clock drift, in output samples
+	struct Drift
+	{
+		int64_t samples{0};    // clock minus counted samples at the last update, after compensation
+		int64_t corrected{0};  // samples inserted (>0) or dropped (<0) by the compensation so far
+		double ppm{0};         // estimated rate difference between the clock and the sample clock
+	};
+
 	static Expected<Ptr<Resample>> create(int inChannels, AVSampleFormat inSampleFmt, int inSampleRate,
 	                                      int outChannels, AVSampleFormat outSampleFmt, int outSampleRate) noexcept
 	{
@@ -48,11 +61,26 @@ public:
 			RETURN_AV_ERROR("Could not open resample context: {}", avErrorStr(err));
 		}
 
-		return Ptr<Resample>{new Resample{swr}};
+		Ptr<Resample> resample{new Resample{swr, inSampleRate, outSampleRate}};
+		resample->inFmt_    = inSampleFmt;
+		resample->outFmt_   = outSampleFmt;
+		resample->channels_ = outChannels;
+
+		// same rate and channels: only the sample format changes, convert() bypasses swr
+		if (inSampleRate == outSampleRate && inChannels == outChannels && inChannels <= AV_NUM_DATA_POINTERS &&
+		    simd::isConvertible(inSampleFmt) && simd::isConvertible(outSampleFmt))
+		{
+			resample->fastPath_ = true;
+			LOG_AV_DEBUG("Format only conversion {} -> {}, swr bypassed", av_get_sample_fmt_name(inSampleFmt), av_get_sample_fmt_name(outSampleFmt));
+		}
+
+		return resample;
 	}
 
 	~Resample()
 	{
+		if (pool_)
+			av_buffer_pool_uninit(&pool_);
 		if (swr_)
 			swr_free(&swr_);
 	}
@@ -67,6 +95,9 @@ public:
 
 	Expected<void> convert(const Frame& input, Frame& output) noexcept
 	{
+		if (fastPath_)
+			return convertFormat(input, output);
+
 	    //TODO: remove
 		//LOG_AV_DEBUG("input - channel_layout: {} sample_rate: {} format: {}", (*input)->channel_layout, (*input)->sample_rate, av_get_sample_fmt_name((AVSampleFormat) (*input)->format));
 		//LOG_AV_DEBUG("output - channel_layout: {} sample_rate: {} format: {}", (*output)->channel_layout, (*output)->sample_rate, av_get_sample_fmt_name((AVSampleFormat) (*output)->format));
@@ -90,15 +121,170 @@ public:
 //            RETURN_AV_ERROR("Could not convert input samples: {}", avErrorStr(err));
 
         //SWR_CONVERT_FRAME function
+		auto prepareExp = prepareOutput(input, output);
+		if (!prepareExp)
+			FORWARD_AV_ERROR(prepareExp);
+
         auto err = swr_convert_frame(swr_, *output, *input);
         if (err < 0)
             RETURN_AV_ERROR("Could not convert input samples: {}", avErrorStr(err));
 
+		inSamples_ += input.native()->nb_samples;
+		outSamples_ += output.native()->nb_samples;
+
+		return {};
+	}
+
+	/*
+	 * Steers the output towards an external clock.
+	 * drift is how far the clock is ahead (>0) of the samples produced so far, elapsed how many were produced since
+	 * the clock origin, both in output samples. The smoothed drift is spread over one second of output and the
+	 * correction is capped at kMaxCompensationPpm, so timestamp jitter never turns into audible pitch changes.
+	 */
+	Expected<void> compensate(int64_t drift, int64_t elapsed) noexcept
+	{
+		smoothedDrift_ += (static_cast<double>(drift) - smoothedDrift_) * kDriftSmoothing;
+
+		const auto maxDelta = std::max<int64_t>(1, outSampleRate_ * kMaxCompensationPpm / 1000000);
+		const auto delta    = std::clamp<int64_t>(std::llround(smoothedDrift_), -maxDelta, maxDelta);
+
+		{
+			// read by drift() from other threads
+			std::lock_guard lk{driftMutex_};
+			drift_.samples   = drift;
+			drift_.corrected = outSamples_ - av_rescale(inSamples_, outSampleRate_, inSampleRate_);
+			drift_.ppm       = elapsed > 0 ? (static_cast<double>(drift_.corrected) + smoothedDrift_) * 1e6 / static_cast<double>(elapsed) : 0;
+		}
+
+		// swr has not buffered anything while bypassed, so it takes over seamlessly for good
+		if (fastPath_ && delta)
+		{
+			LOG_AV_DEBUG("Drift compensation needs swr, format only conversion disabled");
+			fastPath_ = false;
+		}
+
+		// a compensation ends after its distance, re-arm it well before
+		if (delta == compensation_ && outSamples_ - compensationStart_ < outSampleRate_ / 2)
+			return {};
+
+		auto err = swr_set_compensation(swr_, static_cast<int>(delta), outSampleRate_);
+		if (err < 0)
+			RETURN_AV_ERROR("Could not set drift compensation of {} samples: {}", delta, avErrorStr(err));
+		compensation_      = delta;
+		compensationStart_ = outSamples_;
+
+		return {};
+	}
+
+	[[nodiscard]] Drift drift() const noexcept
+	{
+		std::lock_guard lk{driftMutex_};
+		return drift_;
+	}
+
+private:
+	// swr_convert_frame rejects an output whose format is not the configured one and fills a reused frame up to its
+	// nb_samples only, so the output gets both: an unreferenced frame has no format, and the compensation returns
+	// more samples than the previous frame had
+	Expected<void> prepareOutput(const Frame& input, Frame& output) noexcept
+	{
+		auto out          = output.native();
+		const auto needed = swr_get_out_samples(swr_, input.native()->nb_samples);
+		if (needed < 0)
+			RETURN_AV_ERROR("Could not get the output size of {} samples: {}", input.native()->nb_samples, avErrorStr(needed));
+
+		const int sampleBytes = av_get_bytes_per_sample(outFmt_) * (av_sample_fmt_is_planar(outFmt_) ? 1 : channels_);
+		auto capacity         = out->buf[0] ? out->linesize[0] / sampleBytes : 0;
+		if (capacity < needed || !av_frame_is_writable(out))
+		{
+			av_frame_unref(out);
+			out->format         = outFmt_;
+			out->channels       = channels_;
+			out->channel_layout = av_get_default_channel_layout(channels_);
+			out->sample_rate    = outSampleRate_;
+			// room for the next compensations too, the buffer is reused from then on
+			out->nb_samples = needed + needed / 8 + 16;
+			auto err        = av_frame_get_buffer(out, 0);
+			if (err < 0)
+				RETURN_AV_ERROR("Could not allocate {} output samples: {}", out->nb_samples, avErrorStr(err));
+			capacity = out->linesize[0] / sampleBytes;
+		}
+		out->nb_samples = capacity;
+
+		return {};
+	}
+
+	// Output planes come from a pool sized for the largest frame seen, the previous frame may still be held by the encoder
+	Expected<void> convertFormat(const Frame& input, Frame& output) noexcept
+	{
+		auto in  = input.native();
+		auto out = output.native();
+		if (in->format != inFmt_ || in->channels != channels_)
+			RETURN_AV_ERROR("Input {} {} channels does not match {} {} channels", av_get_sample_fmt_name((AVSampleFormat)in->format), in->channels,
+			                av_get_sample_fmt_name(inFmt_), channels_);
+
+		int linesize = 0;
+		auto err     = av_samples_get_buffer_size(&linesize, channels_, in->nb_samples, outFmt_, 64);
+		if (err < 0)
+			RETURN_AV_ERROR("Could not compute buffer size for {} samples: {}", in->nb_samples, avErrorStr(err));
+
+		if (!pool_ || poolSize_ < linesize)
+		{
+			if (pool_)
+				av_buffer_pool_uninit(&pool_);
+			pool_ = av_buffer_pool_init(linesize, nullptr);
+			if (!pool_)
+				RETURN_AV_ERROR("Failed to create sample buffer pool of {} bytes", linesize);
+			poolSize_ = linesize;
+		}
+
+		av_frame_unref(out);
+		out->format         = outFmt_;
+		out->channels       = channels_;
+		out->channel_layout = av_get_default_channel_layout(channels_);
+		out->sample_rate    = outSampleRate_;
+		out->nb_samples     = in->nb_samples;
+		out->linesize[0]    = linesize;
+
+		const int planes = av_sample_fmt_is_planar(outFmt_) ? channels_ : 1;
+		for (int p = 0; p < planes; ++p)
+		{
+			out->buf[p] = av_buffer_pool_get(pool_);
+			if (!out->buf[p])
+				RETURN_AV_ERROR("Failed to get sample buffer from pool");
+			out->data[p] = out->buf[p]->data;
+		}
+		out->extended_data = out->data;
+
+		simd::convert(in->extended_data, inFmt_, out->extended_data, outFmt_, in->nb_samples, channels_);
+
+		inSamples_ += in->nb_samples;
+		outSamples_ += out->nb_samples;
+
 		return {};
 	}
 
 private:
+	// Weight of a new drift measurement, about two seconds of 20 ms frames to settle
+	static constexpr double kDriftSmoothing = 0.01;
+	static constexpr int64_t kMaxCompensationPpm = 1000;
+
 	SwrContext* swr_{nullptr};
+	bool fastPath_{false};
+	AVSampleFormat inFmt_{AV_SAMPLE_FMT_NONE};
+	AVSampleFormat outFmt_{AV_SAMPLE_FMT_NONE};
+	int channels_{0};
+	AVBufferPool* pool_{nullptr};
+	int poolSize_{0};
+	int inSampleRate_{0};
+	int outSampleRate_{0};
+	int64_t inSamples_{0};
+	int64_t outSamples_{0};
+	int64_t compensation_{0};
+	int64_t compensationStart_{0};
+	double smoothedDrift_{0};
+	mutable std::mutex driftMutex_;
+	Drift drift_;
 };
 
 }// namespace av
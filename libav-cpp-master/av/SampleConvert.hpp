@@ -0,0 +1,275 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define AV_SAMPLE_CONVERT_SSE2 1
+#endif
+
+namespace av::simd
+{
+
+/*
+ * Sample format conversion without rate or layout change: s16/flt, interleaved/planar, same channel count.
+ * Results are bit exact with libswresample: int to float scales by 1/32768, float to int rounds to nearest
+ * even after scaling by 32768 and saturates.
+ */
+
+inline bool isConvertible(AVSampleFormat fmt) noexcept
+{
+	switch (fmt)
+	{
+		case AV_SAMPLE_FMT_S16:
+		case AV_SAMPLE_FMT_S16P:
+		case AV_SAMPLE_FMT_FLT:
+		case AV_SAMPLE_FMT_FLTP:
+			return true;
+		default:
+			return false;
+	}
+}
+
+namespace internal
+{
+
+inline float toFloat(int16_t v) noexcept
+{
+	return static_cast<float>(v) * (1.0f / 32768.0f);
+}
+
+inline int16_t toS16(float v) noexcept
+{
+	return static_cast<int16_t>(std::lrintf(std::clamp(v * 32768.0f, -32768.0f, 32767.0f)));
+}
+
+template<typename In, typename Out>
+inline Out convertSample(In v) noexcept
+{
+	if constexpr (std::is_same_v<In, Out>)
+		return v;
+	else if constexpr (std::is_same_v<Out, float>)
+		return toFloat(v);
+	else
+		return toS16(v);
+}
+
+// Contiguous run of n samples
+template<typename In, typename Out>
+inline void convertRun(const In* src, Out* dst, size_t n) noexcept
+{
+	size_t i = 0;
+	if constexpr (std::is_same_v<In, Out>)
+	{
+		std::memcpy(dst, src, n * sizeof(In));
+		return;
+	}
+#if AV_SAMPLE_CONVERT_SSE2
+	else if constexpr (std::is_same_v<In, int16_t>)
+	{
+		const auto scale = _mm_set1_ps(1.0f / 32768.0f);
+		for (; i + 8 <= n; i += 8)
+		{
+			auto v  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			auto lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+			auto hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+			_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+			_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+		}
+	}
+	else
+	{
+		const auto scale = _mm_set1_ps(32768.0f);
+		const auto lo    = _mm_set1_ps(-32768.0f);
+		const auto hi    = _mm_set1_ps(32767.0f);
+		for (; i + 8 <= n; i += 8)
+		{
+			auto a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), scale), lo), hi);
+			auto b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale), lo), hi);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+		}
+	}
+#endif
+	for (; i < n; ++i)
+		dst[i] = convertSample<In, Out>(src[i]);
+}
+
+template<typename In, typename Out>
+inline void deinterleave(const In* src, Out* const* dst, size_t n, int channels) noexcept
+{
+	size_t i = 0;
+#if AV_SAMPLE_CONVERT_SSE2
+	if constexpr (std::is_same_v<Out, float>)
+	{
+		if (channels == 2)
+		{
+			float tmp[8];
+			for (; i + 4 <= n; i += 4)
+			{
+				// 4 stereo frames to float, then split even (left) and odd (right) lanes
+				convertRun(src + 2 * i, tmp, 8);
+				auto a = _mm_loadu_ps(tmp);
+				auto b = _mm_loadu_ps(tmp + 4);
+				_mm_storeu_ps(dst[0] + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+				_mm_storeu_ps(dst[1] + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+			}
+		}
+	}
+#endif
+	for (; i < n; ++i)
+		for (int c = 0; c < channels; ++c)
+			dst[c][i] = convertSample<In, Out>(src[i * channels + c]);
+}
+
+template<typename In, typename Out>
+inline void interleave(const In* const* src, Out* dst, size_t n, int channels) noexcept
+{
+	size_t i = 0;
+#if AV_SAMPLE_CONVERT_SSE2
+	if constexpr (std::is_same_v<In, float>)
+	{
+		if (channels == 2)
+		{
+			float tmp[8];
+			for (; i + 4 <= n; i += 4)
+			{
+				auto l = _mm_loadu_ps(src[0] + i);
+				auto r = _mm_loadu_ps(src[1] + i);
+				_mm_storeu_ps(tmp, _mm_unpacklo_ps(l, r));
+				_mm_storeu_ps(tmp + 4, _mm_unpackhi_ps(l, r));
+				convertRun(tmp, dst + 2 * i, 8);
+			}
+		}
+	}
+#endif
+	for (; i < n; ++i)
+		for (int c = 0; c < channels; ++c)
+			dst[i * channels + c] = convertSample<In, Out>(src[c][i]);
+}
+
+template<typename In, typename Out>
+inline void convertTyped(const uint8_t* const* in, bool inPlanar, uint8_t* const* out, bool outPlanar, size_t n, int channels) noexcept
+{
+	const In* src[AV_NUM_DATA_POINTERS];
+	Out* dst[AV_NUM_DATA_POINTERS];
+	for (int c = 0; c < channels; ++c)
+	{
+		src[c] = reinterpret_cast<const In*>(inPlanar ? in[c] : in[0]);
+		dst[c] = reinterpret_cast<Out*>(outPlanar ? out[c] : out[0]);
+	}
+
+	if (inPlanar == outPlanar)
+	{
+		const int planes = inPlanar ? channels : 1;
+		const auto count = inPlanar ? n : n * channels;
+		for (int p = 0; p < planes; ++p)
+			convertRun(src[p], dst[p], count);
+	}
+	else if (outPlanar)
+		deinterleave(src[0], dst, n, channels);
+	else
+		interleave(src, dst[0], n, channels);
+}
+
+}// namespace internal
+
+// in/out are plane pointers as in AVFrame::extended_data, channels must not exceed AV_NUM_DATA_POINTERS
+inline void convert(const uint8_t* const* in, AVSampleFormat inFmt, uint8_t* const* out, AVSampleFormat outFmt, int nbSamples, int channels) noexcept
+{
+	const bool inPlanar  = av_sample_fmt_is_planar(inFmt);
+	const bool outPlanar = av_sample_fmt_is_planar(outFmt);
+	const bool inFloat   = av_get_packed_sample_fmt(inFmt) == AV_SAMPLE_FMT_FLT;
+	const bool outFloat  = av_get_packed_sample_fmt(outFmt) == AV_SAMPLE_FMT_FLT;
+	const auto n         = static_cast<size_t>(nbSamples);
+
+	if (inFloat && outFloat)
+		internal::convertTyped<float, float>(in, inPlanar, out, outPlanar, n, channels);
+	else if (inFloat)
+		internal::convertTyped<float, int16_t>(in, inPlanar, out, outPlanar, n, channels);
+	else if (outFloat)
+		internal::convertTyped<int16_t, float>(in, inPlanar, out, outPlanar, n, channels);
+	else
+		internal::convertTyped<int16_t, int16_t>(in, inPlanar, out, outPlanar, n, channels);
+}
+
+/*
+ * Float sample kernels of the mixer and the silence detector.
+ */
+
+// dst[i] += src[i] * gain
+inline void mixAdd(float* dst, const float* src, size_t n, float gain) noexcept
+{
+	size_t i = 0;
+#if AV_SAMPLE_CONVERT_SSE2
+	const auto g = _mm_set1_ps(gain);
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+#endif
+	for (; i < n; ++i)
+		dst[i] += src[i] * gain;
+}
+
+// Largest absolute sample
+inline float peak(const float* src, size_t n) noexcept
+{
+	size_t i = 0;
+	float res = 0;
+#if AV_SAMPLE_CONVERT_SSE2
+	const auto absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	auto m             = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4)
+		m = _mm_max_ps(m, _mm_and_ps(_mm_loadu_ps(src + i), absMask));
+	float lanes[4];
+	_mm_storeu_ps(lanes, m);
+	res = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+	for (; i < n; ++i)
+		res = std::max(res, std::fabs(src[i]));
+	return res;
+}
+
+// Gain ramping linearly from `from` to `to` over n samples, clipped to [-1, 1]
+inline void applyGain(float* dst, size_t n, float from, float to) noexcept
+{
+	const float step = n ? (to - from) / static_cast<float>(n) : 0.0f;
+	size_t i         = 0;
+#if AV_SAMPLE_CONVERT_SSE2
+	const auto lo    = _mm_set1_ps(-1.0f);
+	const auto hi    = _mm_set1_ps(1.0f);
+	const auto step4 = _mm_set1_ps(step * 4);
+	auto g           = _mm_setr_ps(from, from + step, from + 2 * step, from + 3 * step);
+	for (; i + 4 <= n; i += 4)
+	{
+		_mm_storeu_ps(dst + i, _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(dst + i), g), lo), hi));
+		g = _mm_add_ps(g, step4);
+	}
+#endif
+	for (; i < n; ++i)
+		dst[i] = std::clamp(dst[i] * (from + step * static_cast<float>(i)), -1.0f, 1.0f);
+}
+
+// Sum of the squared samples, for energy measurements
+inline double sumSquares(const float* src, size_t n) noexcept
+{
+	size_t i   = 0;
+	double res = 0;
+#if AV_SAMPLE_CONVERT_SSE2
+	auto acc = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4)
+	{
+		auto v = _mm_loadu_ps(src + i);
+		acc    = _mm_add_ps(acc, _mm_mul_ps(v, v));
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, acc);
+	res = static_cast<double>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+#endif
+	for (; i < n; ++i)
+		res += static_cast<double>(src[i]) * src[i];
+	return res;
+}
+
+}// namespace av::simd
@@ -13,11 +13,12 @@ class Scale : NoCopyable
 	{}
 
 public:
-	static Expected<Ptr<Scale>> create(int inputWidth, int inputHeight, AVPixelFormat inputPixFmt, int outputWidth, int outputHeight, AVPixelFormat outputPixFmt) noexcept
+	static Expected<Ptr<Scale>> create(int inputWidth, int inputHeight, AVPixelFormat inputPixFmt, int outputWidth, int outputHeight, AVPixelFormat outputPixFmt,
+	                                   int flags = SWS_BICUBIC) noexcept
 	{
 		auto sws = sws_getContext(inputWidth, inputHeight, inputPixFmt,
 		                          outputWidth, outputHeight, outputPixFmt,
-		                          SWS_BICUBIC, nullptr, nullptr, nullptr);
+		                          flags, nullptr, nullptr, nullptr);
 
 		if (!sws)
 			RETURN_AV_ERROR("Failed to create sws context");
@@ -43,6 +44,47 @@ public:
 		sws_scale(sws_, src.native()->data, src.native()->linesize, 0, src.native()->height, dst.native()->data, dst.native()->linesize);
 	}
 
+	// Converts the height rows high rectangle at (srcX, srcY) of src to (dstX, dstY) of dst, with a context created
+	// for the size of the rectangle. The offsets have to be multiples of the chroma subsampling of their format.
+	void scale(const Frame& src, int srcX, int srcY, int height, Frame& dst, int dstX, int dstY)
+	{
+		uint8_t* srcPlanes[AV_NUM_DATA_POINTERS]{};
+		uint8_t* dstPlanes[AV_NUM_DATA_POINTERS]{};
+		planesAt(src.native(), srcX, srcY, srcPlanes);
+		planesAt(dst.native(), dstX, dstY, dstPlanes);
+		sws_scale(sws_, srcPlanes, src.native()->linesize, 0, height, dstPlanes, dst.native()->linesize);
+	}
+
+	// Copies the width x height rectangle at (srcX, srcY) of src to (dstX, dstY) of dst, frames of the same format
+	static void copy(const Frame& src, int srcX, int srcY, Frame& dst, int dstX, int dstY, int width, int height)
+	{
+		uint8_t* srcPlanes[AV_NUM_DATA_POINTERS]{};
+		uint8_t* dstPlanes[AV_NUM_DATA_POINTERS]{};
+		planesAt(src.native(), srcX, srcY, srcPlanes);
+		planesAt(dst.native(), dstX, dstY, dstPlanes);
+
+		const auto fmt  = static_cast<AVPixelFormat>(dst.native()->format);
+		const auto desc = av_pix_fmt_desc_get(fmt);
+		for (int p = 0; p < av_pix_fmt_count_planes(fmt); ++p)
+		{
+			const int shiftY = p == 1 || p == 2 ? desc->log2_chroma_h : 0;
+			av_image_copy_plane(dstPlanes[p], dst.native()->linesize[p], srcPlanes[p], src.native()->linesize[p],
+			                    av_image_get_linesize(fmt, width, p), AV_CEIL_RSHIFT(height, shiftY));
+		}
+	}
+
+private:
+	static void planesAt(const AVFrame* f, int x, int y, uint8_t* planes[]) noexcept
+	{
+		const auto fmt  = static_cast<AVPixelFormat>(f->format);
+		const auto desc = av_pix_fmt_desc_get(fmt);
+		for (int p = 0; p < av_pix_fmt_count_planes(fmt); ++p)
+		{
+			const int shiftY = p == 1 || p == 2 ? desc->log2_chroma_h : 0;
+			planes[p]        = f->data[p] + static_cast<ptrdiff_t>(y >> shiftY) * f->linesize[p] + av_image_get_linesize(fmt, x, p);
+		}
+	}
+
 private:
 	SwsContext* sws_{nullptr};
 };
@@ -1,13 +1,24 @@
 #pragma once
 
+#include "ChangeMap.hpp"
 #include "Encoder.hpp"
 #include "Frame.hpp"
+#include "FramePool.hpp"
 #include "OptSetter.hpp"
 #include "OutputFormat.hpp"
 #include "Resample.hpp"
+#include "SampleConvert.hpp"
 #include "Scale.hpp"
 #include "common.hpp"
 
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
 namespace av
 {
 class StreamWriter : NoCopyable
@@ -15,10 +26,41 @@ class StreamWriter : NoCopyable
 	StreamWriter() = default;
 
 public:
-	[[nodiscard]] static Expected<Ptr<StreamWriter>> create(std::string_view filename) noexcept
+	// Frames an encoder thread queues before write() blocks
+	static constexpr size_t kQueueFrames = 32;
+
+	struct SilenceStats
+	{
+		uint64_t samples{0};       // audio samples written
+		uint64_t quietSamples{0};  // samples under the silence threshold
+		uint64_t skippedSamples{0};// quiet samples written as the cached silent packet instead of being encoded
+
+		double fraction() const noexcept
+		{
+			return samples ? static_cast<double>(quietSamples) / static_cast<double>(samples) : 0;
+		}
+	};
+
+	struct TileStats
+	{
+		uint64_t frames{0};        // video frames compared
+		uint64_t tiles{0};         // tiles of those frames
+		uint64_t convertedTiles{0};// tiles converted, whole frames count all of theirs
+
+		// share of the tiles whose previous conversion was kept
+		double hitRate() const noexcept
+		{
+			return tiles ? 1.0 - static_cast<double>(convertedTiles) / static_cast<double>(tiles) : 0;
+		}
+	};
+
+	// variableFrameRate: video is encoded on a fine clock (kVideoClock) instead of one tick per frame, so frames
+	// written with their capture timestamps keep them even when some are dropped or delayed
+	[[nodiscard]] static Expected<Ptr<StreamWriter>> create(std::string_view filename, bool variableFrameRate = false) noexcept
 	{
 		Ptr<StreamWriter> sw{new StreamWriter};
-		sw->filename_ = filename;
+		sw->filename_          = filename;
+		sw->variableFrameRate_ = variableFrameRate;
 
 		auto fcExp = OutputFormat::create(filename);
 		if (!fcExp)
@@ -39,7 +81,8 @@ public:
 		return formatContext_->open(filename_);
 	}
 
-	[[nodiscard]] Expected<int> addVideoStream(std::variant<AVCodecID, std::string_view> codecName, int inWidth, int inHeight, AVPixelFormat inPixFmt, AVRational frameRate, int outWidth, int outHeight, OptValueMap&& codecParams = {}) noexcept
+	[[nodiscard]] Expected<int> addVideoStream(std::variant<AVCodecID, std::string_view> codecName, int inWidth, int inHeight, AVPixelFormat inPixFmt, AVRational frameRate, int outWidth, int outHeight, OptValueMap&& codecParams = {},
+	                                           const EncoderThreading& threading = {}) noexcept
 	{
 		auto stream  = makePtr<Stream>();
 		stream->type = AVMEDIA_TYPE_VIDEO;
@@ -52,6 +95,15 @@ public:
 		Ptr<Encoder> c = expc.value();
 
 		c->setVideoParams(outWidth, outHeight, frameRate, std::move(codecParams));
+		c->setThreading(threading);
+		if (variableFrameRate_)
+			c->native()->time_base = kVideoClock;
+
+		auto packetPoolExp = PacketPool::create(0, av_image_get_buffer_size(c->native()->pix_fmt, outWidth, outHeight, 1) / kPacketPoolShare);
+		if (!packetPoolExp)
+			FORWARD_AV_ERROR(packetPoolExp);
+		c->setPacketPool(packetPoolExp.value());
+
 		auto cOpenEXp = c->open();
 		if (!cOpenEXp)
 			FORWARD_AV_ERROR(cOpenEXp);
@@ -60,8 +112,15 @@ public:
 		if (!frameExp)
 			FORWARD_AV_ERROR(frameExp);
 
-		stream->frame   = frameExp.value();
-		stream->encoder = c;
+		// planes for the conversions while the previous frame is still held, enableFrameArena() carves them from an arena
+		auto framePoolExp = FramePool::create(outWidth, outHeight, c->native()->pix_fmt, 0, nullptr, kFrameAlign);
+		if (!framePoolExp)
+			FORWARD_AV_ERROR(framePoolExp);
+
+		stream->frame     = frameExp.value();
+		stream->framePool = framePoolExp.value();
+		stream->encoder   = c;
+		stream->packets.resize(kPacketsReserve);
 
 		auto swsExp = Scale::create(inWidth, inHeight, inPixFmt, outWidth, outHeight, c->native()->pix_fmt);
 		if (!swsExp)
@@ -73,8 +132,9 @@ public:
 		if (!sIndExp)
 			FORWARD_AV_ERROR(sIndExp);
 
-		stream->index = sIndExp.value();
-		int index     = stream->index;
+		stream->index  = sIndExp.value();
+		stream->output = formatContext_;
+		int index      = stream->index;
 
 		streams_.emplace_back(std::move(stream));
 
@@ -82,18 +142,21 @@ public:
 			RETURN_AV_ERROR("Stream index {} != streams count - 1 {}", index, streams_.size() - 1);
 
 		const AVCodec* codec = c->native()->codec;
-		LOG_AV_INFO("Added video stream #{} codec: {} {}x{} {} fps", index, codec->long_name, c->native()->width, c->native()->height, av_q2d(av_inv_q(c->native()->time_base)));
+		LOG_AV_INFO("Added video stream #{} codec: {} {}x{} {} fps{} threads: {} type: {}", index, codec->long_name, c->native()->width, c->native()->height,
+		            av_q2d(c->native()->framerate), variableFrameRate_ ? " (variable)" : "", c->native()->thread_count, c->native()->active_thread_type);
 
 		return index;
 	}
 
-	[[nodiscard]] Expected<int> addVideoStream(std::variant<AVCodecID, std::string_view> codecName, int inWidth, int inHeight, AVPixelFormat inPixFmt, AVRational frameRate, OptValueMap&& codecParams = {})
+	[[nodiscard]] Expected<int> addVideoStream(std::variant<AVCodecID, std::string_view> codecName, int inWidth, int inHeight, AVPixelFormat inPixFmt, AVRational frameRate, OptValueMap&& codecParams = {},
+	                                           const EncoderThreading& threading = {})
 	{
-		return addVideoStream(codecName, inWidth, inHeight, inPixFmt, frameRate, inWidth, inHeight, std::move(codecParams));
+		return addVideoStream(codecName, inWidth, inHeight, inPixFmt, frameRate, inWidth, inHeight, std::move(codecParams), threading);
 	}
 
 	[[nodiscard]] Expected<int> addAudioStream(std::variant<AVCodecID, std::string_view> codecName, int inChannels, AVSampleFormat inSampleFmt, int inSampleRate,
-	                                           int outChannels, int outSampleRate, int outBitRate, OptValueMap&& codecParams = {}) noexcept
+	                                           int outChannels, int outSampleRate, int outBitRate, OptValueMap&& codecParams = {},
+	                                           const EncoderThreading& threading = {}) noexcept
 	{
 		auto stream  = makePtr<Stream>();
 		stream->type = AVMEDIA_TYPE_AUDIO;
@@ -113,6 +176,7 @@ public:
 			c = makePtr<Encoder>(std::get<std::string_view>(codecName));
 #endif
 		c->setAudioParams(outChannels, outSampleRate, outBitRate, std::move(codecParams));
+		c->setThreading(threading);
 		auto cOpenExp = c->open();
 		if (!cOpenExp)
 			FORWARD_AV_ERROR(cOpenExp);
@@ -123,6 +187,7 @@ public:
 
 		stream->frame   = frameExp.value();
 		stream->encoder = c;
+		stream->packets.resize(kPacketsReserve);
 
 		auto swrExp = Resample::create(inChannels, inSampleFmt, inSampleRate, outChannels, c->native()->sample_fmt, outSampleRate);
 		if (!swrExp)
@@ -130,12 +195,32 @@ public:
 
 		stream->swr = swrExp.value();
 
+		// fixed frame size codecs (AAC) get exactly frame_size samples, whatever the capture period
+		const auto encCtx = c->native();
+		if (encCtx->frame_size > 0 && !(encCtx->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE))
+		{
+			stream->fifo = av_audio_fifo_alloc(encCtx->sample_fmt, encCtx->channels, 2 * encCtx->frame_size);
+			if (!stream->fifo)
+				RETURN_AV_ERROR("Failed to allocate audio fifo");
+
+			auto chunk            = stream->chunk.native();
+			chunk->format         = encCtx->sample_fmt;
+			chunk->channel_layout = encCtx->channel_layout;
+			chunk->channels       = encCtx->channels;
+			chunk->sample_rate    = encCtx->sample_rate;
+			chunk->nb_samples     = encCtx->frame_size;
+			auto err              = av_frame_get_buffer(chunk, 0);
+			if (err < 0)
+				RETURN_AV_ERROR("Could not allocate audio frame of {} samples: {}", encCtx->frame_size, avErrorStr(err));
+		}
+
 		auto sIndExp = formatContext_->addStream(c);
 		if (!sIndExp)
 			FORWARD_AV_ERROR(sIndExp);
 
-		stream->index = sIndExp.value();
-		int index     = stream->index;
+		stream->index  = sIndExp.value();
+		stream->output = formatContext_;
+		int index      = stream->index;
 
 		streams_.emplace_back(std::move(stream));
 
@@ -148,40 +233,326 @@ public:
 		return index;
 	}
 
+	// Timestamps are generated: one tick per video frame, the sample count for audio
 	[[nodiscard]] Expected<void> write(Frame& frame, int streamIndex) noexcept
 	{
 		auto& stream = streams_[streamIndex];
+		if (stream->worker.joinable())
+			return enqueue(*stream, frame, {}, false);
 
-		if (stream->type == AVMEDIA_TYPE_VIDEO)
-		{
-			stream->sws->scale(frame, *stream->frame);
-			stream->frame->native()->pts = stream->nextPts++;
-		}
-		else if (stream->type == AVMEDIA_TYPE_AUDIO)
-		{
-            frame.native()->channel_layout = av_get_default_channel_layout(frame.native()->channels);
-			stream->swr->convert(frame, *stream->frame);
-            stream->frame->native()->pts = stream->nextPts;
-			stream->nextPts += stream->frame->native()->nb_samples;
-        }
-		else
-			RETURN_AV_ERROR("Unsupported/unknown stream type: {}", av_get_media_type_string(stream->type));
+		return writeGenerated(*stream, frame);
+	}
 
-		auto [res, sz] = stream->encoder->encodeFrame(*stream->frame, stream->packets);
+	// Timestamps are taken from frame.pts, expressed in timeBase.
+	// Video frames are rescaled to the encoder time base, a frame that does not advance it is dropped.
+	// Audio stays sample contiguous and only follows the timestamps across gaps larger than kMaxAudioGap.
+	[[nodiscard]] Expected<void> write(Frame& frame, int streamIndex, AVRational timeBase) noexcept
+	{
+		auto& stream = streams_[streamIndex];
+		if (stream->worker.joinable())
+			return enqueue(*stream, frame, timeBase, false);
 
-		if (res == Result::kFail)
-			RETURN_AV_ERROR("Encoder returned failure");
+		return writeTimestamped(*stream, frame, timeBase);
+	}
 
-		for (int i = 0; i < sz; ++i)
-		{
-			auto expected = formatContext_->writePacket(stream->packets[i], stream->index);
-			if (!expected)
-				LOG_AV_ERROR(expected.errorString());
-		}
+	// Same as above for a frame the caller is done with, e.g. a capture: an encoder thread takes its references
+	// over instead of adding its own, which libavutil allocates. The frame is left empty then.
+	[[nodiscard]] Expected<void> write(Frame&& frame, int streamIndex, AVRational timeBase) noexcept
+	{
+		auto& stream = streams_[streamIndex];
+		if (stream->worker.joinable())
+			return enqueue(*stream, frame, timeBase, true);
+
+		return writeTimestamped(*stream, frame, timeBase);
+	}
+
+	/*
+	 * Encodes the video of stream sourceIndex once more at width x height, in a new stream of this writer.
+	 * The rendition takes the frames the source stream has already converted for its encoder, so a ladder is
+	 * cascaded by adding each rendition from the one above it: every step scales the previous one's YUV instead of
+	 * the capture. Each rendition is converted and encoded on a thread of its own. Call before the first write.
+	 */
+	[[nodiscard]] Expected<int> addRendition(int sourceIndex, std::variant<AVCodecID, std::string_view> codecName, int width, int height,
+	                                         OptValueMap&& codecParams = {}, const EncoderThreading& threading = {}) noexcept
+	{
+		return addRendition(sourceIndex, nullptr, codecName, width, height, std::move(codecParams), threading);
+	}
+
+	// Same as above with the rendition added to target, a writer with an output of its own, which is kept alive by
+	// this one. The target has to be opened and is flushed by its owner, after this writer.
+	[[nodiscard]] Expected<int> addRendition(int sourceIndex, Ptr<StreamWriter> target, std::variant<AVCodecID, std::string_view> codecName, int width, int height,
+	                                         OptValueMap&& codecParams = {}, const EncoderThreading& threading = {}) noexcept
+	{
+		if (sourceIndex < 0 || sourceIndex >= (int) streams_.size())
+			RETURN_AV_ERROR("Stream index '{}' is out of range [{}-{}]", sourceIndex, 0, streams_.size());
+
+		auto& source = *streams_[sourceIndex];
+		if (source.type != AVMEDIA_TYPE_VIDEO)
+			RETURN_AV_ERROR("Renditions need a video source, stream #{} is {}", sourceIndex, av_get_media_type_string(source.type));
+
+		auto& writer      = target ? *target : *this;
+		const auto srcCtx = source.encoder->native();
+		auto indexExp     = writer.addVideoStream(codecName, srcCtx->width, srcCtx->height, srcCtx->pix_fmt, av_inv_q(srcCtx->framerate), width, height,
+		                                          std::move(codecParams), threading);
+		if (!indexExp)
+			FORWARD_AV_ERROR(indexExp);
+
+		auto threadExp = writer.startEncoderThread(indexExp.value());
+		if (!threadExp)
+			FORWARD_AV_ERROR(threadExp);
+
+		source.renditions.push_back({&writer, std::move(target), indexExp.value()});
+
+		LOG_AV_INFO("Stream #{} {}x{} feeds a {}x{} rendition{}, stream #{}", sourceIndex, srcCtx->width, srcCtx->height, width, height,
+		            &writer == this ? "" : " in another output", indexExp.value());
+
+		return indexExp.value();
+	}
+
+	/*
+	 * Moves the conversion and encoding of a stream to its own thread, write() then only queues a reference to the
+	 * frame, or the frame itself when it is passed as an rvalue, and blocks only when queueFrames are already waiting.
+	 * Streams on separate threads encode in parallel and only serialize in the muxer. coreMask confines the thread,
+	 * which also converts the frames, 0 for any core.
+	 */
+	[[nodiscard]] Expected<void> startEncoderThread(int streamIndex, size_t queueFrames = kQueueFrames, uint64_t coreMask = 0) noexcept
+	{
+		if (streamIndex < 0 || streamIndex >= (int) streams_.size())
+			RETURN_AV_ERROR("Stream index '{}' is out of range [{}-{}]", streamIndex, 0, streams_.size());
+
+		auto& stream = *streams_[streamIndex];
+		if (stream.worker.joinable())
+			return {};
+
+		stream.queue.resize(queueFrames);
+		for (auto& entry : stream.queue)
+			entry.frame = makePtr<Frame>();
+		stream.worker = std::thread([this, &stream, coreMask] {
+			if (!setThreadAffinity(coreMask))
+				LOG_AV_ERROR("Could not pin the encoder thread of stream #{} to core mask {}", stream.index, coreMask);
+			encodeLoop(stream);
+		});
+
+		return {};
+	}
+
+	/*
+	 * Lets an audio stream skip the encoder over long quiet spans.
+	 * Every encoder frame is measured, once frames have stayed under thresholdDb (RMS, dBFS) for longer than hangover
+	 * the encoder is fed true silence until it produced one steady state silent packet, and from then on that packet
+	 * is muxed in place of encoding until the level rises again. The first loud frame goes to the encoder as usual,
+	 * the packets it still owes for the skipped span are dropped, so speech onsets are encoded untouched.
+	 * Needs a fixed frame size float encoder (AAC), call before the first write.
+	 */
+	[[nodiscard]] Expected<void> enableSilenceSkipping(int streamIndex, double thresholdDb = -60, AVRational hangover = {1, 2}) noexcept
+	{
+		if (streamIndex < 0 || streamIndex >= (int) streams_.size())
+			RETURN_AV_ERROR("Stream index '{}' is out of range [{}-{}]", streamIndex, 0, streams_.size());
+
+		auto& stream      = *streams_[streamIndex];
+		const auto encCtx = stream.encoder->native();
+		const auto fmt    = av_get_packed_sample_fmt(encCtx->sample_fmt);
+		if (stream.type != AVMEDIA_TYPE_AUDIO || !stream.fifo || fmt != AV_SAMPLE_FMT_FLT)
+			RETURN_AV_ERROR("Silence skipping needs a fixed frame size float audio encoder, stream #{} has {}", streamIndex,
+			                av_get_sample_fmt_name(encCtx->sample_fmt));
+
+		stream.silence            = std::make_unique<Silence>();
+		stream.silence->threshold = std::pow(10.0, thresholdDb / 10);
+		stream.silence->hangover  = av_rescale_q(1, hangover, {1, encCtx->sample_rate});
+
+		LOG_AV_INFO("Silence skipping on stream #{} under {} dBFS after {} samples", streamIndex, thresholdDb, stream.silence->hangover);
 
 		return {};
 	}
 
+	/*
+	 * Lets a video stream tell the encoder where the picture changed.
+	 * Every converted frame is compared with the previous one in tiles of tileSize, the changed tiles are attached
+	 * as regions of interest with qoffset (negative: finer quantization), so the encoder spends its bits where the
+	 * screen moved. x264 honours them with adaptive quantization on, as in its presets. Call before the first write.
+	 */
+	[[nodiscard]] Expected<void> enableChangeRegions(int streamIndex, int tileSize = 16, AVRational qoffset = {-1, 5}) noexcept
+	{
+		if (streamIndex < 0 || streamIndex >= (int) streams_.size())
+			RETURN_AV_ERROR("Stream index '{}' is out of range [{}-{}]", streamIndex, 0, streams_.size());
+
+		auto& stream = *streams_[streamIndex];
+		if (stream.type != AVMEDIA_TYPE_VIDEO)
+			RETURN_AV_ERROR("Change regions need a video stream, stream #{} is {}", streamIndex, av_get_media_type_string(stream.type));
+
+		const auto encCtx = stream.encoder->native();
+		auto mapExp       = ChangeMap::create(encCtx->width, encCtx->height, encCtx->pix_fmt, tileSize);
+		if (!mapExp)
+			FORWARD_AV_ERROR(mapExp);
+
+		stream.changes    = mapExp.value();
+		stream.roiQOffset = qoffset;
+
+		LOG_AV_INFO("Change regions on stream #{} in tiles of {} with qoffset {}/{}", streamIndex, tileSize, qoffset.num, qoffset.den);
+
+		return {};
+	}
+
+	/*
+	 * Lets a video stream convert only the parts of the capture that changed.
+	 * Every captured frame is compared with the previous one in tiles of tileSize and only the changed tiles are
+	 * converted into the frame kept for the encoder, the others keep their previous conversion. A tile is converted
+	 * with a margin for the chroma filters, the result is the one of the whole frame conversion. When most of the
+	 * picture changed the whole frame is converted at once. Needs an unscaled stream, otherwise every frame is
+	 * converted whole. Call before the first write.
+	 */
+	[[nodiscard]] Expected<void> enableTileConversion(int streamIndex, int tileSize = 64) noexcept
+	{
+		if (streamIndex < 0 || streamIndex >= (int) streams_.size())
+			RETURN_AV_ERROR("Stream index '{}' is out of range [{}-{}]", streamIndex, 0, streams_.size());
+
+		auto& stream = *streams_[streamIndex];
+		if (stream.type != AVMEDIA_TYPE_VIDEO)
+			RETURN_AV_ERROR("Tile conversion needs a video stream, stream #{} is {}", streamIndex, av_get_media_type_string(stream.type));
+
+		const auto desc = av_pix_fmt_desc_get(stream.encoder->native()->pix_fmt);
+		if (tileSize <= 0 || tileSize % (1 << std::max(desc->log2_chroma_w, desc->log2_chroma_h)))
+			RETURN_AV_ERROR("Tiles of {} do not fit the {} chroma subsampling", tileSize, desc->name);
+
+		stream.tiles           = std::make_unique<Tiles>();
+		stream.tiles->tileSize = tileSize;
+
+		LOG_AV_INFO("Tile conversion on stream #{} in tiles of {}", streamIndex, tileSize);
+
+		return {};
+	}
+
+	/*
+	 * Keeps a width x height pixFmt copy of the video of stream streamIndex, made at most once per interval from the
+	 * frames converted for the encoder, for live monitoring. The encoder never waits for the readers of preview(),
+	 * which share the last copy and are handed a new one once it is made. Call before the first write.
+	 */
+	[[nodiscard]] Expected<void> enablePreview(int streamIndex, int width, int height, AVRational interval = {1, 5},
+	                                           AVPixelFormat pixFmt = AV_PIX_FMT_RGB24) noexcept
+	{
+		if (streamIndex < 0 || streamIndex >= (int) streams_.size())
+			RETURN_AV_ERROR("Stream index '{}' is out of range [{}-{}]", streamIndex, 0, streams_.size());
+
+		auto& stream = *streams_[streamIndex];
+		if (stream.type != AVMEDIA_TYPE_VIDEO)
+			RETURN_AV_ERROR("Previews need a video stream, stream #{} is {}", streamIndex, av_get_media_type_string(stream.type));
+
+		const auto encCtx = stream.encoder->native();
+		auto swsExp       = Scale::create(encCtx->width, encCtx->height, encCtx->pix_fmt, width, height, pixFmt, SWS_AREA);
+		if (!swsExp)
+			FORWARD_AV_ERROR(swsExp);
+
+		stream.preview           = std::make_unique<Preview>();
+		stream.preview->sws      = swsExp.value();
+		stream.preview->width    = width;
+		stream.preview->height   = height;
+		stream.preview->pixFmt   = pixFmt;
+		stream.preview->interval = std::max<int64_t>(av_rescale_q(1, interval, encCtx->time_base), 1);
+
+		LOG_AV_INFO("Preview of stream #{} at {}x{} {} every {} s", streamIndex, width, height, av_get_pix_fmt_name(pixFmt), av_q2d(interval));
+
+		return {};
+	}
+
+	/*
+	 * Calls callback with every frame converted for the encoder of a video stream, on the thread converting it, so
+	 * it has to return quickly. A reference taken to the frame (an av::Frame copy) stays intact, the next conversion
+	 * then goes to new planes. Call before the first write.
+	 */
+	[[nodiscard]] Expected<void> setFrameCallback(int streamIndex, std::function<void(const Frame&)> callback) noexcept
+	{
+		if (streamIndex < 0 || streamIndex >= (int) streams_.size())
+			RETURN_AV_ERROR("Stream index '{}' is out of range [{}-{}]", streamIndex, 0, streams_.size());
+
+		auto& stream = *streams_[streamIndex];
+		if (stream.type != AVMEDIA_TYPE_VIDEO)
+			RETURN_AV_ERROR("Frame callbacks need a video stream, stream #{} is {}", streamIndex, av_get_media_type_string(stream.type));
+
+		stream.onConverted = std::move(callback);
+
+		return {};
+	}
+
+	/*
+	 * Carves the frames a video stream converts for the encoder from an arena sized for frames of them: the planes
+	 * sws_scale writes and the encoder reads, taken again whenever a rendition or a callback still holds the previous
+	 * ones. Returns the arena for its statistics and locking. Call before the first write.
+	 */
+	[[nodiscard]] Expected<Ptr<FrameArena>> enableFrameArena(int streamIndex, size_t frames) noexcept
+	{
+		if (streamIndex < 0 || streamIndex >= (int) streams_.size())
+			RETURN_AV_ERROR("Stream index '{}' is out of range [{}-{}]", streamIndex, 0, streams_.size());
+
+		auto& stream = *streams_[streamIndex];
+		if (stream.type != AVMEDIA_TYPE_VIDEO)
+			RETURN_AV_ERROR("Frame arenas need a video stream, stream #{} is {}", streamIndex, av_get_media_type_string(stream.type));
+
+		const auto encCtx = stream.encoder->native();
+		const auto size   = av_image_get_buffer_size(encCtx->pix_fmt, FFALIGN(encCtx->width, kFrameAlign), encCtx->height, kFrameAlign);
+		if (size < 0)
+			RETURN_AV_ERROR("Failed to get buffer size: {}", avErrorStr(size));
+
+		auto arenaExp = FrameArena::create(frames * (static_cast<size_t>(size) + kFramePadding));
+		if (!arenaExp)
+			FORWARD_AV_ERROR(arenaExp);
+
+		auto poolExp = FramePool::create(encCtx->width, encCtx->height, encCtx->pix_fmt, 0, arenaExp.value(), kFrameAlign);
+		if (!poolExp)
+			FORWARD_AV_ERROR(poolExp);
+
+		// the planes allocated with the encoder go, nothing was converted into them yet
+		auto f = stream.frame->native();
+		av_frame_unref(f);
+		f->format = encCtx->pix_fmt;
+		f->width  = encCtx->width;
+		f->height = encCtx->height;
+		if (!poolExp.value()->fill(f))
+			RETURN_AV_ERROR("Failed to get {}x{} {} planes from the frame arena", f->width, f->height, av_get_pix_fmt_name(encCtx->pix_fmt));
+
+		stream.framePool = poolExp.value();
+
+		LOG_AV_INFO("Frame arena of {} MB for {} converted frames on stream #{}", arenaExp.value()->stats().capacity >> 20, frames, streamIndex);
+
+		return arenaExp.value();
+	}
+
+	// Last preview of a stream, pts in AV_TIME_BASE, null until the first one is made
+	[[nodiscard]] Ptr<const Frame> preview(int streamIndex) const noexcept
+	{
+		if (streamIndex < 0 || streamIndex >= (int) streams_.size() || !streams_[streamIndex]->preview)
+			return {};
+
+		return streams_[streamIndex]->preview->latest.load();
+	}
+
+	[[nodiscard]] TileStats tileStats(int streamIndex) const noexcept
+	{
+		if (streamIndex < 0 || streamIndex >= (int) streams_.size() || !streams_[streamIndex]->tiles)
+			return {};
+
+		auto& tiles = *streams_[streamIndex]->tiles;
+		return {tiles.frames.load(std::memory_order_relaxed), tiles.tiles.load(std::memory_order_relaxed),
+		        tiles.convertedTiles.load(std::memory_order_relaxed)};
+	}
+
+	[[nodiscard]] ChangeMap::Stats changeStats(int streamIndex) const noexcept
+	{
+		if (streamIndex < 0 || streamIndex >= (int) streams_.size() || !streams_[streamIndex]->changes)
+			return {};
+
+		return streams_[streamIndex]->changes->stats();
+	}
+
+	[[nodiscard]] SilenceStats silenceStats(int streamIndex) const noexcept
+	{
+		if (streamIndex < 0 || streamIndex >= (int) streams_.size() || !streams_[streamIndex]->silence)
+			return {};
+
+		auto& silence = *streams_[streamIndex]->silence;
+		return {silence.samples.load(std::memory_order_relaxed), silence.quietSamples.load(std::memory_order_relaxed),
+		        silence.skippedSamples.load(std::memory_order_relaxed)};
+	}
+
 	void flushStream(int streamIndex) noexcept
 	{
 		auto& stream = streams_[streamIndex];
@@ -189,18 +560,91 @@ public:
 		if (stream->flushed)
 			return;
 
+		if (stream->worker.joinable())
+		{
+			{
+				std::lock_guard lk{stream->queueMutex};
+				stream->stopping = true;
+			}
+			stream->queueCv.notify_all();
+			stream->worker.join();
+		}
+
+		if (stream->fifo && av_audio_fifo_size(stream->fifo) > 0)
+		{
+			// the last frame may be short, otherwise it is padded with silence
+			const auto left = av_audio_fifo_size(stream->fifo);
+			const auto caps = stream->encoder->native()->codec->capabilities;
+			if (!(caps & AV_CODEC_CAP_SMALL_LAST_FRAME))
+				writeSilence(*stream, stream->encoder->native()->frame_size - left);
+			encodeChunk(*stream, av_audio_fifo_size(stream->fifo));
+		}
+
 		auto [res, sz]  = stream->encoder->flush(stream->packets);
 		stream->flushed = true;
 
-		if (res == Result::kFail)
-			return;
+		if (res != Result::kFail)
+			writePackets(*stream, sz);
+
+		// a stream ending before the rollover point has nothing more for the previous file
+		const auto switchPts = stream->switchPts.load();
+		if (switchPts != AV_NOPTS_VALUE)
+			switchOutput(*stream, switchPts);
+	}
 
-		for (int i = 0; i < sz; ++i)
+	/*
+	 * Continues the recording in a new file without stopping the encoders.
+	 * The new file is opened now, every stream moves to it at `at` (AV_TIME_BASE, the clock of the timestamped
+	 * writes): audio with its first packet from then on, video with the first frame from then on, which is forced
+	 * to an IDR. Timestamps restart from `at` in the new file. The previous file is finished once all streams left it.
+	 * A stream written past `at` leaves it with its own packets, however long its encoder holds them back. A stream
+	 * with nothing written past `at` when another one gets kRolloverDeadline past it is moved by force, so a stalled
+	 * device doesn't hold the previous file open: its packets from before `at` that come later are dropped, and
+	 * video resumes with its first frame from `at` on, forced to an IDR.
+	 */
+	[[nodiscard]] Expected<void> rollover(std::string_view filename, int64_t at) noexcept
+	{
+		std::lock_guard lk{rolloverMutex_};
+		if (rollover_)
+			RETURN_AV_ERROR("Rollover to '{}' still pending", rollover_->filename);
+
+		auto fcExp = OutputFormat::create(filename);
+		if (!fcExp)
+			FORWARD_AV_ERROR(fcExp);
+
+		auto next = fcExp.value();
+		for (auto& stream : streams_)
 		{
-			auto expected = formatContext_->writePacket(stream->packets[i], stream->index);
-			if (!expected)
-				LOG_AV_ERROR(expected.errorString());
+			auto sIndExp = next->addStream(stream->encoder);
+			if (!sIndExp)
+				FORWARD_AV_ERROR(sIndExp);
+		}
+
+		std::string name{filename};
+		auto openExp = next->open(name);
+		if (!openExp)
+			FORWARD_AV_ERROR(openExp);
+
+		rollover_ = std::make_unique<Rollover>(Rollover{std::move(next), std::move(name), streams_.size(), at});
+		for (auto& stream : streams_)
+		{
+			stream->switchPts = av_rescale_q(at, AV_TIME_BASE_Q, stream->encoder->native()->time_base);
+			stream->keyPts    = stream->switchPts.load();
 		}
+		rolloverDeadline_ = at + av_rescale_q(1, kRolloverDeadline, AV_TIME_BASE_Q);
+
+		LOG_AV_INFO("Rolling over to '{}' at {} us", rollover_->filename, at);
+
+		return {};
+	}
+
+	// Drift of an audio stream written with capture timestamps against their clock
+	[[nodiscard]] Resample::Drift audioDrift(int streamIndex) const noexcept
+	{
+		if (streamIndex < 0 || streamIndex >= (int) streams_.size() || !streams_[streamIndex]->swr)
+			return {};
+
+		return streams_[streamIndex]->swr->drift();
 	}
 
 	void flushAllStreams() noexcept
@@ -212,6 +656,109 @@ public:
 	}
 
 private:
+	// Packets preallocated per stream so the encoder output vector does not grow while recording
+	static constexpr size_t kPacketsReserve = 8;
+	// Alignment and per-frame slack of the arena frames: the plane tail padding of av_frame_get_buffer and the
+	// alignment of each plane carved from the arena
+	static constexpr int kFrameAlign      = 64;
+	static constexpr size_t kFramePadding = 4096;
+
+	// Pooled video packet payloads are 1 / kPacketPoolShare of a raw picture: every P frame and most key frames fit,
+	// and the packets queued for interleaving don't hold raw sized buffers
+	static constexpr int kPacketPoolShare = 8;
+	// MPEG 90 kHz clock, an integer number of ticks per frame at all the usual frame rates
+	static constexpr AVRational kVideoClock = {1, 90000};
+	// Audio timestamp jitter tolerated before following the capture clock
+	static constexpr AVRational kMaxAudioGap = {1, 25};
+	// Silent frames encoded before their packet is taken as the steady state one, past the transform overlap
+	static constexpr int kSilencePrimeFrames = 3;
+	// A frame with more than 1 / kWholeConversionShare of its tiles changed is converted whole
+	static constexpr uint64_t kWholeConversionShare = 2;
+	// Farthest from a pixel the conversion of the tiles reads: the 2:1 bicubic chroma downsampling of 4:2:0 reaches
+	// 4 pixels, a whole number of 4:2:0 and 4:1:0 chroma blocks above it
+	static constexpr int kTileReach = 8;
+	// How far past the start of a rollover a stream is written before the streams with nothing written past it are
+	// moved by force
+	static constexpr AVRational kRolloverDeadline = {2, 1};
+
+	struct QueuedFrame
+	{
+		Ptr<Frame> frame;
+		AVRational timeBase{};// {0, 0} for generated timestamps
+	};
+
+	// Output a rollover() moves the streams to
+	struct Rollover
+	{
+		Ptr<OutputFormat> next;
+		std::string filename;
+		size_t pending{0};// streams still writing to the previous file
+		int64_t at{0};    // AV_TIME_BASE
+	};
+
+	// Preview state of a video stream, pts and interval in the encoder time base
+	struct Preview
+	{
+		Ptr<Scale> sws;
+		int width{0};
+		int height{0};
+		AVPixelFormat pixFmt{AV_PIX_FMT_NONE};
+		int64_t interval{1};
+		int64_t nextPts{AV_NOPTS_VALUE};
+		Ptr<Frame> spare;// a previous preview to reuse once no reader holds it
+		std::atomic<Ptr<const Frame>> latest;
+	};
+
+	// Stream fed with the converted frames of a video stream
+	struct Rendition
+	{
+		StreamWriter* writer{nullptr};
+		Ptr<StreamWriter> owned;// null when the writer is this one
+		int index{-1};
+	};
+
+	// Tile conversion state of a video stream. The converters are sized to the areas the tiles are converted from,
+	// the scratch frame to the largest.
+	struct Tiles
+	{
+		int tileSize{64};
+		bool disabled{false};
+		Ptr<ChangeMap> input;
+		std::map<std::pair<int, int>, Ptr<Scale>> sws;// by width and height of the area
+		Ptr<Frame> scratch;
+
+		std::atomic<uint64_t> frames{0};
+		std::atomic<uint64_t> tiles{0};
+		std::atomic<uint64_t> convertedTiles{0};
+	};
+
+	// Where a changed tile is converted from and what it puts back: the tile with the pixels around it whose
+	// conversion reads it, converted from as far again around them, so every pixel put back is the one the whole
+	// frame conversion makes and the tiles leave no seams
+	struct TileArea
+	{
+		int x, y, width, height;        // put back
+		int inX, inY, inWidth, inHeight;// converted
+	};
+
+	// Silence skipping state of an audio stream, packet timestamps in the encoder time base
+	struct Silence
+	{
+		double threshold{0};               // mean square of a quiet frame
+		int64_t hangover{0};               // quiet samples encoded before skipping
+		int64_t quietRun{0};               // quiet samples in a row
+		int primed{0};                     // silent frames fed to the encoder so far
+		int64_t capturePts{AV_NOPTS_VALUE};// packet to keep as the silent one
+		Packet packet;                     // the steady state silent packet, empty until captured
+		Packet out;
+		int64_t nextPts{AV_NOPTS_VALUE};  // right after the last muxed packet
+		int64_t skipUntil{AV_NOPTS_VALUE};// encoder packets before it are covered by silent ones
+
+		std::atomic<uint64_t> samples{0};
+		std::atomic<uint64_t> quietSamples{0};
+		std::atomic<uint64_t> skippedSamples{0};
+	};
+
 	struct Stream
 	{
 		AVMediaType type{AVMEDIA_TYPE_UNKNOWN};
@@ -221,15 +768,674 @@ private:
 		Ptr<Resample> swr;
 		Ptr<Frame> frame;
 		std::vector<Packet> packets;
-		int nextPts{0};
+		int64_t nextPts{0};
+		int64_t lastPts{AV_NOPTS_VALUE};
+		int64_t firstPts{0};
 		int sampleCount{0};
 		bool flushed{false};
+
+		AVAudioFifo* fifo{nullptr};
+		Frame chunk;
+		int64_t fifoPts{0};// pts of the first queued sample
+		std::unique_ptr<Silence> silence;
+
+		std::unique_ptr<Tiles> tiles;
+		std::vector<Rendition> renditions;
+		std::unique_ptr<Preview> preview;
+		std::function<void(const Frame&)> onConverted;
+		Ptr<FramePool> framePool;// of the converted video frames, from the frame arena if there is one
+		Frame spare;             // takes the pooled planes replacing those still held
+		Ptr<ChangeMap> changes;// of the converted video frames
+		AVRational roiQOffset{0, 1};
+
+		std::mutex outputMutex;                        // output and offsets, changed by a forced rollover of any stream
+		Ptr<OutputFormat> output;                      // file the packets go to
+		int64_t outputOffset{0};                       // start of that file, in the encoder time base
+		int64_t dropBefore{AV_NOPTS_VALUE};            // packets of the previous file left after a forced rollover
+		bool awaitKey{false};                          // video moved by a forced rollover, until its next key frame
+		std::atomic<int64_t> switchPts{AV_NOPTS_VALUE};// where the stream moves to the rollover file
+		std::atomic<int64_t> keyPts{AV_NOPTS_VALUE};   // the first video frame from then on is forced to an IDR
+		std::atomic<int64_t> writtenTime{AV_NOPTS_VALUE};// AV_TIME_BASE timestamp of the last frame written
+
+		std::thread worker;
+		std::mutex queueMutex;
+		std::condition_variable queueCv;
+		std::vector<QueuedFrame> queue;
+		size_t queueHead{0};
+		size_t queueCount{0};
+		bool stopping{false};
+
+		~Stream()
+		{
+			if (fifo)
+				av_audio_fifo_free(fifo);
+		}
 	};
 
+	Expected<void> writeGenerated(Stream& stream, Frame& frame) noexcept
+	{
+		if (stream.type == AVMEDIA_TYPE_VIDEO)
+		{
+			convertVideo(stream, frame);
+			stream.frame->native()->pts = stream.nextPts++;
+			markChanges(stream);
+			if (stream.onConverted)
+				stream.onConverted(*stream.frame);
+			tapPreview(stream);
+			feedRenditions(stream, {});
+		}
+		else if (stream.type == AVMEDIA_TYPE_AUDIO)
+		{
+            frame.native()->channel_layout = av_get_default_channel_layout(frame.native()->channels);
+			stream.swr->convert(frame, *stream.frame);
+            stream.frame->native()->pts = stream.nextPts;
+			stream.nextPts += stream.frame->native()->nb_samples;
+			return encodeAudio(stream);
+        }
+		else
+			RETURN_AV_ERROR("Unsupported/unknown stream type: {}", av_get_media_type_string(stream.type));
+
+		return encodeAndWrite(stream, *stream.frame);
+	}
+
+	Expected<void> writeTimestamped(Stream& stream, Frame& frame, AVRational timeBase) noexcept
+	{
+		auto pts = frame.native()->pts;
+		if (pts == AV_NOPTS_VALUE || !timeBase.den)
+			return writeGenerated(stream, frame);
+
+		noteWritten(stream, av_rescale_q(pts, timeBase, AV_TIME_BASE_Q));
+		auto encTimeBase = stream.encoder->native()->time_base;
+		if (stream.type == AVMEDIA_TYPE_VIDEO)
+		{
+			pts = av_rescale_q(pts, timeBase, encTimeBase);
+			if (stream.lastPts != AV_NOPTS_VALUE && pts <= stream.lastPts)
+			{
+				LOG_AV_DEBUG("Dropped video frame at {}, not after {}", pts, stream.lastPts);
+				return {};
+			}
+			stream.lastPts = pts;
+
+			// the rollover file has to start with an IDR, also when the stream was moved to it before getting there
+			auto keyPts         = stream.keyPts.load();
+			const bool forceKey = keyPts != AV_NOPTS_VALUE && pts >= keyPts && stream.keyPts.compare_exchange_strong(keyPts, AV_NOPTS_VALUE);
+
+			convertVideo(stream, frame);
+			stream.frame->native()->pts       = pts;
+			stream.frame->native()->pict_type = forceKey ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+			markChanges(stream);
+			if (stream.onConverted)
+				stream.onConverted(*stream.frame);
+			tapPreview(stream);
+			feedRenditions(stream, encTimeBase);
+		}
+		else if (stream.type == AVMEDIA_TYPE_AUDIO)
+		{
+			const auto sampleRate = stream.encoder->native()->sample_rate;
+			pts                   = av_rescale_q(pts, timeBase, {1, sampleRate});
+			const auto maxGap     = av_rescale_q(1, kMaxAudioGap, {1, sampleRate});
+			if (stream.lastPts == AV_NOPTS_VALUE || pts - stream.nextPts > maxGap)
+			{
+				if (stream.lastPts != AV_NOPTS_VALUE)
+					LOG_AV_INFO_EVERY(1000, "Audio gap of {} samples, resynchronized to the capture clock", pts - stream.nextPts);
+				else
+					stream.firstPts = pts;
+				stream.nextPts = pts;
+			}
+			else if (stream.nextPts - pts > maxGap)
+				LOG_AV_INFO_EVERY(1000, "Audio ahead of the capture clock by {} samples", stream.nextPts - pts);
+			else if (auto compExp = stream.swr->compensate(pts - stream.nextPts, stream.nextPts - stream.firstPts); !compExp)
+				LOG_AV_ERROR_EVERY(1000, "{}", compExp.errorString());
+
+            frame.native()->channel_layout = av_get_default_channel_layout(frame.native()->channels);
+			stream.swr->convert(frame, *stream.frame);
+			stream.frame->native()->pts = av_rescale_q(stream.nextPts, {1, sampleRate}, encTimeBase);
+			stream.lastPts              = stream.nextPts;
+			stream.nextPts += stream.frame->native()->nb_samples;
+			return encodeAudio(stream);
+		}
+		else
+			RETURN_AV_ERROR("Unsupported/unknown stream type: {}", av_get_media_type_string(stream.type));
+
+		return encodeAndWrite(stream, *stream.frame);
+	}
+
+	void convertVideo(Stream& stream, const Frame& frame) noexcept
+	{
+		makeWritable(stream);
+
+		if (!stream.tiles || stream.tiles->disabled || !prepareTiles(stream, frame))
+		{
+			stream.sws->scale(frame, *stream.frame);
+			return;
+		}
+
+		auto& tiles      = *stream.tiles;
+		auto& map        = *tiles.input;
+		const auto count = static_cast<uint64_t>(map.columns()) * map.rows();
+		tiles.frames.fetch_add(1, std::memory_order_relaxed);
+		tiles.tiles.fetch_add(count, std::memory_order_relaxed);
+
+		auto changedExp = map.update(frame);
+		if (!changedExp)
+			LOG_AV_ERROR_EVERY(1000, "{}", changedExp.errorString());
+
+		// tile by tile only pays while few tiles changed, the first frame is all changed
+		if (!changedExp || changedExp.value() * kWholeConversionShare > count)
+		{
+			stream.sws->scale(frame, *stream.frame);
+			tiles.convertedTiles.fetch_add(count, std::memory_order_relaxed);
+			return;
+		}
+
+		const auto src = frame.native();
+		for (int ty = 0; ty < map.rows(); ++ty)
+		{
+			for (int tx = 0; tx < map.columns(); ++tx)
+			{
+				if (!map.changed(tx, ty))
+					continue;
+
+				const auto area = tileArea(tx, ty, tiles.tileSize, src->width, src->height);
+				tiles.sws[{area.inWidth, area.inHeight}]->scale(frame, area.inX, area.inY, area.inHeight, *tiles.scratch, 0, 0);
+				Scale::copy(*tiles.scratch, area.x - area.inX, area.y - area.inY, *stream.frame, area.x, area.y, area.width, area.height);
+			}
+		}
+		tiles.convertedTiles.fetch_add(changedExp.value(), std::memory_order_relaxed);
+	}
+
+	// Renditions, callbacks and encoders still holding the previous frame keep it, the conversion goes to other
+	// planes from the pool of the stream. Only the tile conversion, which reuses the content, has it copied along.
+	void makeWritable(Stream& stream) noexcept
+	{
+		auto f = stream.frame->native();
+		if (av_frame_is_writable(f))
+			return;
+
+		auto spare    = stream.spare.native();
+		spare->format = f->format;
+		spare->width  = f->width;
+		spare->height = f->height;
+		if (!stream.framePool->fill(spare))
+		{
+			LOG_AV_ERROR_EVERY(1000, "Failed to get {}x{} {} planes from the frame pool", f->width, f->height, av_get_pix_fmt_name((AVPixelFormat) f->format));
+			if (auto err = av_frame_make_writable(f); err < 0)
+				LOG_AV_ERROR_EVERY(1000, "Could not make video frame writable: {}", avErrorStr(err));
+			return;
+		}
+
+		if (stream.tiles && !stream.tiles->disabled)
+			av_frame_copy(spare, f);
+		av_frame_copy_props(spare, f);
+		av_frame_unref(f);
+		av_frame_move_ref(f, spare);
+	}
+
+	// Sets the tile converters up for the captured frames on the first one
+	bool prepareTiles(Stream& stream, const Frame& frame) noexcept
+	{
+		auto& tiles = *stream.tiles;
+		if (tiles.input)
+			return true;
+
+		const auto src    = frame.native();
+		const auto encCtx = stream.encoder->native();
+		const auto fmt    = static_cast<AVPixelFormat>(src->format);
+		tiles.disabled    = true;
+		if (src->width != encCtx->width || src->height != encCtx->height)
+		{
+			LOG_AV_ERROR("Tile conversion of stream #{} needs an unscaled stream, {}x{} is encoded {}x{}", stream.index, src->width, src->height,
+			             encCtx->width, encCtx->height);
+			return false;
+		}
+
+		auto mapExp = ChangeMap::create(src->width, src->height, fmt, tiles.tileSize);
+		if (!mapExp)
+		{
+			LOG_AV_ERROR("Tile conversion of stream #{} disabled: {}", stream.index, mapExp.errorString());
+			return false;
+		}
+
+		auto& map = *mapExp.value();
+		for (int ty = 0; ty < map.rows(); ++ty)
+		{
+			for (int tx = 0; tx < map.columns(); ++tx)
+			{
+				const auto area = tileArea(tx, ty, tiles.tileSize, src->width, src->height);
+				auto& sws       = tiles.sws[{area.inWidth, area.inHeight}];
+				if (sws)
+					continue;
+
+				auto swsExp = Scale::create(area.inWidth, area.inHeight, fmt, area.inWidth, area.inHeight, encCtx->pix_fmt);
+				if (!swsExp)
+				{
+					LOG_AV_ERROR("Tile conversion of stream #{} disabled: {}", stream.index, swsExp.errorString());
+					return false;
+				}
+				sws = swsExp.value();
+			}
+		}
+
+		const int scratchSize = tiles.tileSize + 4 * kTileReach;
+		auto scratchExp       = Frame::create(scratchSize, scratchSize, encCtx->pix_fmt);
+		if (!scratchExp)
+		{
+			LOG_AV_ERROR("Tile conversion of stream #{} disabled: {}", stream.index, scratchExp.errorString());
+			return false;
+		}
+
+		tiles.scratch  = scratchExp.value();
+		tiles.input    = mapExp.value();
+		tiles.disabled = false;
+		return true;
+	}
+
+	static TileArea tileArea(int tx, int ty, int tileSize, int width, int height) noexcept
+	{
+		const int x = tx * tileSize;
+		const int y = ty * tileSize;
+
+		TileArea area;
+		area.x        = std::max(x - kTileReach, 0);
+		area.y        = std::max(y - kTileReach, 0);
+		area.width    = std::min(x + tileSize + kTileReach, width) - area.x;
+		area.height   = std::min(y + tileSize + kTileReach, height) - area.y;
+		area.inX      = std::max(area.x - kTileReach, 0);
+		area.inY      = std::max(area.y - kTileReach, 0);
+		area.inWidth  = std::min(area.x + area.width + kTileReach, width) - area.inX;
+		area.inHeight = std::min(area.y + area.height + kTileReach, height) - area.inY;
+
+		return area;
+	}
+
+	void tapPreview(Stream& stream) noexcept
+	{
+		if (!stream.preview)
+			return;
+
+		auto& preview  = *stream.preview;
+		const auto pts = stream.frame->native()->pts;
+		if (preview.nextPts != AV_NOPTS_VALUE && pts < preview.nextPts)
+			return;
+		preview.nextPts = pts + preview.interval;
+
+		// the slot does not hold the spare, a use count of 1 leaves it to this thread
+		if (!preview.spare || preview.spare.use_count() > 1)
+		{
+			auto frameExp = Frame::create(preview.width, preview.height, preview.pixFmt);
+			if (!frameExp)
+			{
+				LOG_AV_ERROR_EVERY(1000, "{}", frameExp.errorString());
+				return;
+			}
+			preview.spare = frameExp.value();
+		}
+
+		auto frame = std::move(preview.spare);
+		preview.sws->scale(*stream.frame, *frame);
+		frame->native()->pts = av_rescale_q(pts, stream.encoder->native()->time_base, AV_TIME_BASE_Q);
+		preview.spare        = std::const_pointer_cast<Frame>(preview.latest.exchange(std::move(frame)));
+	}
+
+	// Renditions on their encoder threads queue a reference to the converted frame, generated timestamps for a
+	// {0, 0} timeBase
+	void feedRenditions(Stream& stream, AVRational timeBase) noexcept
+	{
+		for (auto& rendition : stream.renditions)
+		{
+			auto expected = timeBase.den ? rendition.writer->write(*stream.frame, rendition.index, timeBase) : rendition.writer->write(*stream.frame, rendition.index);
+			if (!expected)
+				LOG_AV_ERROR_EVERY(1000, "{}", expected.errorString());
+		}
+	}
+
+	void markChanges(Stream& stream) noexcept
+	{
+		if (!stream.changes)
+			return;
+
+		auto changedExp = stream.changes->update(*stream.frame);
+		if (!changedExp)
+		{
+			LOG_AV_ERROR_EVERY(1000, "{}", changedExp.errorString());
+			return;
+		}
+
+		if (auto roiExp = stream.changes->attachRegionsOfInterest(*stream.frame, stream.roiQOffset); !roiExp)
+			LOG_AV_ERROR_EVERY(1000, "{}", roiExp.errorString());
+	}
+
+	// Converted samples in stream.frame go through the fifo when the encoder wants fixed size frames
+	Expected<void> encodeAudio(Stream& stream) noexcept
+	{
+		if (!stream.fifo)
+			return encodeAndWrite(stream, *stream.frame);
+
+		auto frame = stream.frame->native();
+		if (frame->nb_samples <= 0)
+			return {};
+
+		const auto queued = av_audio_fifo_size(stream.fifo);
+		if (!queued)
+			stream.fifoPts = frame->pts;
+		else if (frame->pts > stream.fifoPts + queued)
+			writeSilence(stream, static_cast<int>(frame->pts - stream.fifoPts - queued));
+
+		auto err = av_audio_fifo_write(stream.fifo, reinterpret_cast<void**>(frame->extended_data), frame->nb_samples);
+		if (err < 0)
+			RETURN_AV_ERROR("Failed to queue {} audio samples: {}", frame->nb_samples, avErrorStr(err));
+
+		const auto frameSize = stream.encoder->native()->frame_size;
+		while (av_audio_fifo_size(stream.fifo) >= frameSize)
+		{
+			auto expected = encodeChunk(stream, frameSize);
+			if (!expected)
+				FORWARD_AV_ERROR(expected);
+		}
+
+		return {};
+	}
+
+	Expected<void> encodeChunk(Stream& stream, int samples) noexcept
+	{
+		auto chunk = stream.chunk.native();
+		auto err   = av_frame_make_writable(chunk);
+		if (err < 0)
+			RETURN_AV_ERROR("Could not make audio frame writable: {}", avErrorStr(err));
+
+		chunk->nb_samples = av_audio_fifo_read(stream.fifo, reinterpret_cast<void**>(chunk->extended_data), samples);
+		chunk->pts        = stream.fifoPts;
+		stream.fifoPts += chunk->nb_samples;
+
+		if (stream.silence)
+			return encodeOrSkipSilence(stream);
+
+		return encodeAndWrite(stream, stream.chunk);
+	}
+
+	bool isQuiet(const Silence& silence, const AVFrame* chunk) noexcept
+	{
+		const bool planar = av_sample_fmt_is_planar(static_cast<AVSampleFormat>(chunk->format));
+		const auto planes = planar ? chunk->channels : 1;
+		const auto count  = static_cast<size_t>(chunk->nb_samples) * (planar ? 1 : chunk->channels);
+
+		double energy = 0;
+		for (int p = 0; p < planes; ++p)
+			energy += simd::sumSquares(reinterpret_cast<const float*>(chunk->extended_data[p]), count);
+
+		return energy < silence.threshold * static_cast<double>(count) * planes;
+	}
+
+	Expected<void> encodeOrSkipSilence(Stream& stream) noexcept
+	{
+		auto& silence = *stream.silence;
+		auto chunk    = stream.chunk.native();
+		const auto n  = chunk->nb_samples;
+
+		silence.samples.fetch_add(n, std::memory_order_relaxed);
+		if (!isQuiet(silence, chunk))
+		{
+			if (silence.quietRun > silence.hangover)
+				LOG_AV_DEBUG("Stream #{} quiet for {} samples", stream.index, silence.quietRun);
+			silence.quietRun = 0;
+			if (silence.capturePts == AV_NOPTS_VALUE)
+				silence.primed = 0;
+			return encodeAndWrite(stream, stream.chunk);
+		}
+
+		silence.quietSamples.fetch_add(n, std::memory_order_relaxed);
+		silence.quietRun += n;
+		if (silence.quietRun <= silence.hangover)
+			return encodeAndWrite(stream, stream.chunk);
+
+		const auto encCtx = stream.encoder->native();
+		if (!silence.packet.native()->size)
+		{
+			// the encoder has to see true silence for its packet to be a clean one
+			av_samples_set_silence(chunk->extended_data, 0, n, chunk->channels, static_cast<AVSampleFormat>(chunk->format));
+			if (++silence.primed == kSilencePrimeFrames)
+				silence.capturePts = chunk->pts - encCtx->initial_padding;
+			return encodeAndWrite(stream, stream.chunk);
+		}
+
+		// the encoder keeps its delay of frames without packets, they are covered here and dropped later
+		const auto end = chunk->pts + n - encCtx->initial_padding;
+		for (; silence.nextPts < end; silence.nextPts += encCtx->frame_size)
+		{
+			auto out = silence.out.native();
+			av_packet_unref(out);
+			if (av_packet_ref(out, silence.packet.native()) < 0)
+				RETURN_AV_ERROR("Could not reference the silent packet");
+			out->pts = out->dts = silence.nextPts;
+			out->duration       = encCtx->frame_size;
+
+			auto expected = writeOutput(stream, silence.out);
+			if (!expected)
+				LOG_AV_ERROR("{}", expected.errorString());
+		}
+		silence.skipUntil = silence.nextPts;
+		silence.skippedSamples.fetch_add(n, std::memory_order_relaxed);
+
+		return {};
+	}
+
+	// Encoder packets of a span already muxed as silence are dropped, the silent packet is captured on its way out
+	bool keepPacket(Stream& stream, Packet& packet) noexcept
+	{
+		auto& silence = *stream.silence;
+		auto pkt      = packet.native();
+		if (silence.skipUntil != AV_NOPTS_VALUE && pkt->pts < silence.skipUntil)
+			return false;
+
+		if (pkt->pts == silence.capturePts)
+		{
+			av_packet_ref(silence.packet.native(), pkt);
+			av_packet_free_side_data(silence.packet.native());
+			silence.capturePts = AV_NOPTS_VALUE;
+		}
+		silence.nextPts = pkt->pts + (pkt->duration > 0 ? pkt->duration : stream.encoder->native()->frame_size);
+
+		return true;
+	}
+
+	void writeSilence(Stream& stream, int samples) noexcept
+	{
+		auto chunk = stream.chunk.native();
+		if (samples <= 0 || av_frame_make_writable(chunk) < 0)
+			return;
+
+		const auto frameSize = stream.encoder->native()->frame_size;
+		av_samples_set_silence(chunk->extended_data, 0, frameSize, chunk->channels, static_cast<AVSampleFormat>(chunk->format));
+		for (int left = samples; left > 0; left -= frameSize)
+			av_audio_fifo_write(stream.fifo, reinterpret_cast<void**>(chunk->extended_data), std::min(left, frameSize));
+	}
+
+	// take moves the references of the frame into the queue, the entries are empty until then
+	Expected<void> enqueue(Stream& stream, Frame& frame, AVRational timeBase, bool take) noexcept
+	{
+		std::unique_lock lk{stream.queueMutex};
+		stream.queueCv.wait(lk, [&stream] { return stream.queueCount < stream.queue.size(); });
+
+		auto& entry = stream.queue[(stream.queueHead + stream.queueCount) % stream.queue.size()];
+		if (take)
+			av_frame_move_ref(entry.frame->native(), frame.native());
+		else if (auto err = av_frame_ref(entry.frame->native(), frame.native()); err < 0)
+			RETURN_AV_ERROR("Could not reference frame for the encoder thread: {}", avErrorStr(err));
+		entry.frame->type(frame.type());
+		entry.timeBase = timeBase;
+		stream.queueCount++;
+		lk.unlock();
+		stream.queueCv.notify_all();
+
+		return {};
+	}
+
+	void encodeLoop(Stream& stream) noexcept
+	{
+		for (;;)
+		{
+			std::unique_lock lk{stream.queueMutex};
+			stream.queueCv.wait(lk, [&stream] { return stream.queueCount || stream.stopping; });
+			if (!stream.queueCount)
+				return;
+			auto& entry = stream.queue[stream.queueHead];
+			lk.unlock();
+
+			auto expected = writeTimestamped(stream, *entry.frame, entry.timeBase);
+			if (!expected)
+				LOG_AV_ERROR_EVERY(1000, "{}", expected.errorString());
+			av_frame_unref(entry.frame->native());
+
+			lk.lock();
+			stream.queueHead = (stream.queueHead + 1) % stream.queue.size();
+			stream.queueCount--;
+			lk.unlock();
+			stream.queueCv.notify_all();
+		}
+	}
+
+	Expected<void> encodeAndWrite(Stream& stream, Frame& frame) noexcept
+	{
+		auto [res, sz] = stream.encoder->encodeFrame(frame, stream.packets);
+
+		if (res == Result::kFail)
+			RETURN_AV_ERROR("Encoder returned failure");
+
+		writePackets(stream, sz);
+
+		return {};
+	}
+
+	void writePackets(Stream& stream, int count) noexcept
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			if (stream.silence && !keepPacket(stream, stream.packets[i]))
+				continue;
+
+			auto expected = writeOutput(stream, stream.packets[i]);
+			if (!expected)
+				LOG_AV_ERROR("{}", expected.errorString());
+		}
+	}
+
+	Expected<void> writeOutput(Stream& stream, Packet& packet) noexcept
+	{
+		auto pkt             = packet.native();
+		const auto switchPts = stream.switchPts.load();
+		if (switchPts != AV_NOPTS_VALUE && pkt->pts >= switchPts && (stream.type != AVMEDIA_TYPE_VIDEO || pkt->flags & AV_PKT_FLAG_KEY))
+			switchOutput(stream, switchPts);
+
+		std::lock_guard lk{stream.outputMutex};
+		if (stream.dropBefore != AV_NOPTS_VALUE && pkt->pts < stream.dropBefore)
+		{
+			LOG_AV_DEBUG("Stream #{}: dropped packet at {}, its file is finished", stream.index, pkt->pts);
+			return {};
+		}
+		if (stream.awaitKey && !(pkt->flags & AV_PKT_FLAG_KEY))
+			return {};
+		stream.awaitKey = false;
+
+		if (stream.outputOffset)
+		{
+			pkt->pts -= stream.outputOffset;
+			pkt->dts -= stream.outputOffset;
+		}
+
+		return stream.output->writePacket(packet, stream.index);
+	}
+
+	void switchOutput(Stream& stream, int64_t switchPts) noexcept
+	{
+		Ptr<OutputFormat> finished;
+		{
+			std::lock_guard lk{rolloverMutex_};
+			// moved meanwhile by a forced switch
+			if (!rollover_ || stream.switchPts.load() == AV_NOPTS_VALUE)
+				return;
+
+			if (moveStream(stream, switchPts, false))
+				finished = finishRollover();
+		}
+		// the trailer of the previous file is written here, outside the lock
+	}
+
+	// Written frames, not packets, tell how far a stream got: an encoder with lookahead holds seconds of video back
+	void noteWritten(Stream& stream, int64_t time) noexcept
+	{
+		stream.writtenTime = time;
+		const auto deadline = rolloverDeadline_.load();
+		if (deadline != AV_NOPTS_VALUE && time > deadline)
+			forceSwitch();
+	}
+
+	// Moves the streams with nothing written past the start of the rollover, once another one is past its deadline.
+	// The others are on their way with the packets their encoders still hold.
+	void forceSwitch() noexcept
+	{
+		Ptr<OutputFormat> finished;
+		{
+			std::lock_guard lk{rolloverMutex_};
+			if (!rollover_ || rolloverDeadline_.load() == AV_NOPTS_VALUE)
+				return;
+
+			rolloverDeadline_ = AV_NOPTS_VALUE;
+			size_t forced     = 0;
+			bool done         = false;
+			for (auto& stream : streams_)
+			{
+				const auto switchPts = stream->switchPts.load();
+				const auto written   = stream->writtenTime.load();
+				if (switchPts == AV_NOPTS_VALUE || (written != AV_NOPTS_VALUE && written >= rollover_->at))
+					continue;
+
+				forced++;
+				done = moveStream(*stream, switchPts, true);
+			}
+			if (forced)
+				LOG_AV_INFO("Rollover to '{}' forced for {} streams with nothing written past its start", rollover_->filename, forced);
+			if (done)
+				finished = finishRollover();
+		}
+	}
+
+	// With rolloverMutex_ held, true once no stream is left on the previous file
+	bool moveStream(Stream& stream, int64_t switchPts, bool forced) noexcept
+	{
+		std::lock_guard lk{stream.outputMutex};
+		stream.output       = rollover_->next;
+		stream.outputOffset = switchPts;
+		stream.switchPts    = AV_NOPTS_VALUE;
+		if (forced)
+		{
+			stream.dropBefore = switchPts;
+			stream.awaitKey   = stream.type == AVMEDIA_TYPE_VIDEO;
+		}
+
+		return --rollover_->pending == 0;
+	}
+
+	// With rolloverMutex_ held, the previous file to be destroyed by the caller once unlocked
+	Ptr<OutputFormat> finishRollover() noexcept
+	{
+		LOG_AV_INFO("Rolled over to '{}'", rollover_->filename);
+		auto finished     = std::move(formatContext_);
+		formatContext_    = std::move(rollover_->next);
+		filename_         = std::move(rollover_->filename);
+		rolloverDeadline_ = AV_NOPTS_VALUE;
+		rollover_.reset();
+
+		return finished;
+	}
+
 private:
 	std::string filename_;
+	bool variableFrameRate_{false};
 	std::vector<Ptr<Stream>> streams_;
 	Ptr<OutputFormat> formatContext_;
+	std::mutex rolloverMutex_;
+	std::unique_ptr<Rollover> rollover_;
+	std::atomic<int64_t> rolloverDeadline_{AV_NOPTS_VALUE};// AV_TIME_BASE, until the stalled streams of a pending rollover are moved
 };
 
 }// namespace av
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <charconv>
 #include <cstring>
 #include <memory>
 #include <stdexcept>
@@ -8,8 +9,10 @@
 #include <utility>
 #include <variant>
 #include <vector>
-#include <tuple>
 #include <string_view>
+#include <type_traits>
+
+#include "Log.hpp"
 
 extern "C"
 {
@@ -17,7 +20,9 @@ extern "C"
 #include <libavformat/avformat.h>
 #include <libavutil/avutil.h>
 #include <libavutil/opt.h>
+#include <libavutil/audio_fifo.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/time.h>
 #include <libswresample/swresample.h>
 #include <libswscale/swscale.h>
 #include <libavdevice/avdevice.h>
@@ -40,57 +45,99 @@ auto makePtr(Args&&... args)
 namespace internal
 {
 template<typename T>
-std::string toString(T&& v) noexcept
+inline void appendArg(std::string& out, const T& v) noexcept
 {
-	if constexpr (std::is_convertible_v<T, std::string>)
-		return std::string(v);
+	if constexpr (std::is_pointer_v<T> && std::is_convertible_v<T, std::string_view>)
+		out.append(v ? std::string_view(v) : std::string_view("(null)"));
+	else if constexpr (std::is_convertible_v<const T&, std::string_view>)
+		out.append(std::string_view(v));
+	else if constexpr (std::is_enum_v<T>)
+		appendArg(out, static_cast<std::underlying_type_t<T>>(v));
+	else if constexpr (std::is_arithmetic_v<T>)
+	{
+		char buf[64];
+		auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), v);
+		out.append(buf, ec == std::errc{} ? end : buf);
+	}
 	else
-		return std::to_string(v);
-};
+		static_assert(sizeof(T) == 0, "Unsupported format argument type");
+}
 
-inline
-std::string toString(string_view v) noexcept
+inline void formatTo(std::string& out, std::string_view fmt) noexcept
 {
-	return v.data();
+	out.append(fmt);
 }
 
-template<typename... Args>
-inline size_t formatInplaceEx(std::string& fmt, int offset, Args&&... args) noexcept
+// Appends fmt to out replacing each "{}" with the next argument, the format string is not checked
+template<typename T, typename... Rest>
+inline void formatTo(std::string& out, std::string_view fmt, const T& arg, const Rest&... rest) noexcept
+{
+	auto pos = fmt.find("{}");
+	if (pos == std::string_view::npos)
+	{
+		out.append(fmt);
+		return;
+	}
+
+	out.append(fmt.substr(0, pos));
+	appendArg(out, arg);
+	formatTo(out, fmt.substr(pos + 2), rest...);
+}
+
+consteval size_t countPlaceholders(std::string_view fmt)
 {
-	std::vector<std::string> sargs;
-	(sargs.emplace_back(toString(args)), ...);
+	size_t n = 0;
+	for (auto pos = fmt.find("{}"); pos != std::string_view::npos; pos = fmt.find("{}", pos + 2))
+		++n;
+	return n;
+}
 
-	size_t pos = offset;
-	if (fmt.capacity() < 1024)
-		fmt.reserve(1024);
+// Not constexpr on purpose: reaching it during constant evaluation turns a bad format string into a compile error
+inline void formatArgumentCountMismatch() noexcept {}
 
-	for (const auto& arg : sargs)
+template<typename... Args>
+struct FormatString
+{
+	template<typename S>
+	    requires std::is_convertible_v<const S&, std::string_view>
+	consteval FormatString(const S& s)
+	    : str(s)
 	{
-		pos = fmt.find("{}", pos);
-		if (pos == std::string::npos)
-			return pos;
+		if (countPlaceholders(str) != sizeof...(Args))
+			formatArgumentCountMismatch();
+	}
 
-		fmt.replace(pos, 2, arg);
+	std::string_view str;
+};
 
-		pos += arg.size();
-		if (pos >= fmt.size())
-			return fmt.size();
-	}
+template<typename... Args>
+inline std::string format(FormatString<std::type_identity_t<Args>...> fmt, Args&&... args) noexcept
+{
+	std::string result;
+	result.reserve(fmt.str.size() + 16 * sizeof...(Args));
+	formatTo(result, fmt.str, args...);
 
-	return fmt.size();
+	return result;
 }
 
+// Formats into a per-thread buffer that keeps its capacity, so steady-state logging does not allocate.
+// The view is valid until the next call on the same thread.
 template<typename... Args>
-inline size_t formatInplace(std::string& fmt, Args&&... args) noexcept
+inline std::string_view formatToBuffer(FormatString<std::type_identity_t<Args>...> fmt, Args&&... args) noexcept
 {
-	return formatInplaceEx(fmt, 0, std::forward<Args>(args)...);
+	thread_local std::string buffer;
+	buffer.clear();
+	formatTo(buffer, fmt.str, args...);
+
+	return buffer;
 }
 
+// For format strings only known at runtime
 template<typename... Args>
-inline std::string format(string_view fmt, Args&&... args) noexcept
+inline std::string formatUnchecked(std::string_view fmt, Args&&... args) noexcept
 {
-	std::string result(fmt);
-	formatInplace(result, std::forward<Args>(args)...);
+	std::string result;
+	formatTo(result, fmt, args...);
 
 	return result;
 }
@@ -123,27 +170,42 @@ private:
 
 #define MAKE_AV_SOURCE_LOCATION() (av::internal::SourceLocation(__FILE__, __LINE__, static_cast<const char*>(__FUNCTION__)))
 
-enum LogLevel
-{
-	Trace    = 0,
-	Debug    = 1,
-	Info     = 2,
-	Warn     = 3,
-	Err      = 4,
-	Critical = 5,
-	Off      = 6,
-	n_levels
-};
-
-inline void writeLog(LogLevel level, internal::SourceLocation&& loc, std::string msg) noexcept
+inline void writeLog(LogLevel level, internal::SourceLocation&& loc, std::string_view msg, uint32_t suppressed = 0) noexcept
 {
-    std::cerr << loc.toString() << ": " << msg << std::endl;
+	auto [file, line, fun] = loc.values();
+	Logger::instance().push(level, file, line, fun, msg, suppressed);
 }
-//void writeLog(LogLevel level, internal::SourceLocation&& loc, std::string msg) noexcept;
 
-#define LOG_AV_ERROR(...) av::writeLog(av::LogLevel::Err, MAKE_AV_SOURCE_LOCATION(), av::internal::format(__VA_ARGS__))
-#define LOG_AV_DEBUG(...) av::writeLog(av::LogLevel::Debug, MAKE_AV_SOURCE_LOCATION(), av::internal::format(__VA_ARGS__))
-#define LOG_AV_INFO(...) av::writeLog(av::LogLevel::Info, MAKE_AV_SOURCE_LOCATION(), av::internal::format(__VA_ARGS__))
+#define AV_LOG_ENABLED(level) (static_cast<int>(level) >= AV_LOG_ACTIVE_LEVEL)
+
+#define LOG_AV(level, ...)                                                                        \
+	do                                                                                            \
+	{                                                                                             \
+		if constexpr (AV_LOG_ENABLED(level))                                                      \
+		{                                                                                         \
+			if (av::Logger::instance().enabled(level))                                            \
+				av::writeLog(level, MAKE_AV_SOURCE_LOCATION(), av::internal::formatToBuffer(__VA_ARGS__));\
+		}                                                                                         \
+	} while (0)
+
+// Per call site rate limiting: at most one message every intervalMs, the rest are counted and reported with the next one
+#define LOG_AV_RATE_LIMITED(level, intervalMs, ...)                                                                                   \
+	do                                                                                                                                \
+	{                                                                                                                                 \
+		if constexpr (AV_LOG_ENABLED(level))                                                                                          \
+		{                                                                                                                             \
+			static av::internal::RateLimiter avLogLimiter_{intervalMs};                                                               \
+			if (av::Logger::instance().enabled(level) && avLogLimiter_.allow())                                                       \
+				av::writeLog(level, MAKE_AV_SOURCE_LOCATION(), av::internal::formatToBuffer(__VA_ARGS__), avLogLimiter_.takeSuppressed());\
+		}                                                                                                                             \
+	} while (0)
+
+#define LOG_AV_ERROR(...) LOG_AV(av::LogLevel::Err, __VA_ARGS__)
+#define LOG_AV_DEBUG(...) LOG_AV(av::LogLevel::Debug, __VA_ARGS__)
+#define LOG_AV_INFO(...) LOG_AV(av::LogLevel::Info, __VA_ARGS__)
+
+#define LOG_AV_ERROR_EVERY(intervalMs, ...) LOG_AV_RATE_LIMITED(av::LogLevel::Err, intervalMs, __VA_ARGS__)
+#define LOG_AV_INFO_EVERY(intervalMs, ...) LOG_AV_RATE_LIMITED(av::LogLevel::Info, intervalMs, __VA_ARGS__)
 
 enum class Result
 {
@@ -153,6 +215,19 @@ enum class Result
 	kFail
 };
 
+// Recycling statistics of FramePool/PacketPool: a hit reused a pooled object, a miss had to allocate one
+struct PoolStats
+{
+	uint64_t hits{0};
+	uint64_t misses{0};
+
+	[[nodiscard]] double hitRate() const noexcept
+	{
+		auto total = hits + misses;
+		return total ? static_cast<double>(hits) / static_cast<double>(total) : 0.0;
+	}
+};
+
 struct NoCopyable
 {
 	NoCopyable()                  = default;
@@ -162,92 +237,84 @@ struct NoCopyable
 
 inline std::string avErrorStr(int av_error_code) noexcept
 {
-	const auto buf_size = 1024U;
-	std::string err_string(buf_size, 0);
+	char buf[AV_ERROR_MAX_STRING_SIZE];
 
-	if (0 != av_strerror(av_error_code, err_string.data(), buf_size - 1))
-	{
+	if (0 != av_strerror(av_error_code, buf, sizeof(buf)))
 		return internal::format("Unknown error with code: {}", av_error_code);
-	}
-
-	const auto len = std::strlen(err_string.data());
-	err_string.resize(len);
 
-	return err_string;
+	return buf;
 }
 
+/*
+ * Success is represented by a null error pointer, so constructing, moving and testing a successful
+ * Expected never touches the heap. The error record is allocated only when a failure is created and
+ * the call stack grows as the failure is forwarded up.
+ */
 class ExpectedBase
 {
+	struct Error
+	{
+		std::vector<internal::SourceLocation> stack;
+		std::string desc;
+	};
+
 public:
-	ExpectedBase(const internal::SourceLocation& loc, string_view desc) noexcept
-	    : desc_(desc)
+	ExpectedBase(const internal::SourceLocation& loc, std::string desc) noexcept
+	    : error_(new Error{{}, std::move(desc)})
 	{
-		stack_.emplace_back(loc);
+		error_->stack.emplace_back(loc);
 	}
 
 	ExpectedBase(const internal::SourceLocation& loc, ExpectedBase&& other) noexcept
-	    : stack_(std::move(other.stack_)), desc_(std::move(other.desc_))
+	    : error_(std::move(other.error_))
 	{
-		stack_.emplace_back(loc);
-	}
+		if (!error_)
+			error_.reset(new Error{{}, "Forwarded a successful result as an error"});
 
-	ExpectedBase() = default;
-
-	ExpectedBase(ExpectedBase&& o) noexcept
-	    : stack_(std::move(o.stack_)), desc_(std::move(o.desc_))
-	{}
-
-	ExpectedBase& operator=(ExpectedBase&& o) noexcept
-	{
-		if (&o == this)
-			return *this;
+		error_->stack.emplace_back(loc);
+	}
 
-		stack_ = std::move(o.stack_);
-		desc_  = std::move(o.desc_);
+	ExpectedBase() noexcept = default;
 
-		return *this;
-	}
+	ExpectedBase(ExpectedBase&& o) noexcept = default;
+	ExpectedBase& operator=(ExpectedBase&& o) noexcept = default;
 
 	explicit operator bool() const noexcept
 	{
-		return stack_.empty();
+		return !error_;
 	}
 
-	const auto& stack() const noexcept
+	const std::vector<internal::SourceLocation>& stack() const noexcept
 	{
-		return stack_;
+		static const std::vector<internal::SourceLocation> empty;
+		return error_ ? error_->stack : empty;
 	}
 
-	const auto& errorDescription() const noexcept
+	const std::string& errorDescription() const noexcept
 	{
-		return desc_;
+		static const std::string empty;
+		return error_ ? error_->desc : empty;
 	}
 
 	[[nodiscard]] std::string errorString() const noexcept
 	{
-		if (stack_.empty())
+		if (!error_)
 			return "";
 
 		std::string result;
-		result.reserve(4 * 1024);
+		result.reserve(1024);
 
-		int i      = 0;
-		size_t pos = 0;
-		for (auto it = stack_.rbegin(); it != stack_.rend(); ++it)
-		{
-			result += "#{} {}\n";
-			pos = internal::formatInplaceEx(result, static_cast<int>(pos), i++, it->toString());
-		}
+		int i = 0;
+		for (auto it = error_->stack.rbegin(); it != error_->stack.rend(); ++it)
+			internal::formatTo(result, "#{} {}\n", i++, it->toString());
 
-		result += "Error: {}";
-		internal::formatInplaceEx(result, static_cast<int>(pos), desc_);
+		internal::formatTo(result, "Error: {}", error_->desc);
 
 		return result;
 	}
 
 private:
-	std::vector<internal::SourceLocation> stack_;
-	std::string desc_;
+	std::unique_ptr<Error> error_;
 };
 
 template<typename T>
@@ -306,6 +373,7 @@ Return assertExpected(av::Expected<Return>&& expected) noexcept
 {
 	if (!expected)
 	{
+		av::Logger::instance().flush();
 		std::cerr << " === Expected failure == \n"
 		          << expected.errorString() << std::endl;
 		exit(EXIT_FAILURE);
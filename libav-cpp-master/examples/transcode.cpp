@@ -3,20 +3,10 @@
 #include <av/StreamReader.hpp>
 #include <av/StreamWriter.hpp>
 
-// Since it a header only library there is no specific logging backend, so we must implement our own writeLog function
-// and place it in av namespace
-namespace av
-{
-void writeLog(LogLevel level, internal::SourceLocation&& loc, std::string msg) noexcept
-{
-	std::cerr << loc.toString() << ": " << msg << std::endl;
-}
-}// namespace av
-
 template<typename... Args>
 void println(std::string_view fmt, Args&&... args) noexcept
 {
-	std::cout << av::internal::format(fmt, std::forward<Args>(args)...) << std::endl;
+	std::cout << av::internal::formatUnchecked(fmt, std::forward<Args>(args)...) << std::endl;
 }
 
 template<typename Return>
@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <malloc.h>
+
+/**
+ * Counts the heap allocations of the process at the C library: malloc, calloc, realloc and the aligned allocators
+ * are defined here and forwarded to the glibc implementation. The shared libraries resolve them to these definitions
+ * too, so every allocation is seen wherever it is made: operator new of the C++ library, av_malloc, the AVBufferRef
+ * that libavutil allocates inside av_buffer_ref() or av_frame_ref(), the codecs and the muxers. The executable has to
+ * export them (ENABLE_EXPORTS). The functions are defined here, not inline: only the file with main() of a test
+ * includes this header.
+ */
+namespace allocations {
+inline std::atomic<uint64_t> total{0};
+
+/**
+ * Allocations made since its construction, by every thread.
+ */
+class Counter
+{
+    uint64_t start;
+public:
+    Counter() : start(total.load()) {}
+    [[nodiscard]] uint64_t count() const { return total.load() - this->start; }
+};
+}
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t nmemb, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+
+// noexcept like the declarations of the C library
+void* malloc(size_t size) noexcept {
+    allocations::total.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size) noexcept {
+    allocations::total.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(nmemb, size);
+}
+
+// a reallocation may move the block, it counts as one
+void* realloc(void* ptr, size_t size) noexcept {
+    allocations::total.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size) noexcept {
+    allocations::total.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept {
+    allocations::total.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) noexcept {
+    if (alignment % sizeof(void*) || alignment & (alignment - 1))
+        return EINVAL;
+    allocations::total.fetch_add(1, std::memory_order_relaxed);
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : ENOMEM;
+}
+}
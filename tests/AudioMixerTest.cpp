@@ -0,0 +1,262 @@
+/**
+ * AudioMixer with file-backed sources: stereo WAV files are demuxed and decoded like a capture device, and their
+ * frames are pushed stamped with their position on the timeline, the sources in the order they would arrive live.
+ * Checks that the sources are placed sample exact by their timestamps, that a stalled source is padded with
+ * silence while the others go on once it is maxLatency behind, and that the limiter keeps a loud mix under
+ * kCeiling.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "Check.h"
+#include "../libav-cpp-master/av/AudioMixer.hpp"
+#include "../libav-cpp-master/av/Decoder.hpp"
+#include "../libav-cpp-master/av/Packet.hpp"
+
+namespace {
+constexpr int kSampleRate = 48000;
+constexpr int kChannels = 2;
+constexpr int kFrameSize = 1024;
+constexpr int64_t kMaxLatency = kSampleRate / 5;
+
+std::string directory;
+
+/**
+ * Writes a 16 bit stereo WAV file.
+ * @param name: the file name in the test directory.
+ * @param seconds: the duration.
+ * @param sample: the value of sample i, the same on both channels.
+ * @return the path of the file.
+ */
+std::string writeWav(const std::string& name, const int seconds, const std::function<float(int)>& sample) {
+    const auto path = directory + "/" + name;
+    const uint32_t samples = seconds * kSampleRate;
+    const uint32_t dataBytes = samples * kChannels * 2;
+    auto file = std::fopen(path.c_str(), "wb");
+    auto put = [file](const uint32_t v, const int bytes) { std::fwrite(&v, bytes, 1, file); }; // little endian host
+    std::fwrite("RIFF", 4, 1, file);
+    put(36 + dataBytes, 4);
+    std::fwrite("WAVEfmt ", 8, 1, file);
+    put(16, 4);
+    put(1, 2); // PCM
+    put(kChannels, 2);
+    put(kSampleRate, 4);
+    put(kSampleRate * kChannels * 2, 4);
+    put(kChannels * 2, 2);
+    put(16, 2);
+    std::fwrite("data", 4, 1, file);
+    put(dataBytes, 4);
+    for (uint32_t i = 0; i < samples; i++) {
+        const auto v = (int16_t)std::lrint(std::clamp(sample(i) * 32768.0f, -32768.0f, 32767.0f));
+        for (int c = 0; c < kChannels; c++)
+            std::fwrite(&v, 2, 1, file);
+    }
+    std::fclose(file);
+    return path;
+}
+
+/**
+ * A WAV file read like a capture device, shift moves its frames on the mixer timeline.
+ */
+class Source
+{
+    AVFormatContext* input = nullptr;
+    std::shared_ptr<av::Decoder> decoder;
+    av::Packet packet;
+    av::Frame frame;
+    int streamIndex = -1;
+    bool pending = false;
+public:
+    std::function<int64_t(int64_t)> shift = [](int64_t) { return 0; };
+    int64_t read = 0; // samples pushed so far
+    int index = -1;
+
+    explicit Source(const std::string& path) {
+        AVCodec* codec = nullptr;
+        if (avformat_open_input(&input, path.c_str(), nullptr, nullptr) < 0 || avformat_find_stream_info(input, nullptr) < 0 ||
+            (streamIndex = av_find_best_stream(input, AVMEDIA_TYPE_AUDIO, -1, -1, &codec, 0)) < 0)
+            return;
+        auto decoderExp = av::Decoder::create(codec, input->streams[streamIndex]);
+        if (decoderExp)
+            decoder = decoderExp.value();
+    }
+
+    ~Source() {
+        avformat_close_input(&input);
+    }
+
+    bool ready() const {
+        return decoder != nullptr;
+    }
+
+    // decodes the next frame, false at the end of the file
+    bool next() {
+        if (pending)
+            return true;
+        while (true) {
+            packet.dataUnref();
+            if (av_read_frame(input, packet.native()) < 0)
+                return false;
+            if (packet.native()->stream_index != streamIndex)
+                continue;
+            auto res = decoder->decode(packet, frame);
+            if (res && res.value() == av::Result::kSuccess)
+                return pending = true;
+        }
+    }
+
+    int64_t position() const {
+        return read + shift(read);
+    }
+
+    bool push(av::AudioMixer& mixer) {
+        frame.native()->pts = position();
+        read += frame.native()->nb_samples;
+        pending = false;
+        return (bool)mixer.push(this->index, frame, {1, kSampleRate});
+    }
+};
+
+/**
+ * Mixed channels, as pulled from the mixer.
+ */
+struct Mix
+{
+    std::vector<float> channels[kChannels];
+
+    void pull(av::AudioMixer& mixer) {
+        av::Frame out;
+        while (true) {
+            auto pulled = mixer.pull(out);
+            if (!pulled || !pulled.value())
+                return;
+            CHECK(out.native()->pts == (int64_t)channels[0].size());
+            for (int c = 0; c < kChannels; c++) {
+                auto samples = reinterpret_cast<const float*>(out.native()->data[c]);
+                channels[c].insert(channels[c].end(), samples, samples + out.native()->nb_samples);
+            }
+        }
+    }
+
+    // the samples of [from, to) of the first channel all equal value
+    bool equals(const int64_t from, const int64_t to, const float value) const {
+        if (to > (int64_t)channels[0].size())
+            return false;
+        for (auto i = from; i < to; i++) {
+            if (std::abs(channels[0][i] - value) > 1e-6f)
+                return false;
+        }
+        return true;
+    }
+};
+
+/**
+ * Pushes the sources in the order of their timeline positions, like live devices, pulling after every push once
+ * they all started: the mixer can't wait for a source it has no samples from yet.
+ * @param beforePush: called before each push with the source about to be pushed.
+ */
+Mix mix(av::AudioMixer& mixer, std::vector<Source*> sources, const std::function<void(const Source&, const Mix&)>& beforePush = {}) {
+    Mix res;
+    for (auto source : sources)
+        source->index = assertExpected(mixer.addSource(kChannels, AV_SAMPLE_FMT_S16, kSampleRate));
+    while (true) {
+        Source* next = nullptr;
+        for (auto source : sources) {
+            if (source->next() && (!next || source->position() < next->position()))
+                next = source;
+        }
+        if (!next)
+            return res;
+        if (beforePush)
+            beforePush(*next, res);
+        CHECK(next->push(mixer));
+        if (std::all_of(sources.begin(), sources.end(), [](auto source) { return source->read > 0; }))
+            res.pull(mixer);
+    }
+}
+
+// a source starting later on the timeline is added from there on, sample exact
+void alignment() {
+    constexpr int64_t offset = 4800;
+    Source a{writeWav("a.wav", 1, [](int) { return 0.25f; })};
+    Source b{writeWav("b.wav", 1, [](int) { return 0.125f; })};
+    if (!a.ready() || !b.ready())
+        std::exit(kSkipped);
+    b.shift = [](int64_t) { return offset; };
+    auto mixer = assertExpected(av::AudioMixer::create(kChannels, kSampleRate, kFrameSize));
+    const auto res = mix(*mixer, {&a, &b});
+
+    std::printf("alignment: %zu samples mixed\n", res.channels[0].size());
+    CHECK(res.equals(0, offset, 0.25f));
+    CHECK(res.equals(offset, kSampleRate - kFrameSize, 0.375f));
+    CHECK(mixer->stats().paddedSamples == 0);
+}
+
+// a source missing 300 ms is padded with silence, the mix goes on without it once it is maxLatency behind
+void stall() {
+    constexpr int64_t stallAt = kSampleRate / 2;
+    constexpr int64_t gap = kSampleRate * 3 / 10;
+    Source a{writeWav("a.wav", 2, [](int) { return 0.25f; })};
+    Source b{writeWav("b.wav", 2, [](int) { return 0.125f; })};
+    b.shift = [](const int64_t read) { return read >= stallAt ? gap : 0; };
+    auto mixer = assertExpected(av::AudioMixer::create(kChannels, kSampleRate, kFrameSize));
+    // the stall starts with the first frame read past stallAt
+    int64_t stalledFrom = -1;
+    int64_t mixedInStall = 0;
+    const auto res = mix(*mixer, {&a, &b}, [&](const Source& next, const Mix& mixed) {
+        if (&next == &b && b.read >= stallAt && stalledFrom < 0) {
+            stalledFrom = b.read;
+            mixedInStall = (int64_t)mixed.channels[0].size();
+        }
+    });
+
+    const auto stats = mixer->stats();
+    std::printf("stall: %llu samples padded, %lld samples mixed while stalled\n", (unsigned long long)stats.paddedSamples, (long long)mixedInStall);
+    CHECK(stats.paddedSamples > 0 && (int64_t)stats.paddedSamples <= gap);
+    // the mix went on without the stalled source, up to where it came back
+    CHECK(mixedInStall + 2 * kFrameSize >= stalledFrom + gap);
+    CHECK(res.equals(0, stalledFrom, 0.375f));
+    CHECK(res.equals(stalledFrom, stalledFrom + gap, 0.25f));
+    // its first frame back may have come after the mix passed its start
+    CHECK(res.equals(stalledFrom + gap + kFrameSize, 2 * kSampleRate - kFrameSize, 0.375f));
+}
+
+// two loud sources in phase sum up to 1.6, the limiter keeps them under the ceiling
+void limiter() {
+    auto sine = [](const int i) { return 0.8f * (float)std::sin(2 * M_PI * 440 * i / kSampleRate); };
+    Source a{writeWav("a.wav", 2, sine)};
+    Source b{writeWav("b.wav", 2, sine)};
+    auto mixer = assertExpected(av::AudioMixer::create(kChannels, kSampleRate, kFrameSize));
+    const auto res = mix(*mixer, {&a, &b});
+
+    float peak = 0;
+    for (auto& channel : res.channels) {
+        for (const auto v : channel)
+            peak = std::max(peak, std::abs(v));
+    }
+    std::printf("limiter: peak %.4f, %llu frames limited\n", peak, (unsigned long long)mixer->stats().limited);
+    CHECK(peak <= av::AudioMixer::kCeiling + 1e-6f);
+    CHECK(peak > 0.9f);
+    CHECK(mixer->stats().limited > 0);
+}
+}
+
+int main() {
+    char dir[] = "/tmp/mixerXXXXXX";
+    if (!mkdtemp(dir))
+        return kSkipped;
+    directory = dir;
+
+    alignment();
+    stall();
+    limiter();
+
+    std::remove((directory + "/a.wav").c_str());
+    std::remove((directory + "/b.wav").c_str());
+    rmdir(dir);
+    return checkResult();
+}
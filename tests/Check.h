@@ -0,0 +1,45 @@
+#pragma once
+#include <chrono>
+#include <iostream>
+
+/**
+ * Return code of a test the host can't run, ctest reports it as skipped.
+ */
+constexpr int kSkipped = 77;
+
+namespace check {
+inline int failures = 0;
+}
+
+/**
+ * Checks a condition, a failure is reported and the test goes on.
+ */
+#define CHECK(cond)                                                                                      \
+    do {                                                                                                 \
+        if (!(cond)) {                                                                                   \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " << #cond << std::endl;        \
+            check::failures++;                                                                           \
+        }                                                                                                \
+    } while (0)
+
+/**
+ * Gets the exit code of the test.
+ * @return 0 if every check passed.
+ */
+inline int checkResult() {
+    if (check::failures)
+        std::cerr << check::failures << " checks failed" << std::endl;
+    return check::failures ? 1 : 0;
+}
+
+/**
+ * Gets the wall clock time a function takes.
+ * @param f: the function.
+ * @return the time in seconds.
+ */
+template<typename F>
+double timeIt(F&& f) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
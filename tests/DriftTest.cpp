@@ -0,0 +1,100 @@
+/**
+ * Drift compensation of Resample against a skewed sample clock. A 1 kHz tone is captured from a device running
+ * kSkewPpm off the session clock and stamped by that clock, then fed through the drift logic of StreamWriter for
+ * twenty minutes. Once settled the output must stay within a millisecond of the clock, its length must track the
+ * clock and the estimated skew must be the real one. The output frame is reused like StreamWriter does, or
+ * unreferenced before every conversion like AudioMixer does.
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "Check.h"
+#include "../libav-cpp-master/av/Resample.hpp"
+
+namespace {
+constexpr int kSampleRate = 48000;
+constexpr int kChannels = 2;
+constexpr int kFrameSamples = 1024;
+constexpr int kSeconds = 20 * 60;
+constexpr int kSettleSeconds = 60;
+constexpr int64_t kMaxDrift = kSampleRate / 1000;
+constexpr double kSkewPpm = 300;
+
+struct Result
+{
+    int64_t maxDrift; // once settled, in samples
+    int64_t lengthError; // output samples minus clock samples at the end
+    double ppm; // estimated by the resampler
+};
+
+void tone(av::Frame& frame, const int64_t first) {
+    auto samples = reinterpret_cast<int16_t*>(frame.native()->data[0]);
+    for (int i = 0; i < kFrameSamples; i++) {
+        const auto v = (int16_t)(8000 * std::sin(2 * M_PI * 1000 * (first + i) / kSampleRate));
+        for (int c = 0; c < kChannels; c++)
+            samples[i * kChannels + c] = v;
+    }
+}
+
+/**
+ * Records a device whose sample clock is skewPpm off the session clock.
+ * @param unrefOutput: if the output frame is unreferenced before each conversion.
+ * @return the drift measures.
+ */
+Result record(const double skewPpm, const bool unrefOutput) {
+    auto swr = assertExpected(av::Resample::create(kChannels, AV_SAMPLE_FMT_S16, kSampleRate, kChannels, AV_SAMPLE_FMT_FLTP, kSampleRate));
+    av::Frame in, out;
+    auto f = in.native();
+    f->format = AV_SAMPLE_FMT_S16;
+    f->channels = kChannels;
+    f->channel_layout = av_get_default_channel_layout(kChannels);
+    f->sample_rate = kSampleRate;
+    f->nb_samples = kFrameSamples;
+    if (av_frame_get_buffer(f, 0) < 0)
+        std::exit(kSkipped);
+
+    Result res{0, 0, 0};
+    int64_t firstPts = 0, nextPts = 0, pts = 0;
+    const int64_t frames = (int64_t)kSeconds * kSampleRate / kFrameSamples;
+    for (int64_t n = 0; n < frames; n++) {
+        // the device delivers kSampleRate * (1 + skew) samples per second of the session clock
+        const auto captured = n * kFrameSamples;
+        pts = std::llround(captured / (1 + skewPpm * 1e-6));
+        if (n == 0)
+            firstPts = nextPts = pts;
+        else
+            CHECK(swr->compensate(pts - nextPts, nextPts - firstPts));
+        if (pts - firstPts > (int64_t)kSettleSeconds * kSampleRate)
+            res.maxDrift = std::max(res.maxDrift, std::abs(pts - nextPts));
+
+        tone(in, captured);
+        if (unrefOutput)
+            av_frame_unref(out.native());
+        if (!swr->convert(in, out)) {
+            CHECK(!"conversion failed");
+            return res;
+        }
+        nextPts += out.native()->nb_samples;
+    }
+    res.lengthError = nextPts - (pts + std::llround(kFrameSamples / (1 + skewPpm * 1e-6)));
+    res.ppm = swr->drift().ppm;
+    return res;
+}
+
+void checkSkew(const double skewPpm, const bool unrefOutput) {
+    const auto res = record(skewPpm, unrefOutput);
+    std::printf("%+.0f ppm, output %s: max drift %lld samples, length error %lld samples, estimated %+.1f ppm\n", skewPpm,
+                unrefOutput ? "unreferenced" : "reused", (long long)res.maxDrift, (long long)res.lengthError, res.ppm);
+    CHECK(res.maxDrift <= kMaxDrift);
+    CHECK(std::abs(res.lengthError) <= kMaxDrift);
+    // a fast device has samples dropped, so the estimate has the opposite sign of its skew
+    CHECK(std::abs(res.ppm + skewPpm) < 0.05 * std::abs(skewPpm));
+}
+}
+
+int main() {
+    checkSkew(kSkewPpm, false);
+    checkSkew(-kSkewPpm, false);
+    checkSkew(-kSkewPpm, true);
+    return checkResult();
+}
@@ -0,0 +1,65 @@
+/**
+ * Cost of av::Expected returned through three calls, on success and on failure.
+ * A success is a null error pointer: it must not allocate. A failure allocates its error record once and grows the
+ * call stack as it is forwarded.
+ */
+#include <cstdio>
+#include "AllocationCounter.h"
+#include "Check.h"
+#include "../libav-cpp-master/av/common.hpp"
+
+namespace {
+constexpr int kSuccessCalls = 1000000;
+constexpr int kFailureCalls = 100000;
+
+[[gnu::noinline]] av::Expected<int> leaf(const int x) noexcept {
+    if (x < 0)
+        RETURN_AV_ERROR("Negative value {}", x);
+    return x * 2;
+}
+
+[[gnu::noinline]] av::Expected<int> middle(const int x) noexcept {
+    auto res = leaf(x);
+    if (!res)
+        FORWARD_AV_ERROR(res);
+    return res.value() + 1;
+}
+
+[[gnu::noinline]] av::Expected<void> top(const int x) noexcept {
+    auto res = middle(x);
+    if (!res)
+        FORWARD_AV_ERROR(res);
+    return {};
+}
+
+struct Measure
+{
+    double nsPerCall;
+    double allocationsPerCall;
+};
+
+Measure measure(const int calls, const int value) {
+    volatile int input = value;
+    int failed = 0;
+    allocations::Counter counter;
+    const auto seconds = timeIt([&] {
+        for (int i = 0; i < calls; i++)
+            failed += !top(input);
+    });
+    CHECK(failed == (value < 0 ? calls : 0));
+    return {seconds * 1e9 / calls, (double)counter.count() / calls};
+}
+}
+
+int main() {
+    const auto success = measure(kSuccessCalls, 1);
+    const auto failure = measure(kFailureCalls, -1);
+    std::printf("success: %.1f ns, %.2f allocations per call\n", success.nsPerCall, success.allocationsPerCall);
+    std::printf("failure: %.1f ns, %.2f allocations per call\n", failure.nsPerCall, failure.allocationsPerCall);
+
+    CHECK(success.allocationsPerCall == 0);
+    const auto res = top(-1);
+    CHECK(!res && res.stack().size() == 3);
+    CHECK(res.errorDescription() == "Negative value -1");
+    return checkResult();
+}
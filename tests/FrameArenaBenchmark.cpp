@@ -0,0 +1,119 @@
+/**
+ * Page faults and throughput of the conversion for the encoder while a subscriber holds every converted frame, at
+ * 1080p and 4K. Each conversion then needs new planes: StreamWriter takes them from a pool of heap planes or, with
+ * enableFrameArena, from a pool carved from the prefaulted arena. Copying the held frame with av_frame_make_writable
+ * is measured as well. The pooled planes are recycled, so in steady state the conversion into the arena must not
+ * fault at all and never more than the copy.
+ */
+#include <cstdio>
+#include <sys/resource.h>
+#include "Check.h"
+#include "../libav-cpp-master/av/FramePool.hpp"
+#include "../libav-cpp-master/av/Scale.hpp"
+
+namespace {
+constexpr int kWarmupFrames = 10;
+constexpr int kFrames = 200;
+constexpr size_t kArenaFrames = 4;
+
+struct Measure
+{
+    double faultsPerFrame;
+    double fps;
+};
+
+long minorFaults() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+void paint(av::Frame& frame) {
+    auto f = frame.native();
+    for (int y = 0; y < f->height; y++) {
+        auto row = f->data[0] + y * f->linesize[0];
+        for (int x = 0; x < 4 * f->width; x++)
+            row[x] = (uint8_t)(x * 7 + y * 3);
+    }
+}
+
+/**
+ * Converts frames while the previous conversion is still referenced, like the subscribers of the converted frames.
+ * @param renew: gives the destination frame planes of its own before each conversion.
+ * @return the faults and frames per second once warmed up.
+ */
+// gives the destination frame planes of the pool, like StreamWriter does
+auto renewFrom(av::FramePool& pool, av::Frame& spare) {
+    return [&pool, &spare](av::Frame& dst) {
+        auto s = spare.native();
+        s->format = dst.native()->format;
+        s->width = dst.native()->width;
+        s->height = dst.native()->height;
+        if (pool.fill(s)) {
+            av_frame_unref(dst.native());
+            av_frame_move_ref(dst.native(), s);
+        }
+    };
+}
+
+template<typename Renew>
+Measure convert(av::Scale& sws, const av::Frame& src, av::Frame& dst, Renew&& renew) {
+    av::Frame held;
+    auto run = [&](const int frames) {
+        for (int i = 0; i < frames; i++) {
+            held = dst;
+            renew(dst);
+            sws.scale(src, dst);
+        }
+    };
+    run(kWarmupFrames);
+    const auto faults = minorFaults();
+    const auto seconds = timeIt([&] { run(kFrames); });
+    return {(double)(minorFaults() - faults) / kFrames, kFrames / seconds};
+}
+
+bool measure(const int width, const int height) {
+    auto sws = av::Scale::create(width, height, AV_PIX_FMT_BGR0, width, height, AV_PIX_FMT_YUV420P);
+    auto src = av::Frame::create(width, height, AV_PIX_FMT_BGR0);
+    if (!sws || !src)
+        return false;
+    paint(*src.value());
+
+    auto copiedFrame = assertExpected(av::Frame::create(width, height, AV_PIX_FMT_YUV420P));
+    const auto copied = convert(*sws.value(), *src.value(), *copiedFrame, [](av::Frame& dst) {
+        av_frame_make_writable(dst.native());
+    });
+
+    av::Frame spare;
+    auto heapPool = assertExpected(av::FramePool::create(width, height, AV_PIX_FMT_YUV420P, 0));
+    auto heapFrame = assertExpected(av::Frame::create(width, height, AV_PIX_FMT_YUV420P));
+    const auto heap = convert(*sws.value(), *src.value(), *heapFrame, renewFrom(*heapPool, spare));
+
+    const auto frameSize = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, FFALIGN(width, 64), height, 64) + 4096;
+    auto arena = assertExpected(av::FrameArena::create((size_t)frameSize * kArenaFrames));
+    auto pool = assertExpected(av::FramePool::create(width, height, AV_PIX_FMT_YUV420P, 0, arena));
+    av::Frame arenaFrame;
+    auto f = arenaFrame.native();
+    f->format = AV_PIX_FMT_YUV420P;
+    f->width = width;
+    f->height = height;
+    CHECK(pool->fill(f));
+    const auto carved = convert(*sws.value(), *src.value(), arenaFrame, renewFrom(*pool, spare));
+
+    const auto stats = arena->stats();
+    std::printf("%dx%d copy:  %.1f page faults/frame, %.0f fps\n", width, height, copied.faultsPerFrame, copied.fps);
+    std::printf("%dx%d heap:  %.1f page faults/frame, %.0f fps\n", width, height, heap.faultsPerFrame, heap.fps);
+    std::printf("%dx%d arena: %.1f page faults/frame, %.0f fps (backing %d, %llu fallbacks)\n", width, height,
+                carved.faultsPerFrame, carved.fps, (int)stats.backing, (unsigned long long)stats.fallbacks);
+    CHECK(stats.fallbacks == 0);
+    CHECK(carved.faultsPerFrame < 1);
+    CHECK(carved.faultsPerFrame <= copied.faultsPerFrame);
+    return true;
+}
+}
+
+int main() {
+    if (!measure(1920, 1080) || !measure(3840, 2160))
+        return kSkipped;
+    return checkResult();
+}
@@ -0,0 +1,152 @@
+/**
+ * A frame ring read by another process. The test publishes numbered frames into a small ring and execs itself as
+ * a reader of FrameRingWriter::getPath(), which checks that every frame it reads intact has the content and the
+ * timestamp of its number, that the latest frame numbers only go up, and that isValid() rejects a frame whose slot
+ * was written over while it was read, without locking the writer.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "Check.h"
+#include "../include/FrameRing.h"
+
+namespace {
+constexpr int kSlots = 4;
+constexpr int kPlanes = 2;
+constexpr int kRowBytes[kPlanes] = {640, 320};
+constexpr int kLines[kPlanes] = {360, 180};
+constexpr int64_t kFrameDuration = 1000; // microseconds
+constexpr int kReads = 500;
+constexpr int kOverwrites = 20;
+constexpr auto kPublishInterval = std::chrono::microseconds(100);
+constexpr auto kTimeout = std::chrono::seconds(20);
+
+uint8_t pixel(const uint64_t frame, const int plane, const int y, const int x) {
+    return (uint8_t)(frame * 13 + plane * 101 + y * 3 + x);
+}
+
+// the content of a view matches its frame number
+bool matches(const FrameRingView& view) {
+    for (int p = 0; p < kPlanes; p++) {
+        for (int y = 0; y < kLines[p]; y++) {
+            const auto row = view.data[p] + (size_t)y * view.linesize[p];
+            for (int x = 0; x < kRowBytes[p]; x++) {
+                if (row[x] != pixel(view.frame, p, y, x))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Reads the ring of another process.
+ * @return 0 if the ring behaved, 1 otherwise.
+ */
+int reader(const std::string& path) {
+    auto ring = FrameRingReader::open(path);
+    if (!ring)
+        return 1;
+
+    // latest frames, read while the writer goes on
+    uint64_t last = 0;
+    int reads = 0, torn = 0;
+    while (reads < kReads) {
+        FrameRingView view;
+        if (!ring->latest(view))
+            continue;
+        const bool intact = matches(view) && view.pts == (int64_t)view.frame * kFrameDuration;
+        if (!ring->isValid(view)) {
+            torn++;
+            continue;
+        }
+        if (!intact || view.frame < last || view.width != kRowBytes[0] || view.height != kLines[0]) {
+            std::fprintf(stderr, "reader: frame %llu after %llu read intact with the wrong content\n", (unsigned long long)view.frame,
+                         (unsigned long long)last);
+            return 1;
+        }
+        last = view.frame;
+        reads++;
+    }
+
+    // frames held until the writer went around the ring
+    for (int n = 0; n < kOverwrites; n++) {
+        FrameRingView view;
+        while (!ring->latest(view))
+            ;
+        while (ring->getPublished() < view.frame + kSlots)
+            std::this_thread::yield();
+        if (ring->isValid(view) || ring->acquire(view.frame, view)) {
+            std::fprintf(stderr, "reader: overwritten frame %llu taken as valid\n", (unsigned long long)view.frame);
+            return 1;
+        }
+    }
+    std::printf("reader: %d frames read up to frame %llu, %d torn reads rejected, %d overwritten frames rejected\n", reads,
+                (unsigned long long)last, torn, kOverwrites);
+    return 0;
+}
+}
+
+int main(int argc, char* argv[]) {
+    if (argc == 3 && std::string{argv[1]} == "reader")
+        return reader(argv[2]);
+
+    FrameRingFormat format;
+    format.width = kRowBytes[0];
+    format.height = kLines[0];
+    format.pixFmt = 0;
+    format.planes = kPlanes;
+    for (int p = 0; p < kPlanes; p++) {
+        format.rowBytes[p] = kRowBytes[p];
+        format.lines[p] = kLines[p];
+    }
+    auto ring = FrameRingWriter::create("frame-ring-test", kSlots, format);
+    if (!ring)
+        return kSkipped;
+
+    std::vector<uint8_t> planes[kPlanes];
+    for (int p = 0; p < kPlanes; p++)
+        planes[p].resize((size_t)kRowBytes[p] * kLines[p]);
+    const uint8_t* data[kPlanes] = {planes[0].data(), planes[1].data()};
+    const int linesize[kPlanes] = {kRowBytes[0], kRowBytes[1]};
+
+    const auto path = ring->getPath();
+    const auto child = fork();
+    if (child < 0)
+        return kSkipped;
+    if (child == 0) {
+        execl("/proc/self/exe", argv[0], "reader", path.c_str(), (char*)nullptr);
+        _exit(127);
+    }
+
+    // publishes until the reader is done
+    const auto start = std::chrono::steady_clock::now();
+    int status = 0;
+    uint64_t frame = 1;
+    for (; waitpid(child, &status, WNOHANG) == 0; frame++) {
+        if (std::chrono::steady_clock::now() - start > kTimeout) {
+            kill(child, SIGKILL);
+            waitpid(child, &status, 0);
+            std::fprintf(stderr, "reader timed out\n");
+            break;
+        }
+        for (int p = 0; p < kPlanes; p++) {
+            for (int y = 0; y < kLines[p]; y++) {
+                for (int x = 0; x < kRowBytes[p]; x++)
+                    planes[p][(size_t)y * kRowBytes[p] + x] = pixel(frame, p, y, x);
+            }
+        }
+        CHECK(ring->publish(data, linesize, (int64_t)frame * kFrameDuration) == frame);
+        std::this_thread::sleep_for(kPublishInterval);
+    }
+
+    std::printf("writer: %llu frames published\n", (unsigned long long)frame - 1);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    return checkResult();
+}
@@ -0,0 +1,70 @@
+/**
+ * Cost of logging in a light record loop. The loop sums a small tile per frame and logs like the record loops do: a
+ * progress message at most once per second and a debug message on every frame, far more than the sink writes out.
+ * It is timed without any logging statement, with the logger set to Off and with every level enabled. Set to Off,
+ * the level is checked before the message is formatted, so the loop has to run as fast as without logging; the cost
+ * of enabled logging, formatting and the push into the queue, is reported per message.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include "Check.h"
+#include "../libav-cpp-master/av/common.hpp"
+
+namespace {
+constexpr int kFrames = 2000000;
+constexpr size_t kTileBytes = 256;
+constexpr int kRuns = 5;
+
+// the work of a frame, small enough for the logging to be a measurable share of the loop
+template<bool kLog>
+double recordLoop(std::vector<uint8_t>& tile) {
+    int64_t nFrames = 0;
+    volatile uint32_t sink = 0;
+    const auto seconds = timeIt([&] {
+        for (int i = 0; i < kFrames; i++) {
+            tile[i % kTileBytes] = (uint8_t)i;
+            uint32_t sum = 0;
+            for (const auto v : tile)
+                sum += v;
+            sink = sink + sum;
+            nFrames++;
+            if constexpr (kLog) {
+                LOG_AV_DEBUG("Frame {} written, checksum {}", nFrames, sum);
+                LOG_AV_INFO_EVERY(1000, "Wrote {} video frames", nFrames);
+            }
+        }
+    });
+    return seconds / kFrames * 1e9;
+}
+
+// nanoseconds per frame, best of several runs, the host may be busy with something else meanwhile
+template<bool kLog>
+double bestOf(const av::LogLevel level, std::vector<uint8_t>& tile) {
+    av::Logger::instance().setLevel(level);
+    double best = 1e9;
+    for (int run = 0; run < kRuns; run++)
+        best = std::min(best, recordLoop<kLog>(tile));
+    av::Logger::instance().flush();
+    return best;
+}
+}
+
+int main() {
+    // the sink writes somewhere, not into the test log
+    if (!std::freopen("/dev/null", "w", stderr))
+        return kSkipped;
+
+    std::vector<uint8_t> tile(kTileBytes, 1);
+    bestOf<true>(av::LogLevel::Trace, tile); // warm-up
+    const auto none = bestOf<false>(av::LogLevel::Off, tile);
+    const auto off = bestOf<true>(av::LogLevel::Off, tile);
+    const auto enabled = bestOf<true>(av::LogLevel::Trace, tile);
+
+    std::printf("record loop without logging:    %.1f ns per frame\n", none);
+    std::printf("record loop, logging set to Off: %.1f ns per frame (%+.1f%%)\n", off, 100.0 * (off - none) / none);
+    std::printf("record loop, logging enabled:    %.1f ns per frame, %.1f ns per message, %llu messages dropped\n", enabled,
+                enabled - none, (unsigned long long)av::Logger::instance().dropped());
+    CHECK(off <= 1.1 * none);
+    return checkResult();
+}
@@ -0,0 +1,106 @@
+/**
+ * CPU time per captured frame of the raw x11grab packets wrapped as frames (Decoder::wrapRawPacket) against the
+ * rawvideo decoder round trip they replaced, at 1080p and 4K. The packets are refcounted BGR0 images like the
+ * grabber's, which the decoder references too: the difference is the send/receive machinery of every frame.
+ */
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include "Check.h"
+#include "../libav-cpp-master/av/Decoder.hpp"
+
+namespace {
+constexpr int kFrames = 20000;
+
+double cpuSeconds() {
+    timespec ts{};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Runs the reads of all the frames.
+ * @param read: reads frame n from a new reference to the grabbed packet.
+ * @return the CPU seconds per frame, negative if a read failed.
+ */
+template<typename Read>
+double cpuPerFrame(Read&& read) {
+    const auto start = cpuSeconds();
+    for (int n = 0; n < kFrames; n++) {
+        if (!read(n))
+            return -1;
+    }
+    return (cpuSeconds() - start) / kFrames;
+}
+
+bool samePixels(const AVFrame* a, const AVFrame* b) {
+    if (a->format != b->format || a->width != b->width || a->height != b->height)
+        return false;
+    for (int y = 0; y < a->height; y++) {
+        if (std::memcmp(a->data[0] + y * a->linesize[0], b->data[0] + y * b->linesize[0], 4 * a->width))
+            return false;
+    }
+    return true;
+}
+
+bool measure(const int width, const int height) {
+    // the grabbed stream, only its parameters are used
+    std::unique_ptr<AVFormatContext, void (*)(AVFormatContext*)> input{avformat_alloc_context(), avformat_free_context};
+    const auto stream = input ? avformat_new_stream(input.get(), nullptr) : nullptr;
+    const auto codec = avcodec_find_decoder(AV_CODEC_ID_RAWVIDEO);
+    if (!stream || !codec)
+        return false;
+    const auto codecpar = stream->codecpar;
+    codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    codecpar->codec_id = AV_CODEC_ID_RAWVIDEO;
+    codecpar->format = AV_PIX_FMT_BGR0;
+    codecpar->width = width;
+    codecpar->height = height;
+    stream->time_base = AV_TIME_BASE_Q;
+    auto decoder = assertExpected(av::Decoder::create(codec, stream, {30, 1}));
+
+    av::Packet grabbed, packet;
+    const auto size = av_image_get_buffer_size(AV_PIX_FMT_BGR0, width, height, 1);
+    if (av_new_packet(grabbed.native(), size) < 0)
+        return false;
+    for (int i = 0; i < size; i++)
+        grabbed.native()->data[i] = (uint8_t)(i * 13);
+
+    av::Frame wrapped, decoded;
+    auto wrap = [&](const int n) {
+        av_packet_ref(packet.native(), grabbed.native());
+        packet.native()->pts = n;
+        av_frame_unref(wrapped.native());
+        const bool ok = av::Decoder::wrapRawPacket(codecpar, packet, wrapped);
+        packet.dataUnref();
+        return ok;
+    };
+    auto decode = [&](const int n) {
+        av_packet_ref(packet.native(), grabbed.native());
+        packet.native()->pts = n;
+        av_frame_unref(decoded.native());
+        auto res = decoder->decode(packet, decoded);
+        packet.dataUnref();
+        return res && res.value() == av::Result::kSuccess;
+    };
+
+    CHECK(wrap(0) && decode(0));
+    CHECK(samePixels(wrapped.native(), decoded.native()));
+    CHECK(wrapped.native()->data[0] == grabbed.native()->data);
+
+    const auto decodeCpu = cpuPerFrame(decode);
+    const auto wrapCpu = cpuPerFrame(wrap);
+    std::printf("%dx%d decode: %.2f us CPU/frame\n", width, height, decodeCpu * 1e6);
+    std::printf("%dx%d wrap:   %.2f us CPU/frame\n", width, height, wrapCpu * 1e6);
+    CHECK(decodeCpu > 0 && wrapCpu > 0);
+    CHECK(wrapCpu < decodeCpu);
+    return true;
+}
+}
+
+int main() {
+    if (!measure(1920, 1080) || !measure(3840, 2160))
+        return kSkipped;
+    return checkResult();
+}
@@ -0,0 +1,196 @@
+/**
+ * Bitrate, encode time and quality of a 720p H.264 recording of a scripted screen, with and without the change
+ * regions of StreamWriter::enableChangeRegions. The scene is a static desktop with a scrolling terminal and a playing
+ * video in two windows. The quality is the PSNR of the decoded luma against the frames handed to the encoder, over
+ * the two windows and over the rest of the screen. The regions are meant to buy quality where the screen moves, which
+ * is checked; what they cost in bits and time is reported only.
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "Check.h"
+#include "../libav-cpp-master/av/StreamWriter.hpp"
+
+namespace {
+constexpr int kWidth = 1280;
+constexpr int kHeight = 720;
+constexpr int kFps = 30;
+constexpr int kFrames = 150;
+
+/**
+ * A window of the scene, in pixels.
+ */
+struct Window
+{
+    int x, y, width, height;
+
+    bool contains(const int px, const int py) const {
+        return px >= x && px < x + width && py >= y && py < y + height;
+    }
+};
+
+constexpr Window kTerminal = {64, 64, 512, 320};
+constexpr Window kPlayer = {720, 360, 448, 256};
+
+std::string filename;
+
+// the desktop, the terminal scrolled by one line of text per frame and the player's moving picture
+void drawScene(av::Frame& frame, const int n) {
+    auto f = frame.native();
+    for (int y = 0; y < kHeight; y++) {
+        auto row = reinterpret_cast<uint32_t*>(f->data[0] + y * f->linesize[0]);
+        for (int x = 0; x < kWidth; x++) {
+            uint32_t v = 0x203040 + ((x / 8 + y / 8) % 2) * 0x080808;
+            if (kTerminal.contains(x, y)) {
+                // lines of 16 pixels with glyph-like bits, scrolled up by a line each frame
+                const int line = (y - kTerminal.y) / 16 + n;
+                const int glyph = (x - kTerminal.x) / 8;
+                const bool ink = ((line * 31 + glyph * 17) % 7 < 3) && ((x + y) % 3 != 0) && (y - kTerminal.y) % 16 < 12;
+                v = ink ? 0xd0d0d0 : 0x101010;
+            } else if (kPlayer.contains(x, y)) {
+                const double t = n / (double)kFps;
+                const auto r = (uint32_t)(128 + 127 * std::sin(x * 0.05 + t * 3));
+                const auto g = (uint32_t)(128 + 127 * std::sin(y * 0.07 - t * 2));
+                const auto b = (uint32_t)(128 + 127 * std::sin((x + y) * 0.03 + t * 5));
+                v = (r << 16) | (g << 8) | b;
+            }
+            row[x] = v;
+        }
+    }
+}
+
+/**
+ * The outcome of a recording.
+ */
+struct Result
+{
+    double kbps = 0;
+    double msPerFrame = 0;
+    double activePsnr = 0; // over the windows
+    double staticPsnr = 0; // over the rest of the screen
+};
+
+// PSNR of squared errors summed over a number of pixels
+double psnr(const double squaredErrors, const double pixels) {
+    return squaredErrors > 0 ? 10 * std::log10(255.0 * 255.0 * pixels / squaredErrors) : 99;
+}
+
+/**
+ * Decodes the recording and compares its luma with the frames the encoder was given.
+ * @return false if it can't be decoded.
+ */
+bool compare(const std::vector<std::vector<uint8_t>>& encoded, Result& res) {
+    AVFormatContext* input = nullptr;
+    if (avformat_open_input(&input, filename.c_str(), nullptr, nullptr) < 0)
+        return false;
+    AVCodec* codec = nullptr;
+    const int index = avformat_find_stream_info(input, nullptr) < 0 ? -1 : av_find_best_stream(input, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    AVCodecContext* ctx = index < 0 ? nullptr : avcodec_alloc_context3(codec);
+    if (!ctx || avcodec_parameters_to_context(ctx, input->streams[index]->codecpar) < 0 || avcodec_open2(ctx, codec, nullptr) < 0) {
+        avcodec_free_context(&ctx);
+        avformat_close_input(&input);
+        return false;
+    }
+
+    double active = 0, rest = 0;
+    size_t decoded = 0;
+    AVPacket* pkt = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    auto receive = [&] {
+        while (avcodec_receive_frame(ctx, frame) >= 0) {
+            if (decoded < encoded.size()) {
+                const auto& reference = encoded[decoded];
+                for (int y = 0; y < kHeight; y++) {
+                    for (int x = 0; x < kWidth; x++) {
+                        const double d = (int)frame->data[0][y * frame->linesize[0] + x] - reference[y * kWidth + x];
+                        (kTerminal.contains(x, y) || kPlayer.contains(x, y) ? active : rest) += d * d;
+                    }
+                }
+            }
+            decoded++;
+            av_frame_unref(frame);
+        }
+    };
+    while (av_read_frame(input, pkt) >= 0) {
+        if (pkt->stream_index == index && avcodec_send_packet(ctx, pkt) >= 0)
+            receive();
+        av_packet_unref(pkt);
+    }
+    avcodec_send_packet(ctx, nullptr);
+    receive();
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    avcodec_free_context(&ctx);
+    avformat_close_input(&input);
+
+    const double activePixels = (double)decoded * (kTerminal.width * kTerminal.height + kPlayer.width * kPlayer.height);
+    res.activePsnr = psnr(active, activePixels);
+    res.staticPsnr = psnr(rest, (double)decoded * kWidth * kHeight - activePixels);
+    return decoded == encoded.size();
+}
+
+/**
+ * Records the scene.
+ * @param regions: if the changed tiles are passed to the encoder.
+ */
+Result record(const std::vector<std::shared_ptr<av::Frame>>& scene, const bool regions) {
+    std::vector<std::vector<uint8_t>> encoded;
+    Result res;
+    {
+        auto writer = assertExpected(av::StreamWriter::create(filename));
+        const auto index = assertExpected(writer->addVideoStream(AV_CODEC_ID_H264, kWidth, kHeight, AV_PIX_FMT_BGR0, {1, kFps},
+                                                                 {{"preset", "medium"}}));
+        if (regions)
+            assertExpected(writer->enableChangeRegions(index));
+        assertExpected(writer->setFrameCallback(index, [&encoded](const av::Frame& frame) {
+            auto f = frame.native();
+            std::vector<uint8_t> luma((size_t)kWidth * kHeight);
+            for (int y = 0; y < kHeight; y++)
+                std::memcpy(luma.data() + (size_t)y * kWidth, f->data[0] + y * f->linesize[0], kWidth);
+            encoded.push_back(std::move(luma));
+        }));
+        assertExpected(writer->open());
+
+        const auto seconds = timeIt([&] {
+            for (auto& frame : scene)
+                CHECK(writer->write(*frame, index));
+            writer->flushAllStreams();
+        });
+        res.msPerFrame = seconds * 1000 / kFrames;
+    }
+
+    struct stat st{};
+    stat(filename.c_str(), &st);
+    res.kbps = st.st_size * 8.0 / 1000 / ((double)kFrames / kFps);
+    CHECK(compare(encoded, res));
+    std::remove(filename.c_str());
+    return res;
+}
+}
+
+int main() {
+    char dir[] = "/tmp/roiXXXXXX";
+    if (!avcodec_find_encoder_by_name("libx264") || !avcodec_find_decoder(AV_CODEC_ID_H264) || !mkdtemp(dir))
+        return kSkipped;
+    filename = std::string{dir} + "/roi.mp4";
+
+    std::vector<std::shared_ptr<av::Frame>> scene;
+    for (int n = 0; n < kFrames; n++) {
+        scene.push_back(assertExpected(av::Frame::create(kWidth, kHeight, AV_PIX_FMT_BGR0)));
+        drawScene(*scene.back(), n);
+    }
+
+    const auto plain = record(scene, false);
+    const auto roi = record(scene, true);
+    rmdir(dir);
+
+    for (const auto& [name, res] : {std::pair{"without regions", plain}, std::pair{"with regions", roi}})
+        std::printf("%s: %.0f kbit/s, %.2f ms per frame, PSNR %.2f dB in the windows, %.2f dB elsewhere\n", name, res.kbps,
+                    res.msPerFrame, res.activePsnr, res.staticPsnr);
+    CHECK(roi.activePsnr > plain.activePsnr);
+    return checkResult();
+}
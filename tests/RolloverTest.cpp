@@ -0,0 +1,261 @@
+/**
+ * StreamWriter::rollover with an MPEG-4 or H.264 video and an AAC audio stream written with capture timestamps.
+ * Checks that the two files hold every packet of the same recording written to one file, also with the seconds of
+ * video an H.264 encoder holds back, that the second one starts with a key frame and its audio within a frame of its
+ * video, that a stalled audio or video stream doesn't keep the first file open past the deadline, and that a flush
+ * right after the rollover finishes the first file.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "Check.h"
+#include "../libav-cpp-master/av/StreamWriter.hpp"
+
+namespace {
+constexpr int kWidth = 320;
+constexpr int kHeight = 240;
+constexpr int kSampleRate = 48000;
+constexpr int kChannels = 2;
+constexpr int kFrameSamples = 1024;
+constexpr int64_t kSecond = AV_TIME_BASE;
+
+struct VideoCodec
+{
+    const char* name;
+    int fps;
+};
+constexpr VideoCodec kMpeg4 = {"mpeg4", 25};
+// the defaults of libx264, preset medium: 40 frames of lookahead and B-frames, close to 3 s held back at 15 fps
+constexpr VideoCodec kX264 = {"libx264", 15};
+
+std::string directory;
+std::vector<std::string> files;
+
+std::string path(const std::string& name) {
+    const auto res = directory + "/" + name;
+    files.push_back(res);
+    return res;
+}
+
+/**
+ * Packets of a file, per stream type.
+ */
+struct Content
+{
+    struct Track
+    {
+        int packets = 0;
+        double firstTime = 0; // seconds
+        bool firstKey = false;
+    };
+    Track video, audio;
+    bool opened = false;
+
+    explicit Content(const std::string& filename) {
+        AVFormatContext* input = nullptr;
+        if (avformat_open_input(&input, filename.c_str(), nullptr, nullptr) < 0)
+            return;
+        opened = avformat_find_stream_info(input, nullptr) >= 0;
+        AVPacket* pkt = av_packet_alloc();
+        while (opened && av_read_frame(input, pkt) >= 0) {
+            const auto stream = input->streams[pkt->stream_index];
+            auto& track = stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO ? video : audio;
+            if (!track.packets++) {
+                track.firstTime = pkt->pts * av_q2d(stream->time_base);
+                track.firstKey = pkt->flags & AV_PKT_FLAG_KEY;
+            }
+            av_packet_unref(pkt);
+        }
+        av_packet_free(&pkt);
+        avformat_close_input(&input);
+    }
+};
+
+/**
+ * A recording: moving video and a tone, written in capture order with timestamps in AV_TIME_BASE.
+ */
+class Recording
+{
+    std::shared_ptr<av::Frame> picture;
+    av::Frame samples;
+    int fps;
+    int video = -1;
+    int audio = -1;
+    int64_t videoFrames = 0;
+    int64_t audioSamples = 0;
+public:
+    std::shared_ptr<av::StreamWriter> writer;
+
+    explicit Recording(const std::string& filename, const VideoCodec codec = kMpeg4) : fps(codec.fps) {
+        writer = assertExpected(av::StreamWriter::create(filename, true));
+        video = assertExpected(writer->addVideoStream(std::string_view{codec.name}, kWidth, kHeight, AV_PIX_FMT_BGR0, {1, fps}));
+        audio = assertExpected(writer->addAudioStream(AV_CODEC_ID_AAC, kChannels, AV_SAMPLE_FMT_S16, kSampleRate, kChannels, kSampleRate, 128000));
+        assertExpected(writer->open());
+        picture = assertExpected(av::Frame::create(kWidth, kHeight, AV_PIX_FMT_BGR0));
+        auto f = samples.native();
+        f->format = AV_SAMPLE_FMT_S16;
+        f->channels = kChannels;
+        f->channel_layout = av_get_default_channel_layout(kChannels);
+        f->sample_rate = kSampleRate;
+        f->nb_samples = kFrameSamples;
+        if (av_frame_get_buffer(f, 0) < 0)
+            std::exit(kSkipped);
+    }
+
+    int64_t videoTime() const {
+        return videoFrames * kSecond / fps;
+    }
+
+    int64_t audioTime() const {
+        return audioSamples * kSecond / kSampleRate;
+    }
+
+    /**
+     * Writes the frames captured before a time.
+     * @param withAudio: false for a stalled audio device, its samples of the span are lost.
+     * @param withVideo: false for a stalled video device, its frames of the span are lost.
+     */
+    void until(const int64_t time, const bool withAudio = true, const bool withVideo = true) {
+        while ((withVideo && videoTime() < time) || (withAudio && audioTime() < time)) {
+            if (withVideo && videoTime() < time && (!withAudio || audioTime() >= time || videoTime() <= audioTime())) {
+                auto f = picture->native();
+                for (int y = 0; y < kHeight; y++)
+                    std::fill_n(f->data[0] + y * f->linesize[0], 4 * kWidth, (uint8_t)(y + videoFrames * 3));
+                f->pts = videoTime();
+                CHECK(writer->write(*picture, video, AV_TIME_BASE_Q));
+                videoFrames++;
+                continue;
+            }
+            auto data = reinterpret_cast<int16_t*>(samples.native()->data[0]);
+            for (int i = 0; i < kFrameSamples * kChannels; i++)
+                data[i] = (int16_t)(4000 * std::sin(2 * M_PI * 440 * (audioSamples + i / kChannels) / kSampleRate));
+            samples.native()->pts = audioTime();
+            CHECK(writer->write(samples, audio, AV_TIME_BASE_Q));
+            audioSamples += kFrameSamples;
+        }
+        if (!withAudio)
+            audioSamples = (time * kSampleRate + kSecond - 1) / kSecond;
+        if (!withVideo)
+            videoFrames = (time * fps + kSecond - 1) / kSecond;
+    }
+};
+
+// the two files hold the packets of one, the second starts decodable and in sync
+void noGap(const VideoCodec codec) {
+    const std::string prefix = codec.name;
+    const auto whole = path(prefix + "-whole.mkv");
+    {
+        Recording recording{whole, codec};
+        recording.until(4 * kSecond);
+        recording.writer->flushAllStreams();
+    }
+    const auto first = path(prefix + "-first.mkv");
+    const auto second = path(prefix + "-second.mkv");
+    {
+        Recording recording{first, codec};
+        recording.until(2 * kSecond);
+        CHECK(recording.writer->rollover(second, 2 * kSecond));
+        recording.until(4 * kSecond);
+        recording.writer->flushAllStreams();
+    }
+
+    const Content reference{whole}, a{first}, b{second};
+    std::printf("no gap, %s: video %d + %d of %d packets, audio %d + %d of %d, second file audio at %+.4f s of its video\n",
+                codec.name, a.video.packets, b.video.packets, reference.video.packets, a.audio.packets, b.audio.packets, reference.audio.packets,
+                b.audio.firstTime - b.video.firstTime);
+    CHECK(a.video.packets == 2 * codec.fps);
+    CHECK(a.video.packets + b.video.packets == reference.video.packets);
+    CHECK(a.audio.packets + b.audio.packets == reference.audio.packets);
+    CHECK(b.video.firstKey);
+    CHECK(std::abs(b.audio.firstTime - b.video.firstTime) <= 2.0 * kFrameSamples / kSampleRate);
+}
+
+// audio stalls across the rollover: the first file is finished at the deadline, the next rollover is taken
+void stalledStream() {
+    const auto first = path("stalled1.mkv");
+    const auto second = path("stalled2.mkv");
+    const auto third = path("stalled3.mkv");
+    Recording recording{first};
+    recording.until(2 * kSecond);
+    CHECK(recording.writer->rollover(second, 2 * kSecond));
+    recording.until(5 * kSecond, false);
+    const bool taken = (bool)recording.writer->rollover(third, 5 * kSecond);
+    recording.until(6 * kSecond);
+    recording.writer->flushAllStreams();
+    recording.writer.reset();
+
+    const Content a{first}, b{second}, c{third};
+    std::printf("stalled: next rollover %s, video %d + %d + %d packets\n", taken ? "taken" : "refused", a.video.packets,
+                b.video.packets, c.video.packets);
+    CHECK(taken);
+    CHECK(a.video.packets == 2 * kMpeg4.fps);
+    CHECK(a.video.packets + b.video.packets + c.video.packets == 6 * kMpeg4.fps);
+    CHECK(b.video.firstKey && c.video.firstKey);
+}
+
+// video stalls across the rollover while its encoder holds back the end of the first file: the stream is moved at
+// the deadline, its late packets of the first file are dropped and the second file starts with the IDR of its next frame
+void stalledVideo() {
+    const auto first = path("stalledvideo1.mkv");
+    const auto second = path("stalledvideo2.mkv");
+    Recording recording{first, kX264};
+    recording.until(2 * kSecond);
+    CHECK(recording.writer->rollover(second, 2 * kSecond));
+    recording.until(5 * kSecond, true, false);
+    recording.until(7 * kSecond);
+    recording.writer->flushAllStreams();
+    recording.writer.reset();
+
+    const Content a{first}, b{second};
+    std::printf("stalled video: %d + %d packets, second file %s\n", a.video.packets, b.video.packets,
+                b.video.firstKey ? "starts with a key frame" : "starts without a key frame");
+    CHECK(a.video.packets <= 2 * kX264.fps);
+    CHECK(b.video.packets == 2 * kX264.fps);
+    CHECK(b.video.firstKey);
+    CHECK(b.audio.packets > 0);
+}
+
+// flushed before any stream got to the rollover point, the first file is finished with everything
+void flushBeforeSwitch() {
+    const auto first = path("flushed1.mkv");
+    const auto second = path("flushed2.mkv");
+    const auto third = path("flushed3.mkv");
+    Recording recording{first};
+    recording.until(2 * kSecond);
+    CHECK(recording.writer->rollover(second, 3 * kSecond));
+    recording.writer->flushAllStreams();
+    // taken: the flush left no rollover pending
+    CHECK(recording.writer->rollover(third, 3 * kSecond));
+    recording.writer.reset();
+
+    const Content a{first}, b{second};
+    std::printf("flushed: video %d packets, second file %s\n", a.video.packets, b.opened ? "opened" : "unreadable");
+    CHECK(a.video.packets == 2 * kMpeg4.fps);
+    CHECK(a.audio.packets > 0);
+    CHECK(b.opened);
+}
+}
+
+int main() {
+    char dir[] = "/tmp/rolloverXXXXXX";
+    if (!avcodec_find_encoder(AV_CODEC_ID_MPEG4) || !avcodec_find_encoder(AV_CODEC_ID_AAC) || !mkdtemp(dir))
+        return kSkipped;
+    directory = dir;
+
+    noGap(kMpeg4);
+    stalledStream();
+    flushBeforeSwitch();
+    if (avcodec_find_encoder_by_name(kX264.name)) {
+        noGap(kX264);
+        stalledVideo();
+    }
+
+    for (auto& file : files)
+        std::remove(file.c_str());
+    rmdir(dir);
+    return checkResult();
+}
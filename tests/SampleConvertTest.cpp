@@ -0,0 +1,141 @@
+/**
+ * The format only audio conversions of SampleConvert.hpp against swr_convert, for every pair of s16/flt, interleaved
+ * or planar, in 1, 2 and 6 channels: the output must be bit exact. The float inputs include full scale, the values
+ * clipped beyond it and the halves the rounding decides on. They stay far below 65536.0, which overflows the 32 bit
+ * integers of the swr SIMD conversion once scaled. Then the samples per second of both for stereo capture frames,
+ * reported only.
+ */
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <vector>
+#include "Check.h"
+#include "../libav-cpp-master/av/SampleConvert.hpp"
+
+namespace {
+constexpr int kSamples = 1027; // not a multiple of the SIMD width, the tails are converted too
+constexpr int kFrameSamples = 1024;
+constexpr int kFrames = 20000;
+constexpr AVSampleFormat kFormats[] = {AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_FLT, AV_SAMPLE_FMT_FLTP};
+constexpr int kChannels[] = {1, 2, 6};
+
+const float kFloatValues[] = {0.0f, -0.0f, 1.0f, -1.0f, 1.5f, -1.5f, 2.0f, -2.0f, 100.0f, -100.0f, 1.99f, -1.99f,
+                              32767.0f / 32768, 32767.5f / 32768, -32768.5f / 32768, 0.5f / 32768, -0.5f / 32768,
+                              1.5f / 32768, -1.5f / 32768, 2.5f / 32768, -2.5f / 32768, 1e-9f, -1e-9f};
+const int16_t kS16Values[] = {0, 1, -1, 32767, -32768, 16384, -16385, 255, -256};
+
+/**
+ * Sample planes of a format, as in AVFrame::extended_data.
+ */
+struct Samples
+{
+    AVSampleFormat format;
+    int channels;
+    int count;
+    std::vector<std::vector<uint8_t>> planes;
+    std::vector<uint8_t*> data;
+
+    Samples(const AVSampleFormat format, const int channels, const int count) : format(format), channels(channels), count(count) {
+        const bool planar = av_sample_fmt_is_planar(format);
+        const auto bytes = (size_t)count * av_get_bytes_per_sample(format) * (planar ? 1 : channels);
+        planes.resize(planar ? channels : 1, std::vector<uint8_t>(bytes + 64));
+        for (auto& plane : planes)
+            data.push_back(plane.data());
+    }
+
+    size_t bytes() const {
+        return (size_t)count * av_get_bytes_per_sample(format) * (av_sample_fmt_is_planar(format) ? 1 : channels);
+    }
+
+    template<typename T>
+    T& at(const int i, const int c) {
+        return av_sample_fmt_is_planar(format) ? reinterpret_cast<T*>(data[c])[i] : reinterpret_cast<T*>(data[0])[i * channels + c];
+    }
+
+    bool operator==(const Samples& other) const {
+        for (size_t p = 0; p < planes.size(); p++) {
+            if (std::memcmp(planes[p].data(), other.planes[p].data(), bytes()))
+                return false;
+        }
+        return true;
+    }
+};
+
+// the special values first, then noise a little beyond full scale
+void fill(Samples& samples) {
+    uint32_t seed = 12345;
+    const bool isFloat = av_get_packed_sample_fmt(samples.format) == AV_SAMPLE_FMT_FLT;
+    const int specials = isFloat ? std::size(kFloatValues) : std::size(kS16Values);
+    for (int i = 0; i < samples.count; i++) {
+        for (int c = 0; c < samples.channels; c++) {
+            seed = seed * 1664525 + 1013904223;
+            const auto noise = (int16_t)(seed >> 16);
+            if (isFloat)
+                samples.at<float>(i, c) = i < specials ? kFloatValues[(i + c) % specials] : noise * (1.25f / 32768);
+            else
+                samples.at<int16_t>(i, c) = i < specials ? kS16Values[(i + c) % specials] : noise;
+        }
+    }
+}
+
+SwrContext* createSwr(const AVSampleFormat in, const AVSampleFormat out, const int channels) {
+    const auto layout = av_get_default_channel_layout(channels);
+    auto swr = swr_alloc_set_opts(nullptr, layout, out, 48000, layout, in, 48000, 0, nullptr);
+    if (swr && swr_init(swr) < 0)
+        swr_free(&swr);
+    return swr;
+}
+
+bool compare(const AVSampleFormat inFmt, const AVSampleFormat outFmt, const int channels) {
+    auto swr = createSwr(inFmt, outFmt, channels);
+    if (!swr)
+        return false;
+    Samples in{inFmt, channels, kSamples}, expected{outFmt, channels, kSamples}, converted{outFmt, channels, kSamples};
+    fill(in);
+    const int done = swr_convert(swr, expected.data.data(), kSamples, const_cast<const uint8_t**>(in.data.data()), kSamples);
+    swr_free(&swr);
+    av::simd::convert(in.data.data(), inFmt, converted.data.data(), outFmt, kSamples, channels);
+
+    CHECK(done == kSamples);
+    const bool same = converted == expected;
+    if (!same)
+        std::fprintf(stderr, "%s -> %s, %d channels: not bit exact with swr\n", av_get_sample_fmt_name(inFmt), av_get_sample_fmt_name(outFmt), channels);
+    CHECK(same);
+    return true;
+}
+
+void throughput(const AVSampleFormat inFmt, const AVSampleFormat outFmt) {
+    auto swr = createSwr(inFmt, outFmt, 2);
+    if (!swr)
+        return;
+    Samples in{inFmt, 2, kFrameSamples}, out{outFmt, 2, kFrameSamples};
+    fill(in);
+    const auto swrSeconds = timeIt([&] {
+        for (int i = 0; i < kFrames; i++)
+            swr_convert(swr, out.data.data(), kFrameSamples, const_cast<const uint8_t**>(in.data.data()), kFrameSamples);
+    });
+    swr_free(&swr);
+    const auto kernelSeconds = timeIt([&] {
+        for (int i = 0; i < kFrames; i++)
+            av::simd::convert(in.data.data(), inFmt, out.data.data(), outFmt, kFrameSamples, 2);
+    });
+    const double samples = (double)kFrames * kFrameSamples;
+    std::printf("%s -> %s stereo: swr %.0f Msamples/s, kernels %.0f Msamples/s\n", av_get_sample_fmt_name(inFmt), av_get_sample_fmt_name(outFmt),
+                samples / swrSeconds / 1e6, samples / kernelSeconds / 1e6);
+}
+}
+
+int main() {
+    for (const auto channels : kChannels) {
+        for (const auto in : kFormats) {
+            for (const auto out : kFormats) {
+                if (!compare(in, out, channels))
+                    return kSkipped;
+            }
+        }
+    }
+    throughput(AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_FLTP);
+    throughput(AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16);
+    throughput(AV_SAMPLE_FMT_FLT, AV_SAMPLE_FMT_FLTP);
+    return checkResult();
+}
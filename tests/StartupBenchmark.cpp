@@ -0,0 +1,88 @@
+/**
+ * Time from ScreenRecorder::set() to the first video frame written, with fast open against the probing open, on
+ * the display of the host (skipped without one). The first session of the process also pays for the device
+ * registration and the codec lookups; the target of fast open, under 100 ms, is checked on the median of the
+ * sessions after it. Video only, the audio devices of a test host are not predictable.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Check.h"
+#include "../include/ScreenRecorder.h"
+
+namespace {
+constexpr int kSessions = 5;
+constexpr double kTargetMs = 100;
+constexpr auto kFirstFrameTimeout = std::chrono::seconds(2);
+
+/**
+ * Records a session until its first video frame is written.
+ * @return set() to first frame in milliseconds, negative if the session could not start.
+ */
+double startup(ScreenRecorder& recorder) {
+    const auto start = std::chrono::steady_clock::now();
+    if (!recorder.set(false))
+        return -1;
+    recorder.start();
+    while (recorder.getStartupTiming().firstFrameMs <= 0) {
+        if (std::chrono::steady_clock::now() - start > kFirstFrameTimeout) {
+            recorder.stop();
+            return -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    recorder.stop();
+    const auto timing = recorder.getStartupTiming();
+    return timing.openMs + timing.firstFrameMs;
+}
+
+/**
+ * Opens sessions one after the other.
+ * @return the first session and the median of the others, negative if one failed.
+ */
+std::pair<double, double> sessions(const bool fastOpen) {
+    ScreenRecorder recorder;
+    recorder.setFastOpen(fastOpen);
+    std::vector<double> times;
+    for (int i = 0; i < kSessions; i++) {
+        const auto ms = startup(recorder);
+        if (ms < 0)
+            return {-1, -1};
+        times.push_back(ms);
+    }
+    std::sort(times.begin() + 1, times.end());
+    return {times[0], times[1 + (kSessions - 1) / 2]};
+}
+}
+
+int main() {
+    if (!std::getenv("DISPLAY"))
+        return kSkipped;
+    // the recorder writes ../media/output.mp4
+    char dir[] = "/tmp/startupXXXXXX";
+    if (!mkdtemp(dir))
+        return kSkipped;
+    const std::string root = dir;
+    if (mkdir((root + "/media").c_str(), 0700) || mkdir((root + "/run").c_str(), 0700) || chdir((root + "/run").c_str()))
+        return kSkipped;
+
+    const auto fast = sessions(true);
+    const auto probing = sessions(false);
+    std::remove("../media/output.mp4");
+    rmdir((root + "/media").c_str());
+    rmdir((root + "/run").c_str());
+    rmdir(dir);
+    if (fast.first < 0 || probing.first < 0)
+        return kSkipped;
+
+    std::printf("fast open: first session %.1f ms, then %.1f ms\n", fast.first, fast.second);
+    std::printf("probing open: %.1f ms\n", probing.second);
+    CHECK(fast.second < kTargetMs);
+    return checkResult();
+}
@@ -0,0 +1,168 @@
+/**
+ * The capture to mux path in steady state, with every heap allocation of the process counted (see
+ * AllocationCounter.h). Raw BGR0 packets like the grabber's are wrapped as frames (Decoder::wrapRawPacket, as
+ * VideoInput::readFrame does) and written with their microsecond timestamps to an H.264 stream muxed into MP4, on the
+ * calling thread and through an encoder thread. libavcodec and libavformat allocate for every frame and packet
+ * themselves, the reference avcodec_send_frame() takes and the side data of the packets for instance, so the writer
+ * is checked against the same encoder and muxer fed the converted frames directly: nothing on top of them is allowed.
+ */
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "AllocationCounter.h"
+#include "Check.h"
+#include "../libav-cpp-master/av/Decoder.hpp"
+#include "../libav-cpp-master/av/StreamWriter.hpp"
+
+namespace {
+constexpr int kWidth = 320;
+constexpr int kHeight = 192;
+constexpr int kFps = 30;
+constexpr int64_t kFrameUs = 33333;
+constexpr int kPatterns = 8; // grabbed images the packets take turns on
+constexpr int kWarmupFrames = 200;
+constexpr int kFrames = 1000;
+// the clock and the packet payloads of a variable frame rate writer stream
+constexpr AVRational kVideoClock = {1, 90000};
+constexpr int kPacketPoolShare = 8;
+
+std::string filename;
+
+void paint(uint8_t* data, const int linesize, const int n) {
+    for (int y = 0; y < kHeight; y++) {
+        auto row = data + y * linesize;
+        for (int x = 0; x < kWidth; x++) {
+            row[4 * x] = (uint8_t)(x + 3 * n);
+            row[4 * x + 1] = (uint8_t)(y + 2 * n);
+            row[4 * x + 2] = (uint8_t)(x ^ y);
+            row[4 * x + 3] = 0;
+        }
+    }
+}
+
+/**
+ * The grabbed packets of a recording: refcounted images reused like the grabber's buffers, stamped in microseconds.
+ * Their references are made up front, the counted frames only take them over.
+ */
+struct Grabbed
+{
+    AVCodecParameters* codecpar = avcodec_parameters_alloc();
+    std::vector<av::Packet> images = std::vector<av::Packet>(kPatterns);
+    std::vector<av::Packet> packets = std::vector<av::Packet>(kWarmupFrames + kFrames);
+
+    Grabbed() {
+        codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+        codecpar->codec_id = AV_CODEC_ID_RAWVIDEO;
+        codecpar->format = AV_PIX_FMT_BGR0;
+        codecpar->width = kWidth;
+        codecpar->height = kHeight;
+        for (int i = 0; i < kPatterns; i++) {
+            CHECK(av_new_packet(images[i].native(), kWidth * kHeight * 4) >= 0);
+            paint(images[i].native()->data, 4 * kWidth, i);
+        }
+        for (size_t n = 0; n < packets.size(); n++) {
+            CHECK(av_packet_ref(packets[n].native(), images[n % kPatterns].native()) >= 0);
+            packets[n].native()->pts = packets[n].native()->dts = (int64_t)n * kFrameUs;
+        }
+    }
+
+    ~Grabbed() {
+        avcodec_parameters_free(&codecpar);
+    }
+};
+
+/**
+ * Writes the warm-up frames through a writer, then counts the allocations of the next ones.
+ * @return the allocations made while writing the counted frames.
+ */
+uint64_t writerAllocations(const bool encoderThread) {
+    Grabbed grabbed;
+    auto writer = assertExpected(av::StreamWriter::create(filename, true));
+    assertExpected(writer->addVideoStream(std::string_view{"libx264"}, kWidth, kHeight, AV_PIX_FMT_BGR0, {1, kFps}, {{"preset", "medium"}}));
+    if (encoderThread)
+        assertExpected(writer->startEncoderThread(0, 1));
+    assertExpected(writer->open());
+    auto framePool = assertExpected(av::FramePool::create(kWidth, kHeight, AV_PIX_FMT_BGR0, 4));
+
+    auto capture = [&](const int first, const int count) {
+        for (int n = first; n < first + count; n++) {
+            auto frame = assertExpected(framePool->acquire(false));
+            CHECK(av::Decoder::wrapRawPacket(grabbed.codecpar, grabbed.packets[n], *frame));
+            CHECK(writer->write(std::move(*frame), 0, AV_TIME_BASE_Q));
+        }
+    };
+    capture(0, kWarmupFrames);
+    allocations::Counter counter;
+    capture(kWarmupFrames, kFrames);
+    // counted before the flush, which ends the stream
+    const auto count = counter.count();
+    writer->flushAllStreams();
+    return count;
+}
+
+/**
+ * Same as writerAllocations() with the encoder and the muxer of the writer stream fed the converted frames directly.
+ */
+uint64_t referenceAllocations() {
+    auto encoder = assertExpected(av::Encoder::create("libx264"));
+    encoder->setVideoParams(kWidth, kHeight, AVRational{1, kFps}, {{"preset", "medium"}});
+    encoder->setThreading({});
+    encoder->native()->time_base = kVideoClock;
+    const auto payload = av_image_get_buffer_size(encoder->native()->pix_fmt, kWidth, kHeight, 1) / kPacketPoolShare;
+    encoder->setPacketPool(assertExpected(av::PacketPool::create(0, payload)));
+    assertExpected(encoder->open());
+    auto output = assertExpected(av::OutputFormat::create(filename));
+    CHECK(output->addStream(encoder).value() == 0);
+    assertExpected(output->open(filename));
+
+    auto scale = assertExpected(av::Scale::create(kWidth, kHeight, AV_PIX_FMT_BGR0, kWidth, kHeight, encoder->native()->pix_fmt));
+    std::vector<std::shared_ptr<av::Frame>> converted;
+    for (int i = 0; i < kPatterns; i++) {
+        auto image = assertExpected(av::Frame::create(kWidth, kHeight, AV_PIX_FMT_BGR0));
+        paint(image->native()->data[0], image->native()->linesize[0], i);
+        converted.push_back(assertExpected(encoder->newWriteableVideoFrame()));
+        scale->scale(*image, *converted.back());
+    }
+
+    std::vector<av::Packet> packets(8);
+    auto encode = [&](const int first, const int count) {
+        for (int n = first; n < first + count; n++) {
+            auto& frame = *converted[n % kPatterns];
+            frame.native()->pts = av_rescale_q(n * kFrameUs, AV_TIME_BASE_Q, kVideoClock);
+            const auto [res, size] = encoder->encodeFrame(frame, packets);
+            CHECK(res != av::Result::kFail);
+            for (int i = 0; i < size; i++)
+                CHECK(output->writePacket(packets[i], 0));
+        }
+    };
+    encode(0, kWarmupFrames);
+    allocations::Counter counter;
+    encode(kWarmupFrames, kFrames);
+    const auto count = counter.count();
+    encoder->flush(packets);
+    return count;
+}
+}
+
+int main() {
+    char dir[] = "/tmp/allocationsXXXXXX";
+    if (!avcodec_find_encoder_by_name("libx264") || !mkdtemp(dir))
+        return kSkipped;
+    filename = std::string{dir} + "/capture.mp4";
+
+    const auto reference = referenceAllocations();
+    const auto direct = writerAllocations(false);
+    const auto threaded = writerAllocations(true);
+    std::remove(filename.c_str());
+    rmdir(dir);
+
+    std::printf("%d frames, allocations of the encoder and muxer alone: %llu (%.2f per frame)\n", kFrames, (unsigned long long)reference,
+                (double)reference / kFrames);
+    std::printf("written on the calling thread: %llu (%.2f per frame)\n", (unsigned long long)direct, (double)direct / kFrames);
+    std::printf("written through an encoder thread: %llu (%.2f per frame)\n", (unsigned long long)threaded, (double)threaded / kFrames);
+    CHECK(direct <= reference);
+    // the frames in flight at the two ends of the count are allowed for, an allocation per frame is far above it
+    CHECK(threaded <= reference + kFrames / 10);
+    return checkResult();
+}
@@ -0,0 +1,108 @@
+/**
+ * Frames per second of a 1080p H.264 recording on 4, 8 and 32 cores, with the encoder defaults against the plan of
+ * ThreadPlanner. The process is confined to the first cores of the host for each size, sizes the host does not have
+ * are skipped. The defaults encode on the capturing thread with as many x264 threads as it likes; the plan pins the
+ * capture, moves the conversion to its own core and gives the encoder the rest. Reported only: the gain depends on
+ * what else the host runs.
+ */
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <sched.h>
+#include <unistd.h>
+#include "Check.h"
+#include "../include/ThreadPlanner.h"
+#include "../libav-cpp-master/av/CpuAffinity.hpp"
+#include "../libav-cpp-master/av/StreamWriter.hpp"
+
+namespace {
+constexpr int kWidth = 1920;
+constexpr int kHeight = 1080;
+constexpr int kFps = 60;
+constexpr int kFrames = 240;
+constexpr int kPatterns = 8;
+constexpr int kCores[] = {4, 8, 32};
+
+std::string filename;
+cpu_set_t hostCores;
+
+std::vector<std::shared_ptr<av::Frame>> makePatterns() {
+    std::vector<std::shared_ptr<av::Frame>> res;
+    for (int n = 0; n < kPatterns; n++) {
+        auto frame = assertExpected(av::Frame::create(kWidth, kHeight, AV_PIX_FMT_BGR0));
+        auto f = frame->native();
+        for (int y = 0; y < kHeight; y++) {
+            auto row = f->data[0] + y * f->linesize[0];
+            for (int x = 0; x < 4 * kWidth; x++)
+                row[x] = (uint8_t)((x >> 2) * (n + 1) + y * 3 + (x & 3) * 64);
+        }
+        res.push_back(frame);
+    }
+    return res;
+}
+
+// the first cores of the host, false if it does not have them all
+bool confine(const int cores) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c = 0; c < cores; c++) {
+        if (c >= CPU_SETSIZE || !CPU_ISSET(c, &hostCores))
+            return false;
+        CPU_SET(c, &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+/**
+ * Records the patterns as fast as the writer takes them.
+ * @param plan: the thread plan, null for the encoder defaults.
+ * @return the frames per second, flush included.
+ */
+double record(const std::vector<std::shared_ptr<av::Frame>>& patterns, const ThreadPlan* plan) {
+    auto writer = assertExpected(av::StreamWriter::create(filename, true));
+    const auto index = assertExpected(writer->addVideoStream(AV_CODEC_ID_H264, kWidth, kHeight, AV_PIX_FMT_BGR0, {1, kFps},
+                                                             {{"preset", "medium"}}, plan ? plan->video : av::EncoderThreading{}));
+    if (plan)
+        assertExpected(writer->startEncoderThread(index, av::StreamWriter::kQueueFrames, plan->conversionMask));
+    assertExpected(writer->open());
+
+    av::ScopedAffinity capture{plan ? plan->captureMask : 0};
+    const auto seconds = timeIt([&] {
+        for (int n = 0; n < kFrames; n++) {
+            auto& frame = *patterns[n % kPatterns];
+            frame.native()->pts = n;
+            CHECK(writer->write(frame, index, {1, kFps}));
+        }
+        writer->flushAllStreams();
+    });
+    writer.reset();
+    std::remove(filename.c_str());
+    return kFrames / seconds;
+}
+}
+
+int main() {
+    char dir[] = "/tmp/budgetXXXXXX";
+    if (!avcodec_find_encoder_by_name("libx264") || sched_getaffinity(0, sizeof(hostCores), &hostCores) != 0 || !mkdtemp(dir))
+        return kSkipped;
+    filename = std::string{dir} + "/budget.mp4";
+    const auto patterns = makePatterns();
+
+    int measured = 0;
+    for (const auto cores : kCores) {
+        if (!confine(cores)) {
+            std::printf("%d cores: not on this host, skipped\n", cores);
+            continue;
+        }
+        const auto defaults = record(patterns, nullptr);
+        const auto plan = ThreadPlanner::plan(cores, kHeight);
+        const auto planned = record(patterns, &plan);
+        std::printf("%d cores: defaults %.1f fps, planned %.1f fps (%d encoder threads)\n", cores, defaults, planned, plan.video.threads);
+        measured++;
+    }
+    sched_setaffinity(0, sizeof(hostCores), &hostCores);
+    rmdir(dir);
+    if (!measured)
+        return kSkipped;
+    return checkResult();
+}
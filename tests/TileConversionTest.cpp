@@ -0,0 +1,109 @@
+/**
+ * Tile conversion of StreamWriter against the whole frame conversion. The same BGR0 captures are written to a stream
+ * converting only the changed tiles and to one converting every frame whole, and the YUV 4:2:0 frames handed to their
+ * encoders must be identical: the chroma of a changed tile is downsampled with its neighbours, a tile converted on
+ * its own would leave seams at its edges. The captures change a few tiles per frame, across tile edges and at the
+ * partial tiles of the right and bottom edges, on a sharp pattern the chroma filters smear.
+ */
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "Check.h"
+#include "../libav-cpp-master/av/StreamWriter.hpp"
+
+namespace {
+constexpr int kWidth = 656; // not a multiple of the tiles
+constexpr int kHeight = 360;
+constexpr int kTileSize = 64;
+constexpr int kFrames = 30;
+
+std::string directory;
+
+// one pixel stripes of saturated colours, with a square moving across tile edges and the corner flickering
+void drawCapture(av::Frame& frame, const int n) {
+    auto f = frame.native();
+    for (int y = 0; y < kHeight; y++) {
+        auto row = reinterpret_cast<uint32_t*>(f->data[0] + y * f->linesize[0]);
+        for (int x = 0; x < kWidth; x++) {
+            uint32_t v = (x + y) % 2 ? 0xff0000 : 0x00ff40;
+            if (x >= 40 + 5 * n && x < 100 + 5 * n && y >= 50 + 3 * n && y < 90 + 3 * n)
+                v = 0x0000ff ^ (uint32_t)(x * 3 + y * 5);
+            if (x >= kWidth - 20 && y >= kHeight - 30 && n % 2)
+                v = 0xffffff;
+            row[x] = v;
+        }
+    }
+}
+
+/**
+ * Records the captures.
+ * @param tiles: if the stream converts only the changed tiles.
+ * @param stats: the tile statistics of the stream.
+ * @return the frames handed to the encoder.
+ */
+std::vector<av::Frame> record(const std::vector<std::shared_ptr<av::Frame>>& captures, const bool tiles, av::StreamWriter::TileStats& stats) {
+    std::vector<av::Frame> converted;
+    const auto filename = directory + (tiles ? "/tiles.mkv" : "/whole.mkv");
+    {
+        auto writer = assertExpected(av::StreamWriter::create(filename));
+        const auto index = assertExpected(writer->addVideoStream(AV_CODEC_ID_MPEG4, kWidth, kHeight, AV_PIX_FMT_BGR0, {1, 25}));
+        if (tiles)
+            assertExpected(writer->enableTileConversion(index, kTileSize));
+        // a reference keeps the frame intact, the next conversion goes to other planes
+        assertExpected(writer->setFrameCallback(index, [&converted](const av::Frame& frame) { converted.push_back(frame); }));
+        assertExpected(writer->open());
+        for (auto& capture : captures)
+            CHECK(writer->write(*capture, index));
+        writer->flushAllStreams();
+        stats = writer->tileStats(index);
+    }
+    std::remove(filename.c_str());
+    return converted;
+}
+
+// the pixels of a plane that differ
+int differences(const AVFrame* a, const AVFrame* b, const int plane) {
+    const auto fmt = static_cast<AVPixelFormat>(a->format);
+    const int shift = plane ? av_pix_fmt_desc_get(fmt)->log2_chroma_h : 0;
+    const int bytes = av_image_get_linesize(fmt, a->width, plane);
+    int res = 0;
+    for (int y = 0; y < AV_CEIL_RSHIFT(a->height, shift); y++) {
+        for (int x = 0; x < bytes; x++)
+            res += a->data[plane][y * a->linesize[plane] + x] != b->data[plane][y * b->linesize[plane] + x];
+    }
+    return res;
+}
+}
+
+int main() {
+    char dir[] = "/tmp/tilesXXXXXX";
+    if (!avcodec_find_encoder(AV_CODEC_ID_MPEG4) || !mkdtemp(dir))
+        return kSkipped;
+    directory = dir;
+
+    std::vector<std::shared_ptr<av::Frame>> captures;
+    for (int n = 0; n < kFrames; n++) {
+        captures.push_back(assertExpected(av::Frame::create(kWidth, kHeight, AV_PIX_FMT_BGR0)));
+        drawCapture(*captures.back(), n);
+    }
+
+    av::StreamWriter::TileStats stats, unused;
+    const auto tiled = record(captures, true, stats);
+    const auto whole = record(captures, false, unused);
+    rmdir(dir);
+
+    std::printf("%llu of %llu tiles converted\n", (unsigned long long)stats.convertedTiles, (unsigned long long)stats.tiles);
+    // the first frame is converted whole, the others tile by tile
+    CHECK(stats.convertedTiles < stats.tiles / 2);
+    CHECK(tiled.size() == (size_t)kFrames && whole.size() == (size_t)kFrames);
+    for (size_t n = 0; n < tiled.size() && n < whole.size(); n++) {
+        for (int plane = 0; plane < 3; plane++) {
+            const int diff = differences(tiled[n].native(), whole[n].native(), plane);
+            if (diff)
+                std::fprintf(stderr, "frame %zu, plane %d: %d bytes differ\n", n, plane, diff);
+            CHECK(!diff);
+        }
+    }
+    return checkResult();
+}